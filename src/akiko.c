@@ -274,15 +274,30 @@ static uae_u32 akiko_buffer[8];
 static int akiko_read_offset, akiko_write_offset;
 static uae_u32 akiko_result[8];
 
+/* Bit r of the k-th byte of the chunky data, taking the bytes of each
+ * longword from the least significant end and the longwords from the last
+ * one written, ends up as bit k of plane r. Each group of eight bytes is
+ * therefore an 8x8 bit matrix to be transposed, which is done in a 64-bit
+ * word by swapping ever larger blocks across the diagonal. */
 static void akiko_c2p_do (void)
 {
-    int i;
-
-    for (i = 0; i < 8; i++) akiko_result[i] = 0;
-    /* FIXME: better c2p algoritm than this piece of crap.... */
-    for (i = 0; i < 8 * 32; i++) {
-	if (akiko_buffer[7 - (i >> 5)] & (1 << (i & 31)))
-	    akiko_result[i & 7] |= 1 << (i >> 3);
+    int g, r;
+
+    for (r = 0; r < 8; r++)
+	akiko_result[r] = 0;
+    for (g = 0; g < 4; g++) {
+	uae_u64 x = akiko_buffer[7 - 2 * g] | ((uae_u64)akiko_buffer[6 - 2 * g] << 32);
+	uae_u64 t;
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x ^= t ^ (t << 28);
+
+	for (r = 0; r < 8; r++)
+	    akiko_result[r] |= (uae_u32)((x >> (8 * r)) & 0xff) << (8 * g);
     }
 }
 
@@ -312,6 +327,27 @@ static uae_u32 akiko_c2p_read (int offset)
     return v >> (8 * (3 - offset));
 }
 
+/* Longword accesses to 0xb80038, which is how the C2P register is normally
+ * used, done in one go rather than as four byte accesses. */
+static void akiko_c2p_write_long (uae_u32 v)
+{
+    akiko_buffer[akiko_write_offset] = v;
+    akiko_write_offset = (akiko_write_offset + 1) & 7;
+    akiko_read_offset = 0;
+}
+
+static uae_u32 akiko_c2p_read_long (void)
+{
+    uae_u32 v;
+
+    if (akiko_read_offset == 0)
+	akiko_c2p_do ();
+    akiko_write_offset = 0;
+    v = akiko_result[akiko_read_offset];
+    akiko_read_offset = (akiko_read_offset + 1) & 7;
+    return v;
+}
+
 /* CD32 CDROM hardware emulation
  * Akiko addresses used:
  * 0xb80004-0xb80028
@@ -356,10 +392,24 @@ static int cdrom_current_sector;
 static int cdrom_data_end, cdrom_leadout;
 static int cdrom_dosomething;
 
-static uae_u8 *sector_buffer_1, *sector_buffer_2;
-static int sector_buffer_sector_1, sector_buffer_sector_2;
-#define SECTOR_BUFFER_SIZE 64
-static uae_u8 *sector_buffer_info_1, *sector_buffer_info_2;
+/* Data sectors are read by akiko_thread into a cache, ahead of where the
+ * emulated drive is reading. Slots are found through a hash of the sector
+ * number; when the cache is full, the least recently used one is reused.
+ * The read-ahead window doubles with every sector that follows the
+ * previous one and drops back to the minimum on a seek. */
+#define SECTOR_CACHE_MIN_SLOTS 64
+#define SECTOR_HASH_SIZE 1024
+#define READAHEAD_MIN 8
+#define READAHEAD_MAX 256
+static uae_u8 *sector_cache;
+static int *sector_cache_sector, *sector_cache_next, *sector_cache_used;
+static uae_u8 *sector_cache_ok;
+static int sector_cache_slots, sector_cache_clock, sector_cache_generation;
+static int sector_hash[SECTOR_HASH_SIZE];
+static int sector_wanted = -1, sector_missed = -1, sector_readahead;
+static int sector_cache_hits, sector_cache_misses;
+static int akiko_thread_idle;
+static uae_sem_t akiko_wake;
 
 static int unitnum = -1;
 
@@ -838,6 +888,131 @@ static void cdrom_run_command_run (void)
 
 static uae_sem_t akiko_sem;
 
+/* The sector cache; akiko_sem must be held for all of these. */
+
+/* Forget all sectors and where the drive was reading; a read that is
+ * already in progress sees the new generation and is not stored. */
+static void sector_cache_flush (void)
+{
+    int i;
+
+    for (i = 0; i < SECTOR_HASH_SIZE; i++)
+	sector_hash[i] = -1;
+    for (i = 0; i < sector_cache_slots; i++) {
+	sector_cache_sector[i] = -1;
+	sector_cache_used[i] = 0;
+    }
+    sector_cache_clock = 0;
+    sector_wanted = sector_missed = -1;
+    sector_cache_generation++;
+}
+
+/* Next time stamp for a slot that is used; halving all stamps before the
+ * clock overflows keeps their order. */
+static int sector_cache_stamp (void)
+{
+    int i;
+
+    if (sector_cache_clock >= 0x40000000) {
+	for (i = 0; i < sector_cache_slots; i++)
+	    sector_cache_used[i] >>= 1;
+	sector_cache_clock >>= 1;
+    }
+    return ++sector_cache_clock;
+}
+
+static int sector_cache_find (int sector)
+{
+    int i = sector_hash[sector & (SECTOR_HASH_SIZE - 1)];
+
+    while (i >= 0 && sector_cache_sector[i] != sector)
+	i = sector_cache_next[i];
+    if (i >= 0)
+	sector_cache_used[i] = sector_cache_stamp ();
+    return i;
+}
+
+static void sector_cache_insert (int sector, const uae_u8 *p)
+{
+    int *link;
+    int i, victim = 0;
+
+    for (i = 1; i < sector_cache_slots && sector_cache_used[victim]; i++) {
+	if (sector_cache_used[i] < sector_cache_used[victim])
+	    victim = i;
+    }
+    if (sector_cache_sector[victim] >= 0) {
+	link = &sector_hash[sector_cache_sector[victim] & (SECTOR_HASH_SIZE - 1)];
+	while (*link != victim)
+	    link = &sector_cache_next[*link];
+	*link = sector_cache_next[victim];
+    }
+
+    sector_cache_sector[victim] = sector;
+    sector_cache_ok[victim] = p != 0;
+    if (p)
+	memcpy (sector_cache + victim * 2048, p, 2048);
+    sector_cache_used[victim] = sector_cache_stamp ();
+    link = &sector_hash[sector & (SECTOR_HASH_SIZE - 1)];
+    sector_cache_next[victim] = *link;
+    *link = victim;
+}
+
+/* Tell the thread which sector the drive will read next. */
+static void sector_cache_want (int sector)
+{
+    if (sector == sector_wanted)
+	return;
+    if (sector == sector_wanted + 1) {
+	if (sector_readahead < READAHEAD_MAX && sector_readahead < sector_cache_slots / 2)
+	    sector_readahead *= 2;
+    } else
+	sector_readahead = READAHEAD_MIN;
+    sector_wanted = sector;
+    if (akiko_thread_idle) {
+	akiko_thread_idle = 0;
+	uae_sem_post (&akiko_wake);
+    }
+}
+
+static int sector_cache_alloc (int megabytes)
+{
+    int slots = (size_t)megabytes * 1024 * 1024 / 2048;
+
+    if (slots < SECTOR_CACHE_MIN_SLOTS)
+	slots = SECTOR_CACHE_MIN_SLOTS;
+    sector_cache = malloc ((size_t)slots * 2048);
+    sector_cache_sector = malloc (slots * sizeof (int));
+    sector_cache_next = malloc (slots * sizeof (int));
+    sector_cache_used = malloc (slots * sizeof (int));
+    sector_cache_ok = malloc (slots);
+    if (!sector_cache || !sector_cache_sector || !sector_cache_next
+	|| !sector_cache_used || !sector_cache_ok)
+	return 0;
+    sector_cache_slots = slots;
+    sector_cache_flush ();
+    sector_readahead = READAHEAD_MIN;
+    sector_cache_hits = sector_cache_misses = 0;
+    return 1;
+}
+
+static void sector_cache_free (void)
+{
+    if (sector_cache_hits + sector_cache_misses > 0)
+	write_log ("Akiko: %d of %d sectors read from the cache (%d%%).\n",
+		   sector_cache_hits, sector_cache_hits + sector_cache_misses,
+		   sector_cache_hits * 100 / (sector_cache_hits + sector_cache_misses));
+    free (sector_cache);
+    free (sector_cache_sector);
+    free (sector_cache_next);
+    free (sector_cache_used);
+    free (sector_cache_ok);
+    sector_cache = 0;
+    sector_cache_sector = sector_cache_next = sector_cache_used = 0;
+    sector_cache_ok = 0;
+    sector_cache_slots = 0;
+}
+
 /* DMA transfer one CD sector */
 static void cdrom_run_read (void)
 {
@@ -856,10 +1031,15 @@ static void cdrom_run_read (void)
     if (unitnum >= 0 && cdrom_readmask_w & (1 << j)) {
 	uae_sem_wait (&akiko_sem);
 	sector = cdrom_current_sector = cdrom_data_offset + cdrom_sector_counter;
-	sec = sector - sector_buffer_sector_1;
-	if (sector_buffer_sector_1 >= 0 && sec >= 0 && sec < SECTOR_BUFFER_SIZE) {
-	    if (sector_buffer_info_1[sec] != 0xff && sector_buffer_info_1[sec] != 0) {
-		memcpy (buf + 16, sector_buffer_1 + sec * 2048, 2048);
+	sec = sector_cache_find (sector);
+	if (sec >= 0) {
+	    if (sector == sector_missed)
+		sector_missed = -1;
+	    else
+		sector_cache_hits++;
+	    sector_cache_want (sector + 1);
+	    if (sector_cache_ok[sec]) {
+		memcpy (buf + 16, sector_cache + sec * 2048, 2048);
 		encode_l2 (buf, sector + 150);
 		buf[0] = 0;
 		buf[1] = 0;
@@ -869,9 +1049,13 @@ static void cdrom_run_read (void)
 		    put_byte (cdrom_address1 + j * 4096 + i, buf[i]);
 		cdrom_readmask_r |= 1 << j;
 	    }
-	    if (sector_buffer_info_1[sec] != 0xff)
-		sector_buffer_info_1[sec]--;
 	} else {
+	    /* Not read yet; try again at the next sector time. */
+	    if (sector != sector_missed) {
+		sector_missed = sector;
+		sector_cache_misses++;
+	    }
+	    sector_cache_want (sector);
 	    uae_sem_post (&akiko_sem);
 	    return;
 	}
@@ -911,6 +1095,9 @@ static void akiko_handler (void)
 	if (media != lastmediastate) {
 	    write_log ("media changed = %d\n", media);
 	    lastmediastate = cdrom_disk = media;
+	    uae_sem_wait (&akiko_sem);
+	    sector_cache_flush ();
+	    uae_sem_post (&akiko_sem);
 	    cdrom_return_data (cdrom_command_media_status ());
 	    cdrom_toc ();
 	     /* do not remove! first try may fail */
@@ -935,6 +1122,16 @@ static void akiko_internal (void)
     }
 }
 
+/* The CD command timing counts accesses to Akiko, so a longword access
+ * that is not split into bytes still has to count as four. */
+static void akiko_internal4 (void)
+{
+    akiko_internal ();
+    akiko_internal ();
+    akiko_internal ();
+    akiko_internal ();
+}
+
 extern int cd32_enabled;
 
 void AKIKO_hsync_handler (void)
@@ -961,55 +1158,41 @@ static volatile int akiko_thread_running;
 /* cdrom data buffering thread */
 static void *akiko_thread (void *null)
 {
-    int i;
-    uae_u8 *tmp1;
-    uae_u8 *tmp2;
-    int tmp3;
-    int offset;
-    int sector;
-
     sys_command_open_thread (DF_IOCTL, unitnum);
-    while(akiko_thread_running) {
+    while (akiko_thread_running) {
+	const uae_u8 *p = 0;
+	int sector = -1;
+	int i, generation;
+
+	/* Find the first sector in the read-ahead window that is not
+	 * cached yet, marking the ones that are as recently used. */
 	uae_sem_wait (&akiko_sem);
-	sector = cdrom_current_sector;
-	for (i = 0; i < SECTOR_BUFFER_SIZE; i++) {
-	    if (sector_buffer_info_1[i] == 0xff) break;
+	if (cdrom_data_end > 0 && sector_wanted >= 0) {
+	    for (i = 0; i < sector_readahead; i++) {
+		if (sector_cache_find (sector_wanted + i) < 0) {
+		    sector = sector_wanted + i;
+		    break;
+		}
+	    }
 	}
-	if (cdrom_data_end > 0 && sector >= 0 && (sector_buffer_sector_1 < 0 || sector < sector_buffer_sector_1 || sector >= sector_buffer_sector_1 + SECTOR_BUFFER_SIZE * 2 / 3 || i != SECTOR_BUFFER_SIZE)) {
-
-	    uae_sem_post (&akiko_sem);
+	if (sector < 0)
+	    akiko_thread_idle = 1;
+	generation = sector_cache_generation;
+	uae_sem_post (&akiko_sem);
 
-	    memset (sector_buffer_info_2, 0, SECTOR_BUFFER_SIZE);
+	if (sector < 0) {
+	    uae_sem_wait (&akiko_wake);
+	    continue;
+	}
 #if AKIKO_DEBUG_IO_CMD
-	    write_log ("filling buffer sector=%d (max=%d)\n", sector, cdrom_data_end);
+	write_log ("reading ahead sector=%d (max=%d)\n", sector, cdrom_data_end);
 #endif
-	    sector_buffer_sector_2 = sector;
-	    offset = 0;
-	    while (offset < SECTOR_BUFFER_SIZE) {
-		const uae_u8 *p = 0;
-		if (sector < cdrom_data_end)
-		    p = sys_command_read (DF_IOCTL, unitnum, sector);
-		if (p)
-		    memcpy (sector_buffer_2 + offset * 2048, p, 2048);
-		sector_buffer_info_2[offset] = p ? 3 : 0;
-		offset++;
-		sector++;
-	    }
-
-	    uae_sem_wait (&akiko_sem);
-
-	    tmp1 = sector_buffer_info_1;
-	    sector_buffer_info_1 = sector_buffer_info_2;
-	    sector_buffer_info_2 = tmp1;
-	    tmp2 = sector_buffer_1;
-	    sector_buffer_1 = sector_buffer_2;
-	    sector_buffer_2 = tmp2;
-	    tmp3 = sector_buffer_sector_1;
-	    sector_buffer_sector_1 = sector_buffer_sector_2;
-	    sector_buffer_sector_2 = tmp3;
-	}
+	if (sector < cdrom_data_end)
+	    p = sys_command_read (DF_IOCTL, unitnum, sector);
+	uae_sem_wait (&akiko_sem);
+	if (generation == sector_cache_generation)
+	    sector_cache_insert (sector, p);
 	uae_sem_post (&akiko_sem);
-	uae_msleep (10);
     }
     sys_command_close_thread (DF_IOCTL, unitnum);
     akiko_thread_running = -1;
@@ -1145,6 +1328,11 @@ uae_u32 REGPARAM2 akiko_lget (uaecptr addr)
     uae_u32 v;
 
     addr &= 0xffff;
+    if (addr == 0x38) {
+	v = akiko_c2p_read_long ();
+	akiko_internal4 ();
+	return v;
+    }
     v = akiko_bget2 (addr + 3, 0);
     v |= akiko_bget2 (addr + 2, 0) << 8;
     v |= akiko_bget2 (addr + 1, 0) << 16;
@@ -1268,6 +1456,11 @@ void REGPARAM2 akiko_lput (uaecptr addr, uae_u32 v)
 
     if(addr < 0x30 && AKIKO_DEBUG_IO)
 	write_log ("akiko_lput %08.8X: %08.8X=%08.8X\n", m68k_getpc (&regs), addr, v);
+    if (addr == 0x38) {
+	akiko_c2p_write_long (v);
+	akiko_internal4 ();
+	return;
+    }
     akiko_bput2 (addr + 3, (v >> 0) & 0xff, 0);
     akiko_bput2 (addr + 2, (v >> 8) & 0xff, 0);
     akiko_bput2 (addr + 1, (v >> 16) & 0xff, 0);
@@ -1292,6 +1485,7 @@ void akiko_reset (void)
 
     if (akiko_thread_running > 0) {
 	akiko_thread_running = 0;
+	uae_sem_post (&akiko_wake);
 	while(akiko_thread_running == 0)
 	    uae_msleep (10);
 	akiko_thread_running = 0;
@@ -1301,14 +1495,7 @@ void akiko_reset (void)
 	if (unitnum >= 0)
 	    sys_cddev_close ();
 	unitnum = -1;
-	free (sector_buffer_1);
-	free (sector_buffer_2);
-	free (sector_buffer_info_1);
-	free (sector_buffer_info_2);
-	sector_buffer_1 = 0;
-	sector_buffer_2 = 0;
-	sector_buffer_info_1 = 0;
-	sector_buffer_info_2 = 0;
+	sector_cache_free ();
 	cdromok = 0;
     }
 }
@@ -1357,13 +1544,13 @@ int akiko_init (void)
 	    return 0;
 	}
 	if (!sys_cddev_open ()) {
+	    if (!sector_cache_alloc (currprefs.cd32_cache_size)) {
+		write_log ("Akiko: out of memory for the sector cache\n");
+		sector_cache_free ();
+		sys_cddev_close ();
+		return 0;
+	    }
 	    cdromok = 1;
-	    sector_buffer_1 = malloc (SECTOR_BUFFER_SIZE * 2048);
-	    sector_buffer_2 = malloc (SECTOR_BUFFER_SIZE * 2048);
-	    sector_buffer_info_1 = malloc (SECTOR_BUFFER_SIZE);
-	    sector_buffer_info_2 = malloc (SECTOR_BUFFER_SIZE);
-	    sector_buffer_sector_1 = -1;
-	    sector_buffer_sector_2 = -1;
 	    patchrom ();
 	}
     }
@@ -1371,6 +1558,7 @@ int akiko_init (void)
 	cdrom_playing = cdrom_paused = 0;
 	cdrom_data_offset = -1;
 	uae_sem_init (&akiko_sem, 0, 1);
+	uae_sem_init (&akiko_wake, 0, 0);
     }
     if (cdromok && !akiko_thread_running) {
 	akiko_thread_running = 1;
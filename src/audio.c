@@ -29,7 +29,8 @@
 #ifdef AVIOUTPUT
 # include "avioutput.h"
 #endif
-#include "sinctable.h"
+#include "sincqueue.h"
+#include "soundcapture.h"
 #include "gui.h" /* for gui_ledstate */
 #include "threaddep/thread.h"
 
@@ -50,20 +51,6 @@ static int debugchannel (unsigned int ch)
     return 0;
 }
 
-/* periods less than this value are replaced by this value. */
-#define MIN_ALLOWED_PERIOD 16
-/* reserve ~20 extra slots in sinc queue for cpu volume or some such updates
- * even at maximum period. This avoids sinc queue overflow on games like
- * battle squadron that write these low period values and do cpu-based
- * updates on paula registers, probably volume. */
-#define NUMBER_OF_CPU_UPDATES_ALLOWED 20
-
-#define SINC_QUEUE_LENGTH (SINC_QUEUE_MAX_AGE / MIN_ALLOWED_PERIOD + NUMBER_OF_CPU_UPDATES_ALLOWED)
-
-typedef struct {
-    int age, output;
-} sinc_queue_t;
-
 struct audio_channel_data {
     unsigned long adk_mask;
     unsigned long evtime;
@@ -80,8 +67,7 @@ struct audio_channel_data {
     uae_u16 dat, dat2;
     int request_word, request_word_skip;
     int sinc_output_state;
-    sinc_queue_t sinc_queue[SINC_QUEUE_LENGTH];
-    int sinc_queue_length;
+    struct sinc_queue sinc_queue;
 };
 
 STATIC_INLINE unsigned int current_hpos (void)
@@ -100,6 +86,13 @@ static void (*sample_prehandler) (unsigned long best_evtime);
 static unsigned long scaled_sample_evtime;
 static unsigned long last_cycles, next_sample_evtime;
 
+/* Set when no channel can change its state or output until one of its
+ * registers is written or its DMA is switched on. All update_audio() has
+ * to do then is to produce the samples that are due, which all come out
+ * the same. Anything that may wake a channel clears it; audio_hsync()
+ * looks whether it can be set again. */
+static int audio_idle;
+
 unsigned int obtainedfreq;
 
 
@@ -172,7 +165,7 @@ STATIC_INLINE void put_sound_word_left (uae_u32 w)
 
 static void sinc_prehandler (unsigned long best_evtime)
 {
-    int i, j, output;
+    int i, output, dropped;
     struct audio_channel_data *acd;
 
     for (i = 0; i < 4; i++) {
@@ -180,27 +173,13 @@ static void sinc_prehandler (unsigned long best_evtime)
 	output = (acd->current_sample * acd->vol) & acd->adk_mask;
 
 	/* age the sinc queue and truncate it when necessary */
-	for (j = 0; j < acd->sinc_queue_length; j += 1) {
-	    acd->sinc_queue[j].age += best_evtime;
-	    if (acd->sinc_queue[j].age >= SINC_QUEUE_MAX_AGE) {
-		acd->sinc_queue_length = j;
-		break;
-	    }
-	}
+	sinc_queue_advance (&acd->sinc_queue, best_evtime);
 	/* if output state changes, record the state change and also
 	 * write data into sinc queue for mixing in the BLEP */
 	if (acd->sinc_output_state != output) {
-	    if (acd->sinc_queue_length > SINC_QUEUE_LENGTH - 1) {
-		write_log ("warning: sinc queue truncated. Last age: %d.\n",
-			   acd->sinc_queue[SINC_QUEUE_LENGTH-1].age);
-		acd->sinc_queue_length = SINC_QUEUE_LENGTH - 1;
-	    }
-	    /* make room for new and add the new value */
-	    memmove (&acd->sinc_queue[1], &acd->sinc_queue[0],
-		     sizeof(acd->sinc_queue[0]) * acd->sinc_queue_length);
-	    acd->sinc_queue_length += 1;
-	    acd->sinc_queue[0].age = best_evtime;
-	    acd->sinc_queue[0].output = output - acd->sinc_output_state;
+	    dropped = sinc_queue_push (&acd->sinc_queue, output - acd->sinc_output_state, best_evtime);
+	    if (dropped >= 0)
+		write_log ("warning: sinc queue truncated. Last age: %d.\n", dropped);
 	    acd->sinc_output_state = output;
 	}
     }
@@ -231,13 +210,12 @@ STATIC_INLINE void samplexx_sinc_handler (int *datasp)
     winsinc = winsinc_integral[n];
 
     for (i = 0; i < 4; i += 1) {
-	int j, v;
+	int v;
 	struct audio_channel_data *acd = &audio_channel[i];
 	/* The sum rings with harmonic components up to infinity... */
 	int sum = acd->sinc_output_state << 17;
 	/* ...but we cancel them through mixing in BLEPs instead */
-	for (j = 0; j < acd->sinc_queue_length; j += 1)
-	    sum -= winsinc[acd->sinc_queue[j].age] * acd->sinc_queue[j].output;
+	sum -= sinc_queue_mix (&acd->sinc_queue, winsinc);
 	v = sum >> 17;
 	if (v > 32767)
 	    v = 32767;
@@ -655,6 +633,60 @@ void schedule_audio (void)
 
 extern unsigned int have_sound;
 
+/* Sample rate steering. Sound drivers that queue their output report how
+ * full the queue is, and the time between output samples is stretched or
+ * shrunk by up to RATE_ADJUST_LIMIT to keep the queue at the level the
+ * driver asks for. This is a PI controller; the integral term leaks away
+ * slowly, since a driver that blocks when its queue is full never reports
+ * it overfull. Moving the sampling instants is all the resampling that is
+ * needed, since the interpolators already evaluate the Paula output at
+ * arbitrary positions (the sinc one band-limited). */
+#define RATE_ADJUST_LIMIT 0.005
+#define RATE_ADJUST_KP    0.002
+#define RATE_ADJUST_KI    0.0001
+#define RATE_ADJUST_LEAK  0.999
+
+static unsigned long scaled_sample_evtime_orig;
+static double rate_adjust, rate_adjust_integral;
+
+static void set_scaled_sample_evtime (void)
+{
+    scaled_sample_evtime = (unsigned long)(scaled_sample_evtime_orig * (1.0 + rate_adjust));
+}
+
+void sound_report_fill (int fill, int target)
+{
+    double err;
+
+    if (target <= 0 || !scaled_sample_evtime_orig)
+	return;
+
+    err = (double)(fill - target) / target;
+    if (err > 1.0)
+	err = 1.0;
+    else if (err < -1.0)
+	err = -1.0;
+
+    rate_adjust_integral = rate_adjust_integral * RATE_ADJUST_LEAK + err * RATE_ADJUST_KI;
+    if (rate_adjust_integral > RATE_ADJUST_LIMIT)
+	rate_adjust_integral = RATE_ADJUST_LIMIT;
+    else if (rate_adjust_integral < -RATE_ADJUST_LIMIT)
+	rate_adjust_integral = -RATE_ADJUST_LIMIT;
+
+    rate_adjust = err * RATE_ADJUST_KP + rate_adjust_integral;
+    if (rate_adjust > RATE_ADJUST_LIMIT)
+	rate_adjust = RATE_ADJUST_LIMIT;
+    else if (rate_adjust < -RATE_ADJUST_LIMIT)
+	rate_adjust = -RATE_ADJUST_LIMIT;
+
+    set_scaled_sample_evtime ();
+}
+
+double sound_get_rate_adjust (void)
+{
+    return rate_adjust;
+}
+
 void update_sound (unsigned int freq)
 {
 	if (!have_sound)
@@ -663,12 +695,13 @@ void update_sound (unsigned int freq)
     if (obtainedfreq) {
 	if (is_vsync ()) {
 	    if (currprefs.ntscmode)
-		scaled_sample_evtime = (unsigned long)(MAXHPOS_NTSC * MAXVPOS_NTSC * freq * CYCLE_UNIT + obtainedfreq - 1) / obtainedfreq;
+		scaled_sample_evtime_orig = (unsigned long)(MAXHPOS_NTSC * MAXVPOS_NTSC * freq * CYCLE_UNIT + obtainedfreq - 1) / obtainedfreq;
 	    else
-		scaled_sample_evtime = (unsigned long)(MAXHPOS_PAL * MAXVPOS_PAL * freq * CYCLE_UNIT + obtainedfreq - 1) / obtainedfreq;
+		scaled_sample_evtime_orig = (unsigned long)(MAXHPOS_PAL * MAXVPOS_PAL * freq * CYCLE_UNIT + obtainedfreq - 1) / obtainedfreq;
 	} else {
-	    scaled_sample_evtime = (unsigned long)(312.0 * 50 * CYCLE_UNIT / (obtainedfreq  / 227.0));
+	    scaled_sample_evtime_orig = (unsigned long)(312.0 * 50 * CYCLE_UNIT / (obtainedfreq  / 227.0));
 	}
+	set_scaled_sample_evtime ();
     }
 }
 
@@ -885,6 +918,7 @@ void audio_reset (void)
 	audio_channel[i].voltbl = sound_table[audio_channel[i].vol];
 #endif
 
+    audio_idle = 0;
     last_cycles = get_cycles ();
     next_sample_evtime = scaled_sample_evtime;
     schedule_audio ();
@@ -966,6 +1000,7 @@ void check_prefs_changed_audio (void)
     sample_prehandler = NULL;
     if (sample_handler == sample16si_sinc_handler || sample_handler == sample16i_sinc_handler)
 	sample_prehandler = sinc_prehandler;
+    audio_idle = 0;
     if (currprefs.produce_sound == 0) {
 	eventtab[ev_audio].active = 0;
 	events_schedule ();
@@ -980,6 +1015,17 @@ void update_audio (void)
 	return;
 
     n_cycles = get_cycles () - last_cycles;
+    if (audio_idle) {
+	if (currprefs.produce_sound > 1) {
+	    while (n_cycles >= next_sample_evtime) {
+		n_cycles -= next_sample_evtime;
+		next_sample_evtime = scaled_sample_evtime;
+		(*sample_handler) ();
+	    }
+	}
+	last_cycles = get_cycles () - n_cycles;
+	return;
+    }
     for (;;) {
 	unsigned long int best_evtime = n_cycles + 1;
 
@@ -1041,6 +1087,24 @@ extern uae_u8 cycle_line[];
 #endif
 uae_u16	dmacon;
 
+static int channels_idle (void)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	struct audio_channel_data *cdp = audio_channel + i;
+
+	if (cdp->state != 0 || cdp->evtime != MAX_EV || cdp->dmaen || cdp->request_word > 0)
+	    return 0;
+	/* The sinc interpolator still has steps to mix in. */
+	if (sample_prehandler
+	    && (cdp->sinc_queue.length != 0
+		|| cdp->sinc_output_state != (int)((cdp->current_sample * cdp->vol) & cdp->adk_mask)))
+	    return 0;
+    }
+    return 1;
+}
+
 void audio_hsync (int dmaaction)
 {
     unsigned int nr, handle;
@@ -1049,6 +1113,8 @@ void audio_hsync (int dmaaction)
 	return;
 
     update_audio ();
+    if (audio_idle && !((dmacon & DMA_MASTER) && (dmacon & 15)))
+	return;
     handle = 0;
     /* Sound data is fetched at the beginning of each line */
     for (nr = 0; nr < 4; nr++) {
@@ -1102,6 +1168,7 @@ void audio_hsync (int dmaaction)
 	schedule_audio ();
 	events_schedule ();
     }
+    audio_idle = channels_idle ();
 }
 
 void AUDxDAT (unsigned int nr, uae_u16 v)
@@ -1114,6 +1181,7 @@ void AUDxDAT (unsigned int nr, uae_u16 v)
 	    v, cdp->state, isirq(nr) ? 1 : 0, m68k_getpc (&regs));
 #endif
     update_audio ();
+    audio_idle = 0;
     cdp->dat2 = v;
     cdp->request_word = -1;
     cdp->request_word_skip = 0;
@@ -1128,6 +1196,7 @@ void AUDxDAT (unsigned int nr, uae_u16 v)
 void AUDxLCH (unsigned int nr, uae_u16 v)
 {
     update_audio ();
+    audio_idle = 0;
     audio_channel[nr].lc = (audio_channel[nr].lc & 0xffff) | ((uae_u32)v << 16);
 #ifdef DEBUG_AUDIO
     if (debugchannel (nr))
@@ -1138,6 +1207,7 @@ void AUDxLCH (unsigned int nr, uae_u16 v)
 void AUDxLCL (unsigned int nr, uae_u16 v)
 {
     update_audio ();
+    audio_idle = 0;
     audio_channel[nr].lc = (audio_channel[nr].lc & ~0xffff) | (v & 0xFFFE);
 #ifdef DEBUG_AUDIO
     if (debugchannel (nr))
@@ -1149,6 +1219,7 @@ void AUDxPER (unsigned int nr, uae_u16 v)
 {
     unsigned long per = v * CYCLE_UNIT;
     update_audio ();
+    audio_idle = 0;
 
     if (per == 0)
 	per = PERIOD_MAX - 1;
@@ -1180,6 +1251,7 @@ void AUDxPER (unsigned int nr, uae_u16 v)
 void AUDxLEN (unsigned int nr, uae_u16 v)
 {
     update_audio ();
+    audio_idle = 0;
     audio_channel[nr].len = v;
 #ifdef DEBUG_AUDIO
     if (debugchannel (nr))
@@ -1191,6 +1263,7 @@ void AUDxVOL (unsigned int nr, uae_u16 v)
 {
     unsigned int v2 = v & 64 ? 63 : v & 63;
     update_audio ();
+    audio_idle = 0;
     audio_channel[nr].vol = v2;
 #ifndef MULTIPLICATION_PROFITABLE
     audio_channel[nr].voltbl = sound_table[v2];
@@ -1225,6 +1298,8 @@ void audio_update_irq (uae_u16 v)
 void audio_update_adkmasks (void)
 {
     unsigned long t = adkcon | (adkcon >> 4);
+
+    audio_idle = 0;
     audio_channel[0].adk_mask = (((t >> 0) & 1) - 1);
     audio_channel[1].adk_mask = (((t >> 1) & 1) - 1);
     audio_channel[2].adk_mask = (((t >> 2) & 1) - 1);
@@ -1240,6 +1315,27 @@ void audio_update_adkmasks (void)
 #endif
 }
 
+/* The capture is kept running over a reinitialization of the sound
+ * system as long as the format of the samples does not change, and the
+ * file is only written once per run. */
+static int capture_started;
+
+static void start_capture (void)
+{
+    int channels = currprefs.sound_stereo ? 2 : 1;
+
+    if (sound_capture_matches (obtainedfreq, channels))
+	return;
+    if (sound_capture_active) {
+	write_log ("Sound format changed, stopping capture.\n");
+	sound_capture_stop ();
+	return;
+    }
+    if (currprefs.sound_capture_file[0] && !capture_started++)
+	sound_capture_start (currprefs.sound_capture_file, currprefs.sound_capture_format,
+			     obtainedfreq, channels);
+}
+
 int audio_setup (void)
 {
     return setup_sound ();
@@ -1247,14 +1343,20 @@ int audio_setup (void)
 
 int audio_init (void)
 {
-    int result = init_sound ();
+    int result;
+
+    rate_adjust = rate_adjust_integral = 0.0;
+    result = init_sound ();
     update_sound (vblank_hz);
+    if (result && currprefs.produce_sound > 1)
+	start_capture ();
     return result;
 }
 
 void audio_close (void)
 {
     close_sound ();
+    sound_capture_stop ();
 }
 
 void audio_pause (void)
@@ -1291,6 +1393,7 @@ const uae_u8 *restore_audio (unsigned int channel, const uae_u8 *src)
     acd->lc = restore_u32 ();
     acd->pt = restore_u32 ();
     acd->evtime = restore_u32 ();
+    audio_idle = 0;
     return src;
 }
 
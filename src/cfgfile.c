@@ -28,6 +28,7 @@
 
 #include "sounddep/sound.h"
 #include "savestate.h"
+#include "inprec.h"
 #include "memory.h"
 #include "newcpu.h"
 #include "version.h"
@@ -140,6 +141,7 @@ static const char *centermode1[] = { "none", "simple", "smart", 0 };
 static const char *centermode2[] = { "false", "true", "smart", 0 };
 static const char *stereomode[] = { "mono", "stereo", "4ch", "mixed", 0 };
 static const char *interpolmode[] = { "none", "rh", "crux", "sinc", 0 };
+static const char *capturemode[] = { "wav", "flac", 0 };
 static const char *collmode[] = { "none", "sprites", "playfields", "full", 0 };
 static const char *compmode[] = { "direct", "indirect", "indirectKS", "afterPic", 0 };
 static const char *flushmode[]   = { "soft", "hard", 0 };
@@ -390,6 +392,8 @@ void save_options (FILE *f, const struct uae_prefs *p, int type)
 
     cfgfile_write (f, "nr_floppies=%d\n", p->nr_floppies);
     cfgfile_write (f, "floppy_speed=%d\n", p->floppy_speed);
+    if (p->dms_cache_dir[0])
+	cfgfile_write (f, "dms_cache_dir=%s\n", p->dms_cache_dir);
 #ifdef DRIVESOUND
     cfgfile_write (f, "floppy_volume=%d\n", p->dfxclickvolume);
 #endif
@@ -401,6 +405,7 @@ void save_options (FILE *f, const struct uae_prefs *p, int type)
 #ifndef WIN32
     cfgfile_write (f, "scsi_device=%s\n", p->scsi_device);
 #endif
+    cfgfile_write (f, "cd32_cache_size=%d\n", p->cd32_cache_size);
 
     cfgfile_write (f, "sound_output=%s\n", soundmode1[p->produce_sound]);
     cfgfile_write (f, "sound_channels=%s\n", stereomode[p->sound_stereo]);
@@ -412,6 +417,10 @@ void save_options (FILE *f, const struct uae_prefs *p, int type)
     cfgfile_write (f, "sound_adjust=%d\n", p->sound_adjust);
     cfgfile_write (f, "sound_volume=%d\n", p->sound_volume);
     cfgfile_write (f, "sound_latency=%d\n", p->sound_latency);
+    if (p->sound_capture_file[0]) {
+	cfgfile_write (f, "sound_capture_file=%s\n", p->sound_capture_file);
+	cfgfile_write (f, "sound_capture_format=%s\n", capturemode[p->sound_capture_format]);
+    }
 
 #ifdef JIT
     cfgfile_write (f, "comp_trustbyte=%s\n", compmode[p->comptrustbyte]);
@@ -861,7 +870,8 @@ static int cfgfile_parse_host (struct uae_prefs *p, char *option, char *value)
 #endif
 
     if    (cfgfile_string (option, value, "config_info", p->info, 256)
-	|| cfgfile_string (option, value, "config_description", p->description, 256))
+	|| cfgfile_string (option, value, "config_description", p->description, 256)
+	|| cfgfile_string (option, value, "dms_cache_dir", p->dms_cache_dir, 256))
 	return 1;
 
 #ifdef DEBUGGER
@@ -885,6 +895,7 @@ static int cfgfile_parse_host (struct uae_prefs *p, char *option, char *value)
     if (cfgfile_strval (option, value, "sound_output", &p->produce_sound, soundmode1, 1)
 	|| cfgfile_strval (option, value, "sound_output", &p->produce_sound, soundmode2, 0)
 	|| cfgfile_strval (option, value, "sound_interpol", &p->sound_interpol, interpolmode, 0)
+	|| cfgfile_strval (option, value, "sound_capture_format", &p->sound_capture_format, capturemode, 0)
 	|| cfgfile_strval (option, value, "use_gui", &p->start_gui, guimode1, 1)
 	|| cfgfile_strval (option, value, "use_gui", &p->start_gui, guimode2, 1)
 	|| cfgfile_strval (option, value, "use_gui", &p->start_gui, guimode3, 0)
@@ -997,6 +1008,14 @@ static int cfgfile_parse_host (struct uae_prefs *p, char *option, char *value)
 	strcpy (savestate_fname, tmpbuf);
 	return 1;
     }
+    if (cfgfile_string (option, value, "input_record", tmpbuf, sizeof (tmpbuf))) {
+	inprec_prepare (tmpbuf, INPREC_RECORD);
+	return 1;
+    }
+    if (cfgfile_string (option, value, "input_playback", tmpbuf, sizeof (tmpbuf))) {
+	inprec_prepare (tmpbuf, INPREC_PLAYBACK);
+	return 1;
+    }
 #endif
 
     if (cfgfile_strval (option, value, "sound_channels", &p->sound_stereo, stereomode, 1)) {
@@ -1128,6 +1147,7 @@ static int cfgfile_parse_hardware (struct uae_prefs *p, char *option, char *valu
 	|| cfgfile_string (option, value, "kickstart_ext_rom_file", p->romextfile, 256)
 	|| cfgfile_string (option, value, "kickstart_key_file", p->keyfile, 256)
 	|| cfgfile_string (option, value, "flash_file", p->flashfile, 256)
+	|| cfgfile_string (option, value, "sound_capture_file", p->sound_capture_file, 256)
 #ifdef ACTION_REPLAY
 	|| cfgfile_string (option, value, "cart_file", p->cartfile, 256)
 #endif
@@ -1175,6 +1195,14 @@ static int cfgfile_parse_hardware (struct uae_prefs *p, char *option, char *valu
 	}
     }
 
+    if (cfgfile_intval (option, value, "cd32_cache_size", &p->cd32_cache_size, 1)) {
+	if (p->cd32_cache_size < 0)
+	    p->cd32_cache_size = 0;
+	if (p->cd32_cache_size > 512)
+	    p->cd32_cache_size = 512;
+	return 1;
+    }
+
     if (cfgfile_intval (option, value, "cpu_speed", &p->m68k_speed, 1)) {
 	p->m68k_speed *= CYCLE_UNIT;
 	return 1;
@@ -2327,6 +2355,8 @@ void default_prefs (struct uae_prefs *p, int type)
     p->sound_freq = DEFAULT_SOUND_FREQ;
     p->sound_latency = DEFAULT_SOUND_LATENCY;
     p->sound_interpol = 0;
+    p->sound_capture_file[0] = 0;
+    p->sound_capture_format = 0;
 
 #ifdef JIT
     p->comptrustbyte = 1;
@@ -2380,6 +2410,7 @@ void default_prefs (struct uae_prefs *p, int type)
     p->keyboard_leds_in_use = 0;
     p->keyboard_leds[0] = p->keyboard_leds[1] = p->keyboard_leds[2] = 0;
     p->scsi = 0;
+    p->cd32_cache_size = 4;
     p->cpu_idle = 0;
     p->catweasel_io = 0;
     p->tod_hack = 0;
@@ -2435,6 +2466,7 @@ void default_prefs (struct uae_prefs *p, int type)
     p->dfxtype[2] = -1;
     p->dfxtype[3] = -1;
     p->floppy_speed = 100;
+    p->dms_cache_dir[0] = 0;
 #ifdef DRIVESOUND
     p->dfxclickvolume = 33;
 #endif
@@ -44,6 +44,7 @@
 #include "gui.h"
 #include "picasso96.h"
 #include "drawing.h"
+#include "crc32.h"
 #include "savestate.h"
 #include "ar.h"
 #ifdef AVIOUTPUT
@@ -261,6 +262,8 @@ struct copper {
 
 static struct copper cop_state;
 static int copper_enabled_thisline;
+/* The copper has been left to run behind the CPU; see predict_copper_moves ().  */
+static int copper_planned;
 static int cop_min_waittime;
 
 /*
@@ -1710,6 +1713,7 @@ static void do_sprite_collisions (void)
 	sprbuf_res_t maxpos = e->max;
 	hwres_t minp1 = minpos >> sprite_buffer_res;
 	hwres_t maxp1 = maxpos >> sprite_buffer_res;
+	const uae_u16 *sbuf = spixels + e->first_pixel - e->pos;
 
 	if (maxp1 > hw_diwlast)
 	    maxpos = hw_diwlast << sprite_buffer_res;
@@ -1720,8 +1724,8 @@ static void do_sprite_collisions (void)
 	if (minp1 < thisline_decision.plfleft * 2)
 	    minpos = thisline_decision.plfleft * 2 << sprite_buffer_res;
 
-	for (j = minpos; j < maxpos; j++) {
-	    int sprpix = spixels[e->first_pixel + j - e->pos] & collision_mask;
+	for (j = sprite_next_occupied (sbuf, minpos, maxpos); j < maxpos; j = sprite_next_occupied (sbuf, j + 1, maxpos)) {
+	    int sprpix = sbuf[j] & collision_mask;
 	    int k, offs, match = 1;
 
 	    if (sprpix == 0)
@@ -2472,6 +2476,7 @@ static void COPJMP (int num)
     cop_state.hpos = current_hpos () & ~1;
     copper_enabled_thisline = 0;
     cop_state.strobe = num;
+    copper_planned = 0;
 
     if (dmaen (DMA_COPPER)) {
 	copper_enabled_thisline = 1;
@@ -3645,8 +3650,14 @@ static void update_copper (unsigned int until_hpos)
 		continue;
 
 	    hp = c_hpos & (cop_state.saved_i2 & 0xFE);
-	    if (vp == cop_state.vcmp && hp < cop_state.hcmp)
+	    if (vp == cop_state.vcmp && hp < cop_state.hcmp) {
+		/* With the full horizontal mask the comparison cannot succeed
+		   before c_hpos reaches hcmp, so skip straight to the cycle
+		   before it.  Masked waits are stepped through as usual.  */
+		if ((cop_state.saved_i2 & 0xFE) == 0xFE && cop_state.hcmp - 2 > c_hpos)
+		    c_hpos = cop_state.hcmp - 2;
 		break;
+	    }
 
 	    /* Now we know that the comparisons were successful.  We might still
 	       have to wait for the blitter though.  */
@@ -3715,6 +3726,7 @@ static void update_copper (unsigned int until_hpos)
 static void compute_spcflag_copper (void)
 {
     copper_enabled_thisline = 0;
+    copper_planned = 0;
     unset_special (&regs, SPCFLAG_COPPER);
     if (! dmaen (DMA_COPPER) || cop_state.state == COP_stop || cop_state.state == COP_bltwait)
 	return;
@@ -3754,10 +3766,231 @@ void blitter_done_notify (void)
     compute_spcflag_copper ();
 }
 
+/*
+ * Decoded copper lists
+ *
+ * Each slot holds a list decoded by copper_cache_decode () from where the
+ * copper was first seen fetching, keyed by that address and a CRC of the
+ * words. update_copper () still executes every instruction from chip RAM;
+ * the slots only tell predict_copper_moves () how far ahead nothing but
+ * colour writes can happen.
+ *
+ * A slot is dropped on a write to its chip RAM through the memory
+ * functions, and its CRC is checked again the first time it is used in
+ * each frame, which catches any other changes.
+ */
+#define COPCACHE_SLOTS 4
+
+static struct copcache *copcache;
+static int copcache_next;
+uae_u32 copper_cache_lo, copper_cache_hi;
+
+static void copper_cache_range (void)
+{
+    int i;
+
+    copper_cache_lo = copper_cache_hi = 0;
+    for (i = 0; i < COPCACHE_SLOTS; i++) {
+	struct copcache *c = &copcache[i];
+	/* Longword writes start up to three bytes before the list.  */
+	uae_u32 lo = c->start >= 3 ? c->start - 3 : 0;
+	uae_u32 hi = c->start + c->len * 4;
+	if (!c->len)
+	    continue;
+	if (copper_cache_lo == copper_cache_hi || lo < copper_cache_lo)
+	    copper_cache_lo = lo;
+	if (hi > copper_cache_hi)
+	    copper_cache_hi = hi;
+    }
+}
+
+static void copper_cache_flush (void)
+{
+    int i;
+
+    if (!copcache)
+	return;
+    for (i = 0; i < COPCACHE_SLOTS; i++)
+	copcache[i].len = 0;
+    copper_cache_lo = copper_cache_hi = 0;
+}
+
+static uae_u32 copper_cache_crc (uae_u32 start, int len)
+{
+    return get_crc32 (chipmemory + start, len * 4);
+}
+
+static struct copcache *copper_cache_build (struct copcache *c, uae_u32 start)
+{
+    if (!copper_cache_decode (c, chipmemory, start, allocated_chipmem))
+	return 0;
+    c->crc = copper_cache_crc (start, c->len);
+    c->checked = 1;
+    copper_cache_range ();
+    return c;
+}
+
+/* The slot holding the instruction at chip RAM offset OFS, decoding the
+   list from there if none does.  */
+static struct copcache *copper_cache_find (uae_u32 ofs, int *idx)
+{
+    struct copcache *c;
+    int i;
+
+    if (!copcache) {
+	copcache = calloc (COPCACHE_SLOTS, sizeof *copcache);
+	if (!copcache)
+	    return 0;
+    }
+    for (i = 0; i < COPCACHE_SLOTS; i++) {
+	c = &copcache[i];
+	if (!c->len || ofs < c->start || ofs >= c->start + c->len * 4 || ((ofs - c->start) & 3))
+	    continue;
+	if (!c->checked) {
+	    if (copper_cache_crc (c->start, c->len) != c->crc)
+		break;
+	    c->checked = 1;
+	}
+	*idx = (ofs - c->start) / 4;
+	return c;
+    }
+    if (i == COPCACHE_SLOTS) {
+	c = &copcache[copcache_next];
+	copcache_next = (copcache_next + 1) % COPCACHE_SLOTS;
+    }
+    c->len = 0;
+    *idx = 0;
+    return copper_cache_build (c, ofs);
+}
+
+static void copper_cache_newframe (void)
+{
+    int i;
+
+    if (!copcache)
+	return;
+    for (i = 0; i < COPCACHE_SLOTS; i++)
+	copcache[i].checked = 0;
+}
+
+/* Chip RAM at OFFSET is about to be written: drop the lists there, and if
+   the copper was left behind, let it catch up first, so that the MOVEs it
+   still has to do read the list as it was.  */
+void copper_cache_write (uae_u32 offset)
+{
+    int i;
+
+    if (!copcache)
+	return;
+    for (i = 0; i < COPCACHE_SLOTS; i++) {
+	struct copcache *c = &copcache[i];
+	if (c->len && offset + 3 >= c->start && offset < c->start + c->len * 4)
+	    c->len = 0;
+    }
+    copper_cache_range ();
+    if (copper_planned) {
+	copper_planned = 0;
+	eventtab[ev_copper].active = 0;
+	if (copper_enabled_thisline)
+	    update_copper (current_hpos ());
+	set_special (&regs, SPCFLAG_COPPER);
+    }
+}
+
+/* The copper is about to execute MOVEs.  If the list says that they only
+   write colour registers up to a WAIT, nothing outside the display can
+   see them before that WAIT ends; update_copper () records colour changes
+   with their own positions, so it can just as well do them later, when
+   the CPU next touches a custom register, at the WAIT position, or at
+   the end of the line.  */
+static void predict_copper_moves (unsigned int hpos)
+{
+    struct copcache *c;
+    unsigned int i1, i2, vcmp, hcmp, vp, wake_hpos = 0;
+    int i;
+
+    if (currprefs.cpu_cycle_exact || cop_state.strobe || cop_state.ignore_next)
+	return;
+#ifdef JIT
+    /* Compiled code writes chip RAM without copper_cache_check ().  */
+    if (currprefs.cachesize && canbang)
+	return;
+#endif
+    switch (cop_state.state) {
+    case COP_read1:
+    case COP_read1_in2:
+	break;
+    case COP_read1_wr_in2:
+    case COP_read1_wr_in4:
+	if (!copper_is_colour_move (cop_state.saved_i1))
+	    return;
+	break;
+    default:
+	return;
+    }
+
+    c = copper_cache_find ((cop_state.ip - (chipmem_start & chipmem_mask)) & chipmem_mask, &i);
+    if (!c || c->stop[i] >= c->len)
+	return;
+    i = c->stop[i];
+    i1 = c->words[i * 2];
+    i2 = c->words[i * 2 + 1];
+    if (!(i1 & 1) || (i2 & 1))
+	return;
+    if (i1 != 0xFFFF || i2 != 0xFFFE) {
+	if (!(i2 & 0x8000) && bltstate != BLT_done)
+	    return;
+	vcmp = (i1 & (i2 | 0x8000)) >> 8;
+	hcmp = i1 & i2 & 0xFE;
+	vp = vpos & (((i2 >> 8) & 0x7F) | 0x80);
+	if (vp > vcmp)
+	    return;
+	/* The WAIT cannot end before hcmp on its own line.  */
+	if (vp == vcmp) {
+	    if (hcmp <= hpos)
+		return;
+	    if (hcmp < (maxhpos & ~1))
+		wake_hpos = hcmp;
+	}
+    }
+
+    copper_planned = 1;
+    unset_special (&regs, SPCFLAG_COPPER);
+    if (wake_hpos) {
+	eventtab[ev_copper].active = 1;
+	eventtab[ev_copper].evtime = get_cycles () + (wake_hpos - hpos) * CYCLE_UNIT;
+	events_schedule ();
+    }
+}
+
+/* If the copper is now waiting for a later position on this line, let the
+   ev_copper event wake it up there instead of having the CPU call
+   do_copper () after every instruction until then.  */
+static void predict_copper (unsigned int hpos)
+{
+    unsigned int wake_hpos = cop_state.hpos;
+
+    if (!copper_enabled_thisline)
+	return;
+    if (cop_state.state != COP_wait) {
+	predict_copper_moves (hpos);
+	return;
+    }
+    if (wake_hpos <= hpos || wake_hpos >= (maxhpos & ~1))
+	return;
+
+    eventtab[ev_copper].active = 1;
+    eventtab[ev_copper].evtime = get_cycles () + (wake_hpos - hpos) * CYCLE_UNIT;
+    events_schedule ();
+    unset_special (&regs, SPCFLAG_COPPER);
+}
+
 void do_copper (void)
 {
     unsigned int hpos = current_hpos ();
+    copper_planned = 0;
     update_copper (hpos);
+    predict_copper (hpos);
 }
 
 /* ADDR is the address that is going to be read/written; this access is
@@ -3772,7 +4005,10 @@ STATIC_INLINE void sync_copper_with_cpu (unsigned int hpos, int do_schedule)
 	if (do_schedule)
 	    events_schedule ();
 	set_special (&regs, SPCFLAG_COPPER);
+    } else if (copper_planned) {
+	set_special (&regs, SPCFLAG_COPPER);
     }
+    copper_planned = 0;
     if (copper_enabled_thisline)
 	update_copper (hpos);
 }
@@ -4337,6 +4573,7 @@ static void vsync_handler (void)
 
     eventtab[ev_copper].active = 0;
     COPJMP (1);
+    copper_cache_newframe ();
 
     if (timehack_alive > 0)
 	timehack_alive--;
@@ -4537,6 +4774,7 @@ void customreset (void)
 
     write_log ("reset at %x\n", m68k_getpc (&regs));
     hsync_counter = 0;
+    copper_cache_flush ();
     if (! savestate_state) {
 	currprefs.chipset_mask = changed_prefs.chipset_mask;
 	if ((currprefs.chipset_mask & CSMASK_AGA) == 0) {
@@ -130,6 +130,9 @@ static const char help[] = {
     "  h,?                   Show this help page\n"
 #ifdef SAVESTATE
     "  b                     Step to previous state capture position\n"
+    "  b <frame>             Go back to <frame>, from the state captured at or before it\n"
+    "  bl                    List state capture positions\n"
+    "  bi                    Show frame number and state capture buffer usage\n"
 #endif
     "  am <channel mask>     Enable or disable audio channels\n"
     "  sm <sprite mask>      Enable or disable sprites\n"
@@ -1287,11 +1290,23 @@ static int staterecorder (const char **cc)
 	}
 	return 0;
     }
+    if (isdigit (**cc)) {
+	if (savestate_seek (readint (cc))) {
+	    debug_rewind = 1;
+	    return 1;
+	}
+	console_out ("No state captured at or before that frame\n");
+	return 0;
+    }
     nc = next_char (cc);
     if (nc == 'l') {
 	savestate_listrewind ();
 	return 0;
     }
+    if (nc == 'i') {
+	savestate_rewindinfo ();
+	return 0;
+    }
     return 0;
 }
 #endif
@@ -44,6 +44,10 @@
 #endif
 #endif
 #include "crc32.h"
+#include "mfm.h"
+#ifdef SUPPORT_THREADS
+#include "threaddep/thread.h"
+#endif
 
 #include <ctype.h>
 
@@ -120,6 +124,18 @@ typedef struct {
 
 #define MAX_TRACKS (2 * 83)
 
+/* An encoded MFM track, see drive_fill_bigbuf () */
+struct mfmcache {
+    unsigned int tracklen;
+    int skipoffset;
+    unsigned int indexoffset;
+    /* Weak bits that change every revolution, only the flag is kept. */
+    int multirev;
+    uae_u16 *mfm;
+    /* Bit cell timing of IPF and FDI tracks, 0 if the track has none. */
+    uae_u16 *timing;
+};
+
 /* We have three kinds of Amiga floppy drives
  * - internal A500/A2000 drive:
  *   ID is always DRIVE_ID_NONE (S.T.A.G expects this)
@@ -150,6 +166,7 @@ typedef struct {
     int wrprot;
     uae_u16 bigmfmbuf[0x4000 * DDHDMULT];
     uae_u16 tracktiming[0x4000 * DDHDMULT];
+    struct mfmcache *mfmcache[MAX_TRACKS];
     int multi_revolution;
     int skipoffset;
     unsigned int mfmpos;
@@ -544,8 +561,15 @@ static void drive_settype_id (drive *drv)
 #endif
 }
 
+static void mfmcache_lock (void);
+static void mfmcache_unlock (void);
+static void mfmcache_flush (drive *drv);
+
 static void drive_image_free (drive *drv)
 {
+    /* The cache thread may be decoding a track of the image. */
+    mfmcache_lock ();
+    mfmcache_flush (drv);
     switch (drv->filetype)
     {
 	case ADF_IPF:
@@ -562,6 +586,7 @@ static void drive_image_free (drive *drv)
 	default:
 	    break;
     }
+    mfmcache_unlock ();
     drv->filetype = -1;
     zfile_fclose (drv->diskfile);
     drv->diskfile = 0;
@@ -892,9 +917,13 @@ static int drive_insert (drive * drv, struct uae_prefs *p, int dnum, const char
     } else if (strncmp ((char *) buffer, "CAPS", 4) == 0) {
 
 	unsigned int num_tracks;
+	int ok;
 
 	drv->wrprot = 1;
-	if (!caps_loadimage (drv->diskfile, drv - floppy, &num_tracks)) {
+	mfmcache_lock ();
+	ok = caps_loadimage (drv->diskfile, drv - floppy, &num_tracks);
+	mfmcache_unlock ();
+	if (!ok) {
 	    zfile_fclose (drv->diskfile);
 	    drv->diskfile = 0;
 	    return 0;
@@ -1170,60 +1199,21 @@ static void read_floppy_data (struct zfile *diskfile, trackid *tid, int offset,
     zfile_fread (dst, 1, len, diskfile);
 }
 
-/* Megalomania does not like zero MFM words... */
-static void mfmcode (uae_u16 *mfm, unsigned int words)
-{
-    uae_u32 lastword = 0;
-    while (words--) {
-	uae_u32 v = *mfm;
-	uae_u32 lv = (lastword << 16) | v;
-	uae_u32 nlv = 0x55555555 & ~lv;
-	uae_u32 mfmbits = (nlv << 1) & (nlv >> 1);
-	*mfm++ = v | mfmbits;
-	lastword = v;
-    }
-}
-
-static uae_u8 mfmencodetable[16] = {
-    0x2a, 0x29, 0x24, 0x25, 0x12, 0x11, 0x14, 0x15,
-    0x4a, 0x49, 0x44, 0x45, 0x52, 0x51, 0x54, 0x55
-};
-
-
-static uae_u16 dos_encode_byte (uae_u8 byte)
-{
-    uae_u8 b2, b1;
-    uae_u16 word;
-
-    b1 = byte;
-    b2 = b1 >> 4;
-    b1 &= 15;
-    word = mfmencodetable[b2] <<8 | mfmencodetable[b1];
-    return (word | ((word & (256 | 64)) ? 0 : 128));
-}
-
 static uae_u16 *mfmcoder (uae_u8 *src, uae_u16 *dest, int len)
 {
-    int i;
-
-    for (i = 0; i < len; i++) {
-	*dest = dos_encode_byte (*src++);
-	*dest |= ((dest[-1] & 1)||(*dest & 0x4000)) ? 0: 0x8000;
-	dest++;
-    }
-    return dest;
+    mfm_encode_bytes (src, dest, len, dest[-1]);
+    return dest + len;
 }
 
-static void decode_pcdos (drive *drv)
+static void decode_pcdos (drive *drv, unsigned int tr, uae_u16 *mfmbuf, unsigned int *tracklen, int *skipoffset)
 {
     unsigned int i;
-    unsigned int tr = drv->cyl * 2 + side;
     uae_u16 *dstmfmbuf, *mfm2;
     uae_u8 secbuf[700];
     uae_u16 crc16;
     trackid *ti = drv->trackdata + tr;
 
-    mfm2 = drv->bigmfmbuf;
+    mfm2 = mfmbuf;
     *mfm2++ = 0x9254;
     memset (secbuf, 0x4e, 80); // 94
     memset (secbuf + 80, 0x00, 12); // 12
@@ -1243,8 +1233,8 @@ static void decode_pcdos (drive *drv)
 	secbuf[13] = 0xa1;
 	secbuf[14] = 0xa1;
 	secbuf[15] = 0xfe;
-	secbuf[16] = drv->cyl;
-	secbuf[17] = side;
+	secbuf[16] = tr >> 1;
+	secbuf[17] = tr & 1;
 	secbuf[18] = 1 + i;
 	secbuf[19] = 2; // 128 << 2 = 512
 	crc16 = get_crc16 (secbuf + 12, 3 + 1 + 4);
@@ -1271,26 +1261,25 @@ static void decode_pcdos (drive *drv)
     }
     for (i = 0; i < 200; i++)
 	*dstmfmbuf++ = 0x9254;
-    drv->skipoffset = 0;
-    drv->tracklen = (dstmfmbuf - drv->bigmfmbuf) * 16;
+    *skipoffset = 0;
+    *tracklen = (dstmfmbuf - mfmbuf) * 16;
     if (disk_debug_logging > 0)
 	write_log ("pcdos read track %d\n", tr);
 }
 
-static void decode_amigados (drive *drv)
+static void decode_amigados (drive *drv, unsigned int tr, uae_u16 *mfmbuf_out, unsigned int *tracklen, int *skipoffset)
 {
     /* Normal AmigaDOS format track */
-    unsigned int tr = drv->cyl * 2 + side;
     unsigned int sec;
     int dstmfmoffset = 0;
-    uae_u16 *dstmfmbuf = drv->bigmfmbuf;
+    uae_u16 *dstmfmbuf = mfmbuf_out;
     int len = drv->num_secs * 544 + FLOPPY_GAP_LEN;
 
     trackid *ti = drv->trackdata + tr;
     memset (dstmfmbuf, 0xaa, len * 2);
     dstmfmoffset += FLOPPY_GAP_LEN;
-    drv->skipoffset = (FLOPPY_GAP_LEN * 8) / 3 * 2;
-    drv->tracklen = len * 2 * 8;
+    *skipoffset = (FLOPPY_GAP_LEN * 8) / 3 * 2;
+    *tracklen = len * 2 * 8;
 
     for (sec = 0; sec < drv->num_secs; sec++) {
 	uae_u8 secbuf[544];
@@ -1327,17 +1316,7 @@ static void decode_amigados (drive *drv)
 
 	for (i = 8; i < 48; i++)
 	    mfmbuf[i] = 0xaaaa;
-	for (i = 0; i < 512; i += 4) {
-	    deven = ((secbuf[i + 32] << 24) | (secbuf[i + 33] << 16)
-			 | (secbuf[i + 34] << 8) | (secbuf[i + 35]));
-	    dodd = deven >> 1;
-	    deven &= 0x55555555;
-	    dodd &= 0x55555555;
-	    mfmbuf[(i >> 1) + 32] = dodd >> 16;
-	    mfmbuf[(i >> 1) + 33] = dodd;
-	    mfmbuf[(i >> 1) + 256 + 32] = deven >> 16;
-	    mfmbuf[(i >> 1) + 256 + 33] = deven;
-	}
+	dck = mfm_encode_oddeven (secbuf + 32, mfmbuf + 32, mfmbuf + 256 + 32, 128);
 
 	for (i = 4; i < 24; i += 2)
 	    hck ^= (mfmbuf[i] << 16) | mfmbuf[i + 1];
@@ -1349,16 +1328,13 @@ static void decode_amigados (drive *drv)
 	mfmbuf[26] = deven >> 16;
 	mfmbuf[27] = deven;
 
-	for (i = 32; i < 544; i += 2)
-	    dck ^= (mfmbuf[i] << 16) | mfmbuf[i + 1];
-
 	deven = dodd = dck;
 	dodd >>= 1;
 	mfmbuf[28] = dodd >> 16;
 	mfmbuf[29] = dodd;
 	mfmbuf[30] = deven >> 16;
 	mfmbuf[31] = deven;
-	mfmcode (mfmbuf + 4, 544 - 4);
+	mfm_clock (mfmbuf + 4, 544 - 4, 0);
 
 	for (i = 0; i < 544; i++) {
 	    dstmfmbuf[dstmfmoffset % len] = mfmbuf[i];
@@ -1370,86 +1346,323 @@ static void decode_amigados (drive *drv)
 	write_log ("amigados read track %d\n", tr);
 }
 
-static void drive_fill_bigbuf (drive * drv, int force)
+/* Tracks of everything but Catweasel disks only depend on the image
+ * file, so the encoded MFM of a track is kept once it has been built,
+ * until the track is written or the disk ejected. For IPF and FDI images
+ * that is the output of the decoder, with its bit cell timing; tracks
+ * with weak bits are decoded again on every revolution and are not kept.
+ * A thread encodes the tracks next to the one the head is on while the
+ * emulation goes on, so that stepping to them usually finds them ready.
+ *
+ * mfmcache_sem serializes access to the cache, its queue, the image
+ * files of the drives and the IPF and FDI decoders, which are not
+ * reentrant, between the emulation and that thread. */
+#define MFMCACHE_QUEUE 4
+
+static struct { int drive, track; } mfmcache_queue[MFMCACHE_QUEUE];
+static int mfmcache_queued, mfmcache_ntscmode;
+#ifdef SUPPORT_THREADS
+static uae_sem_t mfmcache_sem, mfmcache_wake;
+static uae_thread_id mfmcache_tid;
+static int mfmcache_thread_running;
+static volatile int mfmcache_quit;
+#endif
+
+static void mfmcache_lock (void)
 {
-    unsigned int tr = drv->cyl * 2 + side;
-    trackid *ti = drv->trackdata + tr;
+#ifdef SUPPORT_THREADS
+    if (mfmcache_thread_running)
+	uae_sem_wait (&mfmcache_sem);
+#endif
+}
 
-    if ((!drv->diskfile && !drv->catweasel) || tr >= drv->num_tracks) {
-	track_reset (drv);
-	return;
+static void mfmcache_unlock (void)
+{
+#ifdef SUPPORT_THREADS
+    if (mfmcache_thread_running)
+	uae_sem_post (&mfmcache_sem);
+#endif
+}
+
+static int track_is_cacheable (drive *drv, unsigned int tr)
+{
+    if (drv->writediskfile && drv->writetrackdata[tr].bitlen > 0)
+	return 1;
+    return drv->diskfile && drv->filetype != ADF_CATWEASEL;
+}
+
+/* Number of timing entries of a decoded track. */
+static unsigned int mfmcache_timinglen (const struct mfmcache *t)
+{
+    unsigned int len;
+
+    if (!t->timing || !t->timing[0])
+	return 0;
+    len = (t->tracklen + 7) / 8 + 2;
+    return len < 0x4000 * DDHDMULT ? len : 0x4000 * DDHDMULT;
+}
+
+static void mfmcache_invalidate (drive *drv, unsigned int tr)
+{
+    if (drv->mfmcache[tr]) {
+	free (drv->mfmcache[tr]);
+	drv->mfmcache[tr] = 0;
     }
+}
 
-    if (!force && drv->catweasel) {
-	drv->buffered_cyl = -1;
-	return;
+static void mfmcache_flush (drive *drv)
+{
+    unsigned int tr;
+    int i, n = 0;
+
+    for (tr = 0; tr < MAX_TRACKS; tr++)
+	mfmcache_invalidate (drv, tr);
+    /* Keep the tracks queued for the other drives */
+    for (i = 0; i < mfmcache_queued; i++) {
+	if (mfmcache_queue[i].drive != drv - floppy)
+	    mfmcache_queue[n++] = mfmcache_queue[i];
     }
+    mfmcache_queued = n;
+}
 
-    if (!force && drv->buffered_cyl == (int)drv->cyl && drv->buffered_side == side)
+static void mfmcache_store (drive *drv, unsigned int tr, const struct mfmcache *t)
+{
+    unsigned int words = t->multirev ? 0 : (t->tracklen + 15) / 16;
+    unsigned int timinglen = t->multirev ? 0 : mfmcache_timinglen (t);
+    struct mfmcache *c = malloc (sizeof *c + (words + timinglen) * 2);
+
+    if (!c)
 	return;
-    drv->indexoffset = 0;
-    drv->multi_revolution = 0;
-    drv->tracktiming[0] = 0;
-    drv->skipoffset = -1;
+    *c = *t;
+    c->mfm = (uae_u16 *)(c + 1);
+    memcpy (c->mfm, t->mfm, words * 2);
+    c->timing = 0;
+    if (timinglen) {
+	c->timing = c->mfm + words;
+	memcpy (c->timing, t->timing, timinglen * 2);
+    }
+    mfmcache_invalidate (drv, tr);
+    drv->mfmcache[tr] = c;
+}
 
+/* Encode track TR of a cacheable disk into T->mfm and T->timing and fill
+ * in the rest of T. */
+static void drive_encode_track (drive *drv, unsigned int tr, struct mfmcache *t)
+{
+    trackid *ti = drv->trackdata + tr;
+    uae_u16 *mfmbuf = t->mfm;
+    unsigned int *tracklen = &t->tracklen;
+    unsigned int i;
+
+    t->tracklen = 0;
+    t->skipoffset = -1;
+    t->indexoffset = 0;
+    t->multirev = 0;
+    t->timing[0] = 0;
     if (drv->writediskfile && drv->writetrackdata[tr].bitlen > 0) {
-	unsigned int i;
 	trackid *wti = &drv->writetrackdata[tr];
-	drv->tracklen = wti->bitlen;
-	read_floppy_data (drv->writediskfile, wti, 0, drv->bigmfmbuf, (wti->bitlen + 7) / 8);
-	for (i = 0; i < (drv->tracklen + 15) / 16; i++) {
-	    uae_u16 *mfm = drv->bigmfmbuf + i;
+	*tracklen = wti->bitlen;
+	read_floppy_data (drv->writediskfile, wti, 0, mfmbuf, (wti->bitlen + 7) / 8);
+	for (i = 0; i < (*tracklen + 15) / 16; i++) {
+	    uae_u16 *mfm = mfmbuf + i;
 	    uae_u8 *data = (uae_u8 *) mfm;
 	    *mfm = 256 * *data + *(data + 1);
 	}
 	if (disk_debug_logging > 0)
-	    write_log ("track %d, length %d read from \"saveimage\"\n", tr, drv->tracklen);
-    } else if (drv->filetype == ADF_CATWEASEL) {
-#ifdef CATWEASEL
-	drv->tracklen = 0;
-	if (!catweasel_disk_changed (drv->catweasel)) {
-	    drv->tracklen = catweasel_fillmfm (drv->catweasel, drv->bigmfmbuf, side, drv->ddhd, 0);
-	}
-	drv->buffered_cyl = -1;
-	if (!drv->tracklen) {
-	    track_reset (drv);
-	    return;
-	}
-#endif
+	    write_log ("track %d, length %d read from \"saveimage\"\n", tr, *tracklen);
     } else if (drv->filetype == ADF_IPF) {
 
 #ifdef CAPS
-	caps_loadtrack (drv->bigmfmbuf, drv->tracktiming, drv - floppy, tr, &drv->tracklen, &drv->multi_revolution, &drv->skipoffset);
+	caps_loadtrack (mfmbuf, t->timing, drv - floppy, tr, tracklen, &t->multirev, (unsigned int *)&t->skipoffset);
 #endif
 
     } else if (drv->filetype == ADF_FDI) {
 
 #ifdef FDI2RAW
-	fdi2raw_loadtrack (drv->fdi, drv->bigmfmbuf, drv->tracktiming, tr, &drv->tracklen, &drv->indexoffset, &drv->multi_revolution, 1);
+	fdi2raw_loadtrack (drv->fdi, mfmbuf, t->timing, tr, tracklen, &t->indexoffset, &t->multirev, 1);
 #endif
 
     } else if (ti->type == TRACK_PCDOS) {
 
-	decode_pcdos (drv);
+	decode_pcdos (drv, tr, mfmbuf, tracklen, &t->skipoffset);
 
     } else if (ti->type == TRACK_AMIGADOS) {
 
-	decode_amigados (drv);
+	decode_amigados (drv, tr, mfmbuf, tracklen, &t->skipoffset);
 
     } else {
-	unsigned int i;
 	int base_offset = ti->type == TRACK_RAW ? 0 : 1;
-	drv->tracklen = ti->bitlen + 16 * base_offset;
-	drv->bigmfmbuf[0] = ti->sync;
-	read_floppy_data (drv->diskfile, ti, 0, drv->bigmfmbuf + base_offset, (ti->bitlen + 7) / 8);
-	for (i = base_offset; i < (drv->tracklen + 15) / 16; i++) {
-	    uae_u16 *mfm = drv->bigmfmbuf + i;
+	*tracklen = ti->bitlen + 16 * base_offset;
+	mfmbuf[0] = ti->sync;
+	read_floppy_data (drv->diskfile, ti, 0, mfmbuf + base_offset, (ti->bitlen + 7) / 8);
+	for (i = base_offset; i < (*tracklen + 15) / 16; i++) {
+	    uae_u16 *mfm = mfmbuf + i;
 	    uae_u8 *data = (uae_u8 *) mfm;
 	    *mfm = 256 * *data + *(data + 1);
 	}
 	if (disk_debug_logging > 1)
 	    write_log ("rawtrack %d image offset=%x\n", tr, ti->offs);
     }
+}
+
+#ifdef SUPPORT_THREADS
+static void *mfmcache_thread (void *unused)
+{
+    static uae_u16 mfmbuf[0x4000 * DDHDMULT];
+    static uae_u16 timing[0x4000 * DDHDMULT];
+
+    for (;;) {
+	uae_sem_wait (&mfmcache_wake);
+	if (mfmcache_quit)
+	    break;
+	uae_sem_wait (&mfmcache_sem);
+	while (mfmcache_queued > 0) {
+	    drive *drv = floppy + mfmcache_queue[0].drive;
+	    unsigned int tr = mfmcache_queue[0].track;
+	    struct mfmcache t;
+
+	    mfmcache_queued--;
+	    memmove (mfmcache_queue, mfmcache_queue + 1, mfmcache_queued * sizeof mfmcache_queue[0]);
+	    if (!drv->mfmcache[tr] && tr < drv->num_tracks && track_is_cacheable (drv, tr)) {
+		t.mfm = mfmbuf;
+		t.timing = timing;
+		drive_encode_track (drv, tr, &t);
+		mfmcache_store (drv, tr, &t);
+	    }
+	    /* Let the emulation in between tracks. */
+	    uae_sem_post (&mfmcache_sem);
+	    uae_sem_wait (&mfmcache_sem);
+	}
+	uae_sem_post (&mfmcache_sem);
+    }
+    return 0;
+}
+#endif
+
+/* Queue the tracks the drive is likely to need next: the other side of
+ * the cylinder and the cylinders on either side. Called with the lock. */
+static void mfmcache_prefetch (drive *drv, unsigned int tr)
+{
+#ifdef SUPPORT_THREADS
+    int next[3];
+    int i;
+
+    if (!mfmcache_thread_running)
+	return;
+    next[0] = tr ^ 1;
+    next[1] = tr + 2;
+    next[2] = tr - 2;
+    mfmcache_queued = 0;
+    for (i = 0; i < 3; i++) {
+	if (next[i] < 0 || next[i] >= (int)drv->num_tracks || drv->mfmcache[next[i]])
+	    continue;
+	mfmcache_queue[mfmcache_queued].drive = drv - floppy;
+	mfmcache_queue[mfmcache_queued].track = next[i];
+	mfmcache_queued++;
+    }
+    if (mfmcache_queued)
+	uae_sem_post (&mfmcache_wake);
+#endif
+}
+
+static void mfmcache_init (void)
+{
+#ifdef SUPPORT_THREADS
+    if (mfmcache_thread_running)
+	return;
+    uae_sem_init (&mfmcache_sem, 0, 1);
+    uae_sem_init (&mfmcache_wake, 0, 0);
+    mfmcache_quit = 0;
+    mfmcache_thread_running = uae_start_thread (mfmcache_thread, NULL, &mfmcache_tid);
+    if (!mfmcache_thread_running) {
+	uae_sem_destroy (&mfmcache_sem);
+	uae_sem_destroy (&mfmcache_wake);
+    }
+#endif
+}
+
+static void mfmcache_exit (void)
+{
+#ifdef SUPPORT_THREADS
+    if (!mfmcache_thread_running)
+	return;
+    mfmcache_quit = 1;
+    uae_sem_post (&mfmcache_wake);
+    uae_wait_thread (mfmcache_tid);
+    uae_sem_destroy (&mfmcache_sem);
+    uae_sem_destroy (&mfmcache_wake);
+    mfmcache_thread_running = 0;
+#endif
+}
+
+static void drive_fill_bigbuf (drive * drv, int force)
+{
+    unsigned int tr = drv->cyl * 2 + side;
+
+    if ((!drv->diskfile && !drv->catweasel) || tr >= drv->num_tracks) {
+	track_reset (drv);
+	return;
+    }
+
+    if (!force && drv->catweasel) {
+	drv->buffered_cyl = -1;
+	return;
+    }
+
+    if (!force && drv->buffered_cyl == (int)drv->cyl && drv->buffered_side == side)
+	return;
+    drv->indexoffset = 0;
+    drv->multi_revolution = 0;
+    drv->tracktiming[0] = 0;
+    drv->skipoffset = -1;
+
+    if (track_is_cacheable (drv, tr)) {
+	struct mfmcache *c;
+
+	mfmcache_lock ();
+	if (mfmcache_ntscmode != currprefs.ntscmode) {
+	    /* The gap length of AmigaDOS tracks depends on it. */
+	    unsigned int dr;
+	    for (dr = 0; dr < MAX_FLOPPY_DRIVES; dr++)
+		mfmcache_flush (&floppy[dr]);
+	    mfmcache_ntscmode = currprefs.ntscmode;
+	}
+	c = drv->mfmcache[tr];
+	if (c && !c->multirev) {
+	    drv->tracklen = c->tracklen;
+	    drv->skipoffset = c->skipoffset;
+	    drv->indexoffset = c->indexoffset;
+	    memcpy (drv->bigmfmbuf, c->mfm, (c->tracklen + 15) / 16 * 2);
+	    if (c->timing)
+		memcpy (drv->tracktiming, c->timing, mfmcache_timinglen (c) * 2);
+	} else {
+	    struct mfmcache t;
+
+	    t.mfm = drv->bigmfmbuf;
+	    t.timing = drv->tracktiming;
+	    drive_encode_track (drv, tr, &t);
+	    drv->tracklen = t.tracklen;
+	    drv->skipoffset = t.skipoffset;
+	    drv->indexoffset = t.indexoffset;
+	    drv->multi_revolution = t.multirev;
+	    if (!c)
+		mfmcache_store (drv, tr, &t);
+	}
+	mfmcache_prefetch (drv, tr);
+	mfmcache_unlock ();
+    } else if (drv->filetype == ADF_CATWEASEL) {
+#ifdef CATWEASEL
+	drv->tracklen = 0;
+	if (!catweasel_disk_changed (drv->catweasel)) {
+	    drv->tracklen = catweasel_fillmfm (drv->catweasel, drv->bigmfmbuf, side, drv->ddhd, 0);
+	}
+	drv->buffered_cyl = -1;
+	if (!drv->tracklen) {
+	    track_reset (drv);
+	    return;
+	}
+#endif
+    }
     drv->buffered_side = side;
     drv->buffered_cyl = drv->cyl;
     if (drv->tracklen == 0) {
@@ -1502,7 +1715,6 @@ static int decode_buffer (uae_u16 *mbuf, unsigned int cyl, unsigned int drvsec,
     unsigned int fwlen = FLOPPY_WRITE_LEN * ddhd;
     unsigned int length = 2 * fwlen;
     uae_u32 odd, even, chksum, id, dlong;
-    uae_u8 *secdata;
     uae_u8 secbuf[544];
     uae_u16 *mend = mbuf + length;
     char sectable[22];
@@ -1569,18 +1781,8 @@ static int decode_buffer (uae_u16 *mbuf, unsigned int cyl, unsigned int drvsec,
 	even = getmfmlong (mbuf + 2, shift);
 	mbuf += 4;
 	chksum = (odd << 1) | even;
-	secdata = secbuf + 32;
-	for (i = 0; i < 128; i++) {
-	    odd = getmfmlong (mbuf, shift);
-	    even = getmfmlong (mbuf + 256, shift);
-	    mbuf += 2;
-	    dlong = (odd << 1) | even;
-	    *secdata++ = dlong >> 24;
-	    *secdata++ = dlong >> 16;
-	    *secdata++ = dlong >> 8;
-	    *secdata++ = dlong;
-	    chksum ^= odd ^ even;
-	}
+	chksum ^= mfm_decode_oddeven (mbuf, mbuf + 256, shift, secbuf + 32, 128);
+	mbuf += 256;
 	if (chksum) {
 	    write_log ("Disk decode: sector %d, data checksum error\n", trackoffs);
 	    if (filetype == ADF_EXT2)
@@ -1605,18 +1807,9 @@ static int decode_buffer (uae_u16 *mbuf, unsigned int cyl, unsigned int drvsec,
 static uae_u8 mfmdecode (uae_u16 **mfmp, int shift)
 {
     uae_u16 mfm = getmfmword (*mfmp, shift);
-    uae_u8 out = 0;
-    unsigned int i;
 
     (*mfmp)++;
-    mfm &= 0x5555;
-    for (i = 0; i < 8; i++) {
-	out >>= 1;
-	if (mfm & 1)
-	    out |= 0x80;
-	mfm >>= 2;
-    }
-    return out;
+    return mfm_decode_word (mfm);
 }
 
 static int drive_write_pcdos (drive *drv)
@@ -1743,7 +1936,7 @@ static int drive_write_ext2 (uae_u16 *bigmfmbuf, struct zfile *diskfile, trackid
     return 1;
 }
 
-static void drive_write_data (drive * drv)
+static void drive_write_track (drive * drv)
 {
     int ret = -1;
     static int warned;
@@ -1792,6 +1985,14 @@ static void drive_write_data (drive * drv)
     drv->tracktiming[0] = 0;
 }
 
+static void drive_write_data (drive * drv)
+{
+    mfmcache_lock ();
+    drive_write_track (drv);
+    mfmcache_invalidate (drv, drv->cyl * 2 + side);
+    mfmcache_unlock ();
+}
+
 static void drive_eject (drive * drv)
 {
 #ifdef DRIVESOUND
@@ -1815,8 +2016,10 @@ static void drive_eject (drive * drv)
 void DISK_ersatz_read (int tr, int sec, uaecptr dest)
 {
     uae_u8 *dptr = get_real_address (dest);
+    mfmcache_lock ();
     zfile_fseek (floppy[0].diskfile, floppy[0].trackdata[tr].offs + sec * 512, SEEK_SET);
     zfile_fread (dptr, 1, 512, floppy[0].diskfile);
+    mfmcache_unlock ();
 }
 
 /* type: 0=regular, 1=ext2adf */
@@ -2325,6 +2528,7 @@ static void fetchnextrevolution (drive *drv)
     drv->trackspeed = get_floppy_speed () * drv->tracklen / (2 * 8 * FLOPPY_WRITE_LEN * drv->ddhd);
     if (!drv->multi_revolution)
 	return;
+    mfmcache_lock ();
     switch (drv->filetype)
     {
 	case ADF_IPF:
@@ -2340,6 +2544,7 @@ static void fetchnextrevolution (drive *drv)
 	default:
 	break;
     }
+    mfmcache_unlock ();
 }
 
 void DISK_handler (void)
@@ -2753,6 +2958,145 @@ void DISK_update (unsigned int tohpos)
     }
 }
 
+/* The 16 bits at bit position POS of a track of whole words. */
+STATIC_INLINE uae_u16 turbo_rawword (const uae_u16 *mfm, unsigned int words, unsigned int pos)
+{
+    unsigned int i = (pos >> 4) % words, shift = pos & 15;
+
+    if (!shift)
+	return mfm[i];
+    return (mfm[i] << shift) | (mfm[(i + 1) % words] >> (16 - shift));
+}
+
+/* The next 16 bits the drive delivers from bit position POS, without the
+ * disk_jitter bits at skipoffset that disk_doupdate_read () skips. */
+STATIC_INLINE uae_u16 turbo_getword (drive *drv, unsigned int words, unsigned int pos)
+{
+    uae_u16 v = turbo_rawword (drv->bigmfmbuf, words, pos);
+    unsigned int d;
+
+    if (drv->skipoffset < 0)
+	return v;
+    d = (drv->skipoffset + drv->tracklen - pos % drv->tracklen) % drv->tracklen;
+    if (d == 0 || d >= 16)
+	return v;
+    return (v & ~(0xffff >> d)) | (turbo_rawword (drv->bigmfmbuf, words, drv->skipoffset + disk_jitter) >> d);
+}
+
+/* Position POS moved on by N bits, and past the skipped bits if it gets
+ * to skipoffset on the way. */
+STATIC_INLINE unsigned int turbo_advance (drive *drv, unsigned int pos, unsigned int n)
+{
+    if (drv->skipoffset >= 0) {
+	unsigned int d = (drv->skipoffset + drv->tracklen - pos % drv->tracklen) % drv->tracklen;
+	if (d && d <= n)
+	    n += disk_jitter;
+    }
+    return pos + n;
+}
+
+/* Turbo DMA read: do everything disk_doupdate_read() would do until the
+ * end of the transfer in one go, from the track in bigmfmbuf, and leave
+ * the drive position, word, bitoffset and DSKBYTR as it would have. The
+ * index pulses of the revolutions passed go to the CIA at the end. Only
+ * done for tracks built from an image, which have no timing of their own.
+ * Returns 0 if the transfer has to be done, or finished, the slow way. */
+static int disk_turbo_read (drive *drv)
+{
+    unsigned int words, pos, start, last, need, k, idx, pulses = 0;
+    uae_u32 w = word, next;
+    int sync = 0, done = 1;
+
+    /* The normal path reads random bits there */
+    if (drive_empty (drv) || unformatted (drv))
+	return 0;
+    drive_fill_bigbuf (drv, 0);
+    if (!track_is_cacheable (drv, drv->cyl * 2 + side) || drv->filetype == ADF_IPF || drv->filetype == ADF_FDI
+	|| (drv->tracklen & 15) || drv->tracktiming[0] || drv->skipoffset >= (int)drv->tracklen)
+	return 0;
+    words = drv->tracklen >> 4;
+    start = pos = drv->mfmpos;
+
+    if (adkcon & 0x400) {
+	/* Wait for the sync word, at most one revolution. */
+	for (k = 0; k <= words; k++) {
+	    next = (w << 16) | turbo_getword (drv, words, pos);
+	    for (need = 1; need <= 16; need++) {
+		if (((next >> (16 - need)) & 0xffff) == dsksync)
+		    break;
+	    }
+	    if (need <= 16) {
+		w = (next >> (16 - need)) & 0xffff;
+		pos = turbo_advance (drv, pos, need);
+		break;
+	    }
+	    w = next & 0xffff;
+	    pos = turbo_advance (drv, pos, 16);
+	}
+	if (k > words)
+	    return 0;
+	sync = 1;
+	need = 16;
+    } else {
+	need = 16 - bitoffset;
+    }
+
+    last = pos;
+    for (;;) {
+	/* A sync word that matches again within every word, as 0xAAAA does
+	 * in a gap, lets no word through. Hand over to the normal path. */
+	if (pos - last > 2 * drv->tracklen) {
+	    done = 0;
+	    break;
+	}
+	next = (w << 16) | turbo_getword (drv, words, pos);
+	/* A sync word in the middle restarts the word count. */
+	k = need;
+	if (adkcon & 0x400) {
+	    for (k = 1; k < need; k++) {
+		if (((next >> (16 - k)) & 0xffff) == dsksync)
+		    break;
+	    }
+	}
+	w = (next >> (16 - k)) & 0xffff;
+	pos = turbo_advance (drv, pos, k);
+	if (w == dsksync)
+	    sync = 1;
+	if (k < need) {
+	    need = 16;
+	    continue;
+	}
+	need = 16;
+	if (dsklength > 0) {
+	    do_chipmem_wput (dskpt, w);
+	    dskpt += 2;
+	}
+	last = pos;
+	dsklength--;
+	if (dsklength <= 0)
+	    break;
+    }
+
+    idx = (drv->indexoffset + drv->tracklen - start % drv->tracklen) % drv->tracklen;
+    if (!idx)
+	idx = drv->tracklen;
+    if (pos - start >= idx) {
+	drv->indexhack = 0;
+	pulses = 1 + (pos - start - idx) / drv->tracklen;
+    }
+    drv->mfmpos = pos % drv->tracklen;
+    drv->floppybitcounter = 0;
+    word = w;
+    bitoffset = 0;
+    dma_enable = 1;
+    dskbytr_val = (w & 0xff) | 0x8000;
+    if (sync)
+	INTREQ (0x9000);
+    while (pulses-- > 0)
+	cia_diskindex ();
+    return done;
+}
+
 void DSKLEN (uae_u16 v, unsigned int hpos)
 {
     unsigned int dr, prev = dsklen;
@@ -2834,7 +3178,19 @@ void DSKLEN (uae_u16 v, unsigned int hpos)
 	update_drive_gui (dr);
 
     /* Try to make floppy access from Kickstart faster.  */
-    if (dskdmaen != 2 && dskdmaen != 3)
+    if (dskdmaen == 2) {
+	for (dr = 0; dr < MAX_FLOPPY_DRIVES; dr++) {
+	    drive *drv = &floppy[dr];
+	    if (drv->motoroff || (selected & (1 << dr)))
+		continue;
+	    /* only the first selected drive is read, as in DISK_update () */
+	    if ((drv->useturbo || currprefs.floppy_speed == 0) && disk_turbo_read (drv))
+		disk_dmafinished ();
+	    break;
+	}
+	return;
+    }
+    if (dskdmaen != 3)
 	return;
     for (dr = 0; dr < MAX_FLOPPY_DRIVES; dr++) {
 	drive *drv = &floppy[dr];
@@ -2850,6 +3206,7 @@ void DSKLEN (uae_u16 v, unsigned int hpos)
 	for (dr = 0; dr < MAX_FLOPPY_DRIVES; dr++) {
 	    drive *drv = &floppy[dr];
 	    unsigned int pos;
+	    int i;
 
 	    if (drv->motoroff)
 		continue;
@@ -2861,43 +3218,14 @@ void DSKLEN (uae_u16 v, unsigned int hpos)
 	    pos = drv->mfmpos & ~15;
 	    drive_fill_bigbuf (drv, 0);
 
-	    if (dskdmaen == 2) { /* TURBO read */
-
-		if (adkcon & 0x400) {
-		    unsigned int i;
-		    for (i = 0; i < drv->tracklen; i += 16) {
-			pos += 16;
-			pos %= drv->tracklen;
-			if (drv->bigmfmbuf[pos >> 4] == dsksync) {
-			    /* must skip first disk sync marker */
-			    pos += 16;
-			    pos %= drv->tracklen;
-			    break;
-			}
-		    }
-		    if (i >= drv->tracklen)
-			return;
-		}
-		while (dsklength-- > 0) {
-		    put_word (dskpt, drv->bigmfmbuf[pos >> 4]);
-		    dskpt += 2;
-		    pos += 16;
-		    pos %= drv->tracklen;
-		}
-		INTREQ (0x9000);
-		done = 1;
-
-	    } else if (dskdmaen == 3) { /* TURBO write */
-
-		int i;
-		for (i = 0; i < dsklength; i++) {
-		    drv->bigmfmbuf[pos >> 4] = get_word (dskpt + i * 2);
-		    pos += 16;
-		    pos %= drv->tracklen;
-		}
-		drive_write_data (drv);
-		done = 1;
+	    /* TURBO write */
+	    for (i = 0; i < dsklength; i++) {
+		drv->bigmfmbuf[pos >> 4] = get_word (dskpt + i * 2);
+		pos += 16;
+		pos %= drv->tracklen;
 	    }
+	    drive_write_data (drv);
+	    done = 1;
 	}
 	if (done) {
 	    linecounter = 2;
@@ -2949,6 +3277,7 @@ void DISK_free (void)
 	    drive *drv = &floppy[dr];
 	    drive_image_free (drv);
 	}
+	mfmcache_exit ();
 #ifdef SAVE_MEMORY
 	free (floppy);
 	floppy = 0;
@@ -2970,6 +3299,7 @@ void DISK_init (void)
 	abort ();
     memset (floppy, 0, sizeof (drive) * MAX_FLOPPY_DRIVES);
 #endif
+    mfmcache_init ();
     for (dr = 0; dr < MAX_FLOPPY_DRIVES; dr++) {
 	drive *drv = &floppy[dr];
 	/* reset all drive types to 3.5 DD */
@@ -75,6 +75,16 @@
 #define DIR_SEPARATORS ":\\/"
 
 
-extern UCHAR *text;
+/*  The decoders keep their state in globals. Where the compiler can make  */
+/*  them thread-local, pfile.c unpacks independent tracks in parallel.    */
+#if defined __GNUC__ && defined __ELF__
+	#define DMS_THREAD __thread
+	#define DMS_PARALLEL
+#else
+	#define DMS_THREAD
+#endif
+
+
+extern DMS_THREAD UCHAR *text;
 
 
@@ -19,8 +19,8 @@ ULONG mask_bits[]={
 };
 
 
-UCHAR *indata, bitcount;
-ULONG bitbuf;
+DMS_THREAD UCHAR *indata, bitcount;
+DMS_THREAD ULONG bitbuf;
 
 
 
@@ -1,6 +1,7 @@
 
-extern ULONG mask_bits[], bitbuf;
-extern UCHAR *indata, bitcount;
+extern ULONG mask_bits[];
+extern DMS_THREAD ULONG bitbuf;
+extern DMS_THREAD UCHAR *indata, bitcount;
 
 #define GETBITS(n) ((USHORT)(bitbuf >> (bitcount-(n))))
 #define DROPBITS(n) {bitbuf &= mask_bits[bitcount-=(n)]; while (bitcount<16) {bitbuf = (bitbuf << 8) | *indata++;  bitcount += 8;}}
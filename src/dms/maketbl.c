@@ -13,10 +13,10 @@
 #include "maketbl.h"
 
 
-static SHORT c;
-static USHORT n, tblsiz, len, depth, maxdepth, avail;
-static USHORT codeword, bit, *tbl, TabErr;
-static UCHAR *blen;
+static DMS_THREAD SHORT c;
+static DMS_THREAD USHORT n, tblsiz, len, depth, maxdepth, avail;
+static DMS_THREAD USHORT codeword, bit, *tbl, TabErr;
+static DMS_THREAD UCHAR *blen;
 
 
 static USHORT mktbl(void);
@@ -1,5 +1,5 @@
 
-extern USHORT left[], right[];
+extern DMS_THREAD USHORT left[], right[];
 
 USHORT make_table(USHORT nchar, UCHAR bitlen[], USHORT tablebits, USHORT table[]);
 
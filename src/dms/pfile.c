@@ -22,6 +22,9 @@
 #include "sysconfig.h"
 #include "sysdeps.h"
 #include "zfile.h"
+#ifdef SUPPORT_THREADS
+#include "threaddep/thread.h"
+#endif
 
 #include "cdata.h"
 #include "u_init.h"
@@ -34,8 +37,19 @@
 #include "pfile.h"
 
 
+/*  A track header, and while unpacking, the track itself  */
+struct dms_track {
+	USHORT number, pklen1, pklen2, unpklen, usum;
+	UCHAR cmode, flags;
+	UCHAR *data;	/*  packed data, and once decoded, the unpacked track  */
+	USHORT ret;
+	int newrun;	/*  the decoders start afresh with this track  */
+};
+
 
+static USHORT Read_Track(struct zfile *, UCHAR *, struct dms_track *, USHORT, USHORT);
 static USHORT Process_Track(struct zfile *, struct zfile *, UCHAR *, UCHAR *, USHORT, USHORT, USHORT);
+static USHORT Unpack_File(struct zfile *, struct zfile *, UCHAR *, UCHAR *, USHORT);
 static USHORT Unpack_Track(UCHAR *, UCHAR *, USHORT, USHORT, UCHAR, UCHAR);
 static void printbandiz(UCHAR *, USHORT);
 static void dms_decrypt(UCHAR *, USHORT);
@@ -44,7 +58,7 @@ static void dms_decrypt(UCHAR *, USHORT);
 static char modes[7][7]={"NOCOMP","SIMPLE","QUICK ","MEDIUM","DEEP  ","HEAVY1","HEAVY2"};
 static USHORT PWDCRC;
 
-UCHAR *text;
+DMS_THREAD UCHAR *text;
 
 
 
@@ -205,6 +219,8 @@ USHORT DMS_Process_File(struct zfile *fi, struct zfile *fo, USHORT cmd, USHORT o
 	if (cmd != CMD_VIEW) {
 		if (cmd == CMD_SHOWBANNER) /*  Banner is in the first track  */
 			ret = Process_Track(fi,NULL,b1,b2,cmd,opt,(geninfo & 2)?pwd:0);
+		else if (cmd == CMD_UNPACK)
+			ret = Unpack_File(fi,fo,b1,b2,(geninfo & 2)?pwd:0);
 		else {
 			while ( (ret=Process_Track(fi,fo,b1,b2,cmd,opt,(geninfo & 2)?pwd:0)) == NO_PROBLEM ) ;
 		}
@@ -231,8 +247,9 @@ USHORT DMS_Process_File(struct zfile *fi, struct zfile *fo, USHORT cmd, USHORT o
 
 
 
-static USHORT Process_Track(struct zfile *fi, struct zfile *fo, UCHAR *b1, UCHAR *b2, USHORT cmd, USHORT opt, USHORT pwd){
-	USHORT hcrc, dcrc, usum, number, pklen1, pklen2, unpklen, l, r;
+/*  Reads the header and the data of the next track into T and B1  */
+static USHORT Read_Track(struct zfile *fi, UCHAR *b1, struct dms_track *t, USHORT cmd, USHORT pwd){
+	USHORT hcrc, dcrc, usum, number, pklen1, pklen2, unpklen, l;
 	UCHAR cmode, flags;
 
 
@@ -287,20 +304,33 @@ static USHORT Process_Track(struct zfile *fi, struct zfile *fo, UCHAR *b1, UCHAR
 
 	if (pwd && (number!=80)) dms_decrypt(b1,pklen1);
 
-	if ((cmd == CMD_UNPACK) && (number<80) && (unpklen>2048)) {
-		r = Unpack_Track(b1, b2, pklen2, unpklen, cmode, flags);
-		if (r != NO_PROBLEM)
-			if (pwd)
-				return ERR_BADPASSWD;
-			else
-				return r;
-		if (usum != Calc_CheckSum(b2,(ULONG)unpklen))
-			if (pwd)
-				return ERR_BADPASSWD;
-			else
-				return ERR_CSUM;
-		if (zfile_fwrite(b2,1,(size_t)unpklen,fo) != unpklen) return ERR_CANTWRITE;
-	}
+	t->number = number;
+	t->pklen1 = pklen1;
+	t->pklen2 = pklen2;
+	t->unpklen = unpklen;
+	t->usum = usum;
+	t->cmode = cmode;
+	t->flags = flags;
+
+	return NO_PROBLEM;
+}
+
+
+
+static USHORT Process_Track(struct zfile *fi, struct zfile *fo, UCHAR *b1, UCHAR *b2, USHORT cmd, USHORT opt, USHORT pwd){
+	struct dms_track t;
+	USHORT number, pklen2, unpklen, usum, r;
+	UCHAR cmode, flags;
+
+	r = Read_Track(fi, b1, &t, cmd, pwd);
+	if (r != NO_PROBLEM) return r;
+
+	number = t.number;
+	pklen2 = t.pklen2;
+	unpklen = t.unpklen;
+	usum = t.usum;
+	cmode = t.cmode;
+	flags = t.flags;
 
 	if ((cmd == CMD_SHOWBANNER) && (number == 0xffff)){
 		r = Unpack_Track(b1, b2, pklen2, unpklen, cmode, flags);
@@ -330,6 +360,154 @@ static USHORT Process_Track(struct zfile *fi, struct zfile *fo, UCHAR *b1, UCHAR
 
 
 
+static USHORT Decode_Track(struct dms_track *t, UCHAR *b1, UCHAR *b2, USHORT pwd){
+	USHORT r;
+
+	memcpy(b1,t->data,(size_t)t->pklen1);
+	r = Unpack_Track(b1, b2, t->pklen2, t->unpklen, t->cmode, t->flags);
+	if (r != NO_PROBLEM)
+		return pwd ? ERR_BADPASSWD : r;
+	if (t->usum != Calc_CheckSum(b2,(ULONG)t->unpklen))
+		return pwd ? ERR_BADPASSWD : ERR_CSUM;
+	memcpy(t->data,b2,(size_t)t->unpklen);
+	return NO_PROBLEM;
+}
+
+
+
+/*  Decodes the tracks from FIRST up to the start of the next run  */
+static void Decode_Run(struct dms_track *tracks, int ntracks, int first, UCHAR *b1, UCHAR *b2, USHORT pwd){
+	USHORT r = NO_PROBLEM;
+	int i;
+
+	Init_Decrunchers();
+	for (i = first; i < ntracks && (i == first || !tracks[i].newrun); i++) {
+		if (r == NO_PROBLEM)
+			r = Decode_Track(&tracks[i], b1, b2, pwd);
+		tracks[i].ret = r;
+	}
+}
+
+
+
+#if defined DMS_PARALLEL && defined SUPPORT_THREADS
+
+#define DMS_WORKERS 4
+
+/*  Runs of tracks are handed out to the workers in archive order  */
+struct dms_work {
+	struct dms_track *tracks;
+	int ntracks, next;
+	USHORT pwd;
+	uae_sem_t lock;
+};
+
+static void *Decode_Worker(void *arg){
+	struct dms_work *w = (struct dms_work *)arg;
+	UCHAR *b1, *b2, *oldtext = text;
+	int i;
+
+	b1 = (UCHAR *)calloc((size_t)TRACK_BUFFER_LEN,1);
+	b2 = (UCHAR *)calloc((size_t)TRACK_BUFFER_LEN,1);
+	text = (UCHAR *)calloc((size_t)TEMP_BUFFER_LEN,1);
+	while (b1 && b2 && text) {
+		uae_sem_wait(&w->lock);
+		i = w->next;
+		if (i < w->ntracks)
+			for (w->next++; w->next < w->ntracks && !w->tracks[w->next].newrun; w->next++) ;
+		uae_sem_post(&w->lock);
+		if (i >= w->ntracks) break;
+		Decode_Run(w->tracks, w->ntracks, i, b1, b2, w->pwd);
+	}
+	free(b1);
+	free(b2);
+	free(text);
+	text = oldtext;
+	return 0;
+}
+
+#endif
+
+
+
+/*  Reads all tracks, decodes them, and writes them out. Tracks that  */
+/*  follow a track without flag 1 (and for Heavy, that bring their    */
+/*  own tables) do not depend on the decoder state before them, so    */
+/*  such runs of tracks can be decoded in parallel.                   */
+static USHORT Unpack_File(struct zfile *fi, struct zfile *fo, UCHAR *b1, UCHAR *b2, USHORT pwd){
+	struct dms_track t, *tracks = NULL, *p;
+	int ntracks = 0, maxtracks = 0, runs = 0, i;
+	UCHAR prevflags = 0;
+	USHORT ret;
+
+	while ((ret = Read_Track(fi, b1, &t, CMD_UNPACK, pwd)) == NO_PROBLEM) {
+		if ((t.number >= 80) || (t.unpklen <= 2048)) continue;
+		if (ntracks == maxtracks) {
+			maxtracks = maxtracks ? maxtracks * 2 : 96;
+			p = (struct dms_track *)realloc(tracks, maxtracks * sizeof (struct dms_track));
+			if (!p) {
+				ret = ERR_NOMEMORY;
+				break;
+			}
+			tracks = p;
+		}
+		t.data = (UCHAR *)malloc((size_t)(t.pklen1 > t.unpklen ? t.pklen1 : t.unpklen));
+		if (!t.data) {
+			ret = ERR_NOMEMORY;
+			break;
+		}
+		memcpy(t.data,b1,(size_t)t.pklen1);
+		t.newrun = ntracks == 0 || (!(prevflags & 1) && (t.cmode < 5 || (t.flags & 2)));
+		t.ret = ERR_NOMEMORY;	/*  until it is decoded  */
+		runs += t.newrun;
+		prevflags = t.flags;
+		tracks[ntracks++] = t;
+	}
+
+#if defined DMS_PARALLEL && defined SUPPORT_THREADS
+	if (runs > 1) {
+		struct dms_work w;
+		uae_thread_id tid[DMS_WORKERS - 1];
+		int nthreads = 0;
+
+		w.tracks = tracks;
+		w.ntracks = ntracks;
+		w.next = 0;
+		w.pwd = pwd;
+		uae_sem_init(&w.lock, 0, 1);
+		while (nthreads < DMS_WORKERS - 1 && nthreads < runs - 1
+		       && uae_start_thread(Decode_Worker, &w, &tid[nthreads]))
+			nthreads++;
+		Decode_Worker(&w);
+		for (i = 0; i < nthreads; i++)
+			uae_wait_thread(tid[i]);
+		uae_sem_destroy(&w.lock);
+	} else
+#endif
+	for (i = 0; i < ntracks; i++)
+		if (tracks[i].newrun)
+			Decode_Run(tracks, ntracks, i, b1, b2, pwd);
+
+	for (i = 0; i < ntracks; i++) {
+		if (tracks[i].ret != NO_PROBLEM) {
+			ret = tracks[i].ret;
+			break;
+		}
+		if (zfile_fwrite(tracks[i].data,1,(size_t)tracks[i].unpklen,fo) != tracks[i].unpklen) {
+			ret = ERR_CANTWRITE;
+			break;
+		}
+	}
+
+	for (i = 0; i < ntracks; i++)
+		free(tracks[i].data);
+	free(tracks);
+
+	return ret;
+}
+
+
+
 static USHORT Unpack_Track(UCHAR *b1, UCHAR *b2, USHORT pklen2, USHORT unpklen, UCHAR cmode, UCHAR flags){
 	switch (cmode){
 		case 0:
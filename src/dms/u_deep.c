@@ -23,8 +23,8 @@ INLINE void update(USHORT c);
 static void reconst(void);
 
 
-USHORT deep_text_loc;
-int init_deep_tabs=1;
+DMS_THREAD USHORT deep_text_loc;
+DMS_THREAD int init_deep_tabs=1;
 
 
 
@@ -38,13 +38,13 @@ int init_deep_tabs=1;
 #define MAX_FREQ    0x8000      /* updates tree when the */
 
 
-USHORT freq[T + 1]; /* frequency table */
+DMS_THREAD USHORT freq[T + 1]; /* frequency table */
 
-USHORT prnt[T + N_CHAR]; /* pointers to parent nodes, except for the */
+DMS_THREAD USHORT prnt[T + N_CHAR]; /* pointers to parent nodes, except for the */
 				/* elements [T..T + N_CHAR - 1] which are used to get */
 				/* the positions of leaves corresponding to the codes. */
 
-USHORT son[T];   /* pointers to child nodes (son[], son[] + 1) */
+DMS_THREAD USHORT son[T];   /* pointers to child nodes (son[], son[] + 1) */
 
 
 
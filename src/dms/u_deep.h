@@ -2,6 +2,6 @@
 
 USHORT Unpack_DEEP(UCHAR *, UCHAR *, USHORT);
 
-extern int init_deep_tabs;
-extern USHORT deep_text_loc;
+extern DMS_THREAD int init_deep_tabs;
+extern DMS_THREAD USHORT deep_text_loc;
 
@@ -21,11 +21,11 @@
 #define N1 510
 #define OFFSET 253
 
-USHORT left[2 * NC - 1], right[2 * NC - 1 + 9];
-static UCHAR c_len[NC], pt_len[NPT];
-static USHORT c_table[4096], pt_table[256];
-static USHORT lastlen, np;
-USHORT heavy_text_loc;
+DMS_THREAD USHORT left[2 * NC - 1], right[2 * NC - 1 + 9];
+static DMS_THREAD UCHAR c_len[NC], pt_len[NPT];
+static DMS_THREAD USHORT c_table[4096], pt_table[256];
+static DMS_THREAD USHORT lastlen, np;
+DMS_THREAD USHORT heavy_text_loc;
 
 
 static USHORT read_tree_c(void);
@@ -2,5 +2,5 @@
 
 USHORT Unpack_HEAVY(UCHAR *, UCHAR *, UCHAR, USHORT);
 
-extern USHORT heavy_text_loc;
+extern DMS_THREAD USHORT heavy_text_loc;
 
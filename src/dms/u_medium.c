@@ -19,7 +19,7 @@
 #define MBITMASK 0x3fff
 
 
-USHORT medium_text_loc;
+DMS_THREAD USHORT medium_text_loc;
 
 
 
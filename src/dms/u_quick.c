@@ -17,7 +17,7 @@
 #define QBITMASK 0xff
 
 
-USHORT quick_text_loc;
+DMS_THREAD USHORT quick_text_loc;
 
 
 USHORT Unpack_QUICK(UCHAR *in, UCHAR *out, USHORT origsize){
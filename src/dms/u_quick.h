@@ -1,5 +1,5 @@
 
 USHORT Unpack_QUICK(UCHAR *, UCHAR *, USHORT);
 
-extern USHORT quick_text_loc;
+extern DMS_THREAD USHORT quick_text_loc;
 
@@ -139,6 +139,13 @@ typedef void (*line_draw_func)(int, int);
 
 static char linestate[(MAXVPOS + 1) * 2 + 1];
 
+#ifdef SMART_UPDATE
+/* A hash of everything that went into each line the last time it was drawn.
+ * A line which custom.c reports as changed, but which hashes the same as what
+ * is already on screen, is neither converted nor flushed again. */
+static uae_u32 line_hash[(MAXVPOS + 1) * 2 + 1];
+#endif
+
 uae_u8 line_data[(MAXVPOS + 1) * 2][MAX_PLANES * MAX_WORDS_PER_LINE * 2];
 
 /* Centering variables.  */
@@ -161,6 +168,10 @@ static int first_block_line, last_block_line;
 
 #define NO_BLOCK -3
 
+/* The areas redrawn during this frame, for drivers with a flush_rects method. */
+static struct dirty_rect dirty_rects[MAX_DIRTY_RECTS];
+static int nr_dirty_rects;
+
 /* These are generated by the drawing code from the line_decisions array for
    each line that needs to be drawn.  These are basically extracted out of
    bit fields in the hardware registers.  */
@@ -441,6 +452,13 @@ STATIC_INLINE void fill_line (void)
 
 #include "linetoscr.c"
 
+/* Use the vector converters for 16 and 32-bit displays when configured. */
+#ifdef USE_VECTOR_LINETOSCR
+# define LINETOSCR_VEC(f) f ## _vec
+#else
+# define LINETOSCR_VEC(f) f
+#endif
+
 static void pfield_do_linetoscr (int start, int stop)
 {
 #ifdef AGA
@@ -448,40 +466,40 @@ static void pfield_do_linetoscr (int start, int stop)
 	if (res_shift == 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8_aga (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16_aga (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32_aga (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16_aga) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32_aga) (src_pixel, start, stop); break;
 	    }
 	else if (res_shift > 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8_stretch1_aga (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16_stretch1_aga (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32_stretch1_aga (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16_stretch1_aga) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32_stretch1_aga) (src_pixel, start, stop); break;
 	    }
 	else if (res_shift < 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8_shrink1_aga (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16_shrink1_aga (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32_shrink1_aga (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16_shrink1_aga) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32_shrink1_aga) (src_pixel, start, stop); break;
 	    }
     } else {
 #endif
 	if (res_shift == 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8 (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16 (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32 (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32) (src_pixel, start, stop); break;
 	    }
 	else if (res_shift > 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8_stretch1 (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16_stretch1 (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32_stretch1 (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16_stretch1) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32_stretch1) (src_pixel, start, stop); break;
 	    }
 	else if (res_shift < 0)
 	    switch (gfxvidinfo.pixbytes) {
 	    case 1: src_pixel = linetoscr_8_shrink1 (src_pixel, start, stop); break;
-	    case 2: src_pixel = linetoscr_16_shrink1 (src_pixel, start, stop); break;
-	    case 4: src_pixel = linetoscr_32_shrink1 (src_pixel, start, stop); break;
+	    case 2: src_pixel = LINETOSCR_VEC (linetoscr_16_shrink1) (src_pixel, start, stop); break;
+	    case 4: src_pixel = LINETOSCR_VEC (linetoscr_32_shrink1) (src_pixel, start, stop); break;
 	    }
 #ifdef AGA
     }
@@ -505,16 +523,98 @@ static unsigned int ham_lastcolor;
 
 static int ham_decode_pixel;
 
+/* How the pixels of a HAM line are decoded.  */
+enum ham_mode {
+    /* Bitplane data can't be decoded as HAM; nothing is written.  */
+    HAM_OFF,
+    /* HAM is not active at this point of the line: plain colour lookups.  */
+    HAM_PLAIN,
+    HAM_ECS6,
+    HAM_AGA6,
+    HAM_AGA8
+};
+
+/* Every HAM pixel either loads a base colour or replaces one channel of the
+ * previous colour, so the colour after pixel PV is
+ *   (previous & ham_keep[PV]) | ham_set[PV]
+ * which turns the control bit switch into two table lookups. ham_keep only
+ * depends on the mode; the base colour entries of ham_set are reloaded from
+ * colors_for_drawing by setup_ham_tables before each run of pixels.  */
+static unsigned int ham_keep[256], ham_set[256];
+static int ham_table_mode = HAM_OFF, ham_index_mask;
+
+static int ham_decode_mode (void)
+{
+    if (! bplham || (bplplanecnt != 6 && ((currprefs.chipset_mask & CSMASK_AGA) == 0 || bplplanecnt != 8)))
+	return HAM_PLAIN;
+#ifdef AGA
+    if (currprefs.chipset_mask & CSMASK_AGA)
+	return bplplanecnt == 8 ? HAM_AGA8 : HAM_AGA6;
+#endif
+    return bplplanecnt == 6 ? HAM_ECS6 : HAM_OFF;
+}
+
+static void setup_ham_tables (int mode)
+{
+    int pv;
+
+    if (mode != ham_table_mode) {
+	for (pv = 0; pv < 256; pv++) {
+	    unsigned int keep = 0, set = 0;
+	    if (mode == HAM_AGA8) {
+		switch (pv & 0x3) {
+		case 0x1: keep = 0xFFFF03; set = pv & 0xFC; break;
+		case 0x2: keep = 0x03FFFF; set = (pv & 0xFC) << 16; break;
+		case 0x3: keep = 0xFF03FF; set = (pv & 0xFC) << 8; break;
+		}
+	    } else if (mode == HAM_AGA6) {
+		switch (pv & 0x30) {
+		case 0x10: keep = 0xFFFF00; set = (pv & 0xF) << 4; break;
+		case 0x20: keep = 0x00FFFF; set = (pv & 0xF) << 20; break;
+		case 0x30: keep = 0xFF00FF; set = (pv & 0xF) << 12; break;
+		}
+	    } else {
+		switch (pv & 0x30) {
+		case 0x10: keep = 0xFF0; set = pv & 0xF; break;
+		case 0x20: keep = 0x0FF; set = (pv & 0xF) << 8; break;
+		case 0x30: keep = 0xF0F; set = (pv & 0xF) << 4; break;
+		}
+	    }
+	    ham_keep[pv] = keep;
+	    ham_set[pv] = set;
+	}
+	ham_index_mask = mode == HAM_AGA8 ? 0xFF : 0x3F;
+	ham_table_mode = mode;
+    }
+
+    /* The base colours may change with every colour change in the line.  */
+#ifdef AGA
+    if (mode == HAM_AGA8) {
+	for (pv = 0; pv < 256; pv += 4)
+	    ham_set[pv] = colors_for_drawing.color_regs_aga[pv >> 2];
+    } else if (mode == HAM_AGA6) {
+	for (pv = 0; pv < 16; pv++)
+	    ham_set[pv] = colors_for_drawing.color_regs_aga[pv];
+    } else
+#endif
+    {
+	for (pv = 0; pv < 16; pv++)
+	    ham_set[pv] = colors_for_drawing.color_regs_ecs[pv];
+    }
+}
+
 /* Decode HAM in the invisible portion of the display (left of VISIBLE_LEFT_BORDER),
    but don't draw anything in.  This is done to prepare HAM_LASTCOLOR for later,
    when decode_ham runs.  */
 static void init_ham_decoding (void)
 {
     int unpainted_amiga = res_shift_from_window (unpainted);
+    int mode = ham_decode_mode ();
+
     ham_decode_pixel = src_pixel;
     ham_lastcolor = color_reg_get (&colors_for_drawing, 0);
 
-    if (! bplham || (bplplanecnt != 6 && ((currprefs.chipset_mask & CSMASK_AGA) == 0 || bplplanecnt != 8))) {
+    if (mode == HAM_PLAIN) {
 	if (unpainted_amiga > 0) {
 	    int pv = pixdata.apixels[ham_decode_pixel + unpainted_amiga - 1];
 #ifdef AGA
@@ -524,50 +624,27 @@ static void init_ham_decoding (void)
 #endif
 		ham_lastcolor = colors_for_drawing.color_regs_ecs[pv];
 	}
-#ifdef AGA
-    } else if (currprefs.chipset_mask & CSMASK_AGA) {
-	if (bplplanecnt == 8) { /* AGA mode HAM8 */
-	    while (unpainted_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel++];
-		switch (pv & 0x3) {
-		case 0x0: ham_lastcolor = colors_for_drawing.color_regs_aga[pv >> 2]; break;
-		case 0x1: ham_lastcolor &= 0xFFFF03; ham_lastcolor |= (pv & 0xFC); break;
-		case 0x2: ham_lastcolor &= 0x03FFFF; ham_lastcolor |= (pv & 0xFC) << 16; break;
-		case 0x3: ham_lastcolor &= 0xFF03FF; ham_lastcolor |= (pv & 0xFC) << 8; break;
-		}
-	    }
-	} else if (bplplanecnt == 6) { /* AGA mode HAM6 */
-	    while (unpainted_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel++];
-		switch (pv & 0x30) {
-		case 0x00: ham_lastcolor = colors_for_drawing.color_regs_aga[pv]; break;
-		case 0x10: ham_lastcolor &= 0xFFFF00; ham_lastcolor |= (pv & 0xF) << 4; break;
-		case 0x20: ham_lastcolor &= 0x00FFFF; ham_lastcolor |= (pv & 0xF) << 20; break;
-		case 0x30: ham_lastcolor &= 0xFF00FF; ham_lastcolor |= (pv & 0xF) << 12; break;
-		}
-	    }
-	}
-#endif
-    } else {
-	if (bplplanecnt == 6) { /* OCS/ECS mode HAM6 */
-	    while (unpainted_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel++];
-		switch (pv & 0x30) {
-		case 0x00: ham_lastcolor = colors_for_drawing.color_regs_ecs[pv]; break;
-		case 0x10: ham_lastcolor &= 0xFF0; ham_lastcolor |= (pv & 0xF); break;
-		case 0x20: ham_lastcolor &= 0x0FF; ham_lastcolor |= (pv & 0xF) << 8; break;
-		case 0x30: ham_lastcolor &= 0xF0F; ham_lastcolor |= (pv & 0xF) << 4; break;
-		}
-	    }
+    } else if (mode != HAM_OFF) {
+	const uae_u8 *p = pixdata.apixels;
+	unsigned int c = ham_lastcolor;
+	int mask;
+
+	setup_ham_tables (mode);
+	mask = ham_index_mask;
+	while (unpainted_amiga-- > 0) {
+	    int pv = p[ham_decode_pixel++] & mask;
+	    c = (c & ham_keep[pv]) | ham_set[pv];
 	}
+	ham_lastcolor = c;
     }
 }
 
 static void decode_ham (int pix, int stoppos)
 {
     int todraw_amiga = res_shift_from_window (stoppos - pix);
+    int mode = ham_decode_mode ();
 
-    if (! bplham || (bplplanecnt != 6 && ((currprefs.chipset_mask & CSMASK_AGA) == 0 || bplplanecnt != 8))) {
+    if (mode == HAM_PLAIN) {
 	while (todraw_amiga-- > 0) {
 	    int pv = pixdata.apixels[ham_decode_pixel];
 #ifdef AGA
@@ -579,45 +656,21 @@ static void decode_ham (int pix, int stoppos)
 
 	    ham_linebuf[ham_decode_pixel++] = ham_lastcolor;
 	}
-#ifdef AGA
-    } else if (currprefs.chipset_mask & CSMASK_AGA) {
-	if (bplplanecnt == 8) { /* AGA mode HAM8 */
-	    while (todraw_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel];
-		switch (pv & 0x3) {
-		case 0x0: ham_lastcolor = colors_for_drawing.color_regs_aga[pv >> 2]; break;
-		case 0x1: ham_lastcolor &= 0xFFFF03; ham_lastcolor |= (pv & 0xFC); break;
-		case 0x2: ham_lastcolor &= 0x03FFFF; ham_lastcolor |= (pv & 0xFC) << 16; break;
-		case 0x3: ham_lastcolor &= 0xFF03FF; ham_lastcolor |= (pv & 0xFC) << 8; break;
-		}
-		ham_linebuf[ham_decode_pixel++] = ham_lastcolor;
-	    }
-	} else if (bplplanecnt == 6) { /* AGA mode HAM6 */
-	    while (todraw_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel];
-		switch (pv & 0x30) {
-		case 0x00: ham_lastcolor = colors_for_drawing.color_regs_aga[pv]; break;
-		case 0x10: ham_lastcolor &= 0xFFFF00; ham_lastcolor |= (pv & 0xF) << 4; break;
-		case 0x20: ham_lastcolor &= 0x00FFFF; ham_lastcolor |= (pv & 0xF) << 20; break;
-		case 0x30: ham_lastcolor &= 0xFF00FF; ham_lastcolor |= (pv & 0xF) << 12; break;
-		}
-		ham_linebuf[ham_decode_pixel++] = ham_lastcolor;
-	    }
-	}
-#endif
-    } else {
-	if (bplplanecnt == 6) { /* OCS/ECS mode HAM6 */
-	    while (todraw_amiga-- > 0) {
-		int pv = pixdata.apixels[ham_decode_pixel];
-		switch (pv & 0x30) {
-		case 0x00: ham_lastcolor = colors_for_drawing.color_regs_ecs[pv]; break;
-		case 0x10: ham_lastcolor &= 0xFF0; ham_lastcolor |= (pv & 0xF); break;
-		case 0x20: ham_lastcolor &= 0x0FF; ham_lastcolor |= (pv & 0xF) << 8; break;
-		case 0x30: ham_lastcolor &= 0xF0F; ham_lastcolor |= (pv & 0xF) << 4; break;
-		}
-		ham_linebuf[ham_decode_pixel++] = ham_lastcolor;
-	    }
+    } else if (mode != HAM_OFF && todraw_amiga > 0) {
+	const uae_u8 *p = pixdata.apixels + ham_decode_pixel;
+	uae_u32 *out = ham_linebuf + ham_decode_pixel;
+	unsigned int c = ham_lastcolor;
+	int i, mask;
+
+	setup_ham_tables (mode);
+	mask = ham_index_mask;
+	for (i = 0; i < todraw_amiga; i++) {
+	    int pv = p[i] & mask;
+	    c = (c & ham_keep[pv]) | ham_set[pv];
+	    out[i] = c;
 	}
+	ham_lastcolor = c;
+	ham_decode_pixel += todraw_amiga;
     }
 }
 
@@ -684,6 +737,16 @@ STATIC_INLINE void draw_sprites_1 (struct sprite_entry *e, int ham, int dualpf,
 	int maskshift, plfmask;
 	unsigned int v = buf[pos];
 
+	/* Skip over transparent parts of the entry in one go.  */
+	if (v == 0 && !SPRITE_DEBUG) {
+	    int steps = (sprite_next_occupied (buf, pos, e->max) - pos + (1 << skip) - 1) >> skip;
+	    pos += steps << skip;
+	    window_pos += steps << doubling;
+	    if (pos >= e->max)
+		break;
+	    v = buf[pos];
+	}
+
 	/* The value in the shift lookup table is _half_ the shift count we
 	   need.  This is because we can't shift 32 bits at once (undefined
 	   behaviour in C).  */
@@ -1089,6 +1152,38 @@ static void init_aspect_maps (void)
     }
 }
 
+/*
+ * Add a line to the dirty rectangle list of this frame. Lines usually arrive
+ * in ascending order, so a line just below the last rectangle extends it.
+ */
+static void add_dirty_line (int lineno)
+{
+    struct dirty_rect *r;
+
+    if (nr_dirty_rects > 0) {
+	r = &dirty_rects[nr_dirty_rects - 1];
+	if (lineno >= r->y && lineno <= r->y + r->height) {
+	    if (lineno == r->y + r->height)
+		r->height++;
+	    return;
+	}
+    }
+    if (nr_dirty_rects == MAX_DIRTY_RECTS) {
+	/* Out of rectangles; grow the last one to cover this line. */
+	if (lineno < r->y) {
+	    r->height += r->y - lineno;
+	    r->y = lineno;
+	} else
+	    r->height = lineno - r->y + 1;
+	return;
+    }
+    r = &dirty_rects[nr_dirty_rects++];
+    r->x = 0;
+    r->y = lineno;
+    r->width = gfxvidinfo.width;
+    r->height = 1;
+}
+
 /*
  * A raster line has been built in the graphics buffer. Tell the graphics code
  * to do anything necessary to display it.
@@ -1102,6 +1197,8 @@ static void do_flush_line_1 (int lineno)
 
     if (gfxvidinfo.maxblocklines == 0)
 	flush_line (lineno);
+    else if (gfxvidinfo.flush_rects)
+	add_dirty_line (lineno);
     else {
 	if ((last_block_line + 2) < lineno) {
 	    if (first_block_line != NO_BLOCK)
@@ -1137,6 +1234,10 @@ STATIC_INLINE void do_flush_screen (int start, int stop)
 	flush_block (first_block_line, last_block_line);
     }
     unlockscr ();
+    if (nr_dirty_rects > 0) {
+	gfxvidinfo.flush_rects (&gfxvidinfo, dirty_rects, nr_dirty_rects);
+	nr_dirty_rects = 0;
+    }
     if (start <= stop)
 	flush_screen (start, stop);
     else if (is_vsync ())
@@ -1311,6 +1412,162 @@ enum double_how {
     dh_emerg
 };
 
+#ifdef SMART_UPDATE
+STATIC_INLINE uae_u32 hash_mix (uae_u32 h, uae_u32 v)
+{
+    h = (h ^ v) * 0x9E3779B1;
+    return h ^ (h >> 15);
+}
+
+static uae_u32 hash_bytes (uae_u32 h, const void *p, int len)
+{
+    const uae_u8 *b = (const uae_u8 *)p;
+
+    for (; len >= 4; len -= 4, b += 4) {
+	uae_u32 v;
+	memcpy (&v, b, 4);
+	h = hash_mix (h, v);
+    }
+    while (len-- > 0)
+	h = hash_mix (h, *b++);
+    return h;
+}
+
+/*
+ * Hash the state a line is about to be drawn from: its position on screen,
+ * the decision and colour table for the line, the colour changes and sprites
+ * in it and the bitplane data in line_data.
+ */
+static uae_u32 hash_drawn_line (int lineno, int border, int gfx_ypos, int follow_ypos)
+{
+    struct decision *dp = dp_for_drawing;
+    struct draw_info *dip = dip_for_drawing;
+    uae_u32 h = 0x811C9DC5;
+
+    h = hash_mix (h, border);
+    h = hash_mix (h, gfx_ypos);
+    h = hash_mix (h, follow_ypos);
+    h = hash_mix (h, visible_left_border);
+    h = hash_mix (h, lores_shift);
+    if (border == 2)
+	return h;
+
+    h = hash_mix (h, dp->plfleft);
+    h = hash_mix (h, dp->plfright);
+    h = hash_mix (h, dp->plflinelen);
+    h = hash_mix (h, dp->diwfirstword);
+    h = hash_mix (h, dp->diwlastword);
+    h = hash_mix (h, (dp->bplcon0 << 16) | dp->bplcon2);
+#ifdef AGA
+    h = hash_mix (h, (dp->bplcon3 << 16) | dp->bplcon4);
+#endif
+    h = hash_mix (h, (dp->nr_planes << 24) | (dp->bplres << 16) | (dp->any_hires_sprites << 3)
+		  | (dp->ham_seen << 2) | (dp->ham_at_start << 1) | dp->valid);
+
+    h = hash_bytes (h, curr_color_tables + dp->ctable, sizeof (struct color_entry));
+    if (dip->nr_color_changes)
+	h = hash_bytes (h, curr_color_changes + dip->first_color_change,
+			dip->nr_color_changes * sizeof *curr_color_changes);
+    if (border == 1)
+	return h;
+
+    if (dip->nr_sprites) {
+	struct sprite_entry *first = curr_sprite_entries + dip->first_sprite_entry;
+	struct sprite_entry *last = first + dip->nr_sprites - 1;
+	int npixels = last->first_pixel + (last->max - last->pos) - first->first_pixel;
+	int i;
+
+	for (i = 0; i < dip->nr_sprites; i++) {
+	    h = hash_mix (h, (first[i].pos << 16) | first[i].max);
+	    h = hash_mix (h, first[i].has_attached);
+	}
+	h = hash_bytes (h, spixels + first->first_pixel, npixels * sizeof (uae_u16));
+	h = hash_bytes (h, spixstate.bytes + first->first_pixel, npixels);
+    }
+
+    if (dp->plfleft != -1 && dp->plflinelen > 0) {
+	int len = dp->plflinelen * 4;
+	int i;
+
+	if (len > MAX_WORDS_PER_LINE * 2)
+	    len = MAX_WORDS_PER_LINE * 2;
+	for (i = 0; i < dp->nr_planes && i < MAX_PLANES; i++)
+	    h = hash_bytes (h, line_data[lineno] + i * MAX_WORDS_PER_LINE * 2, len);
+    }
+    return h;
+}
+
+/*
+ * HAM pictures tend to stay on screen unchanged while something else on
+ * the line (a sprite, say) forces it to be redrawn. Keep the decoded HAM
+ * colours of each line together with a hash of the bitplane pixels and
+ * base colours they were decoded from, and reuse them when those match.
+ */
+struct ham_cache_line {
+    uae_u32 hash;
+    int len, size;
+    unsigned int lastcolor;
+    uae_u32 *pixels;
+};
+
+static struct ham_cache_line ham_cache[(MAXVPOS + 1) * 2 + 1];
+
+static void decode_ham_line (int lineno)
+{
+    struct ham_cache_line *hc = ham_cache + lineno;
+    int mode = ham_decode_mode ();
+    int skip = res_shift_from_window (unpainted);
+    int len = res_shift_from_window (visible_right_border - visible_left_border);
+    int out;
+    uae_u32 h;
+
+    if (mode == HAM_PLAIN || mode == HAM_OFF || len <= 0) {
+	init_ham_decoding ();
+	decode_ham (visible_left_border, visible_right_border);
+	return;
+    }
+    if (skip < 0)
+	skip = 0;
+    out = src_pixel + skip;
+
+    h = hash_mix (0x811C9DC5, mode);
+    h = hash_mix (h, src_pixel);
+    h = hash_mix (h, skip);
+    h = hash_mix (h, len);
+    h = hash_bytes (h, pixdata.apixels + src_pixel, skip + len);
+#ifdef AGA
+    if (mode != HAM_ECS6)
+	h = hash_bytes (h, colors_for_drawing.color_regs_aga, (mode == HAM_AGA8 ? 64 : 16) * sizeof (uae_u32));
+    else
+#endif
+	h = hash_bytes (h, colors_for_drawing.color_regs_ecs, 16 * sizeof (uae_u16));
+
+    if (hc->pixels && hc->hash == h && hc->len == len) {
+	memcpy (ham_linebuf + out, hc->pixels, len * sizeof (uae_u32));
+	ham_lastcolor = hc->lastcolor;
+	ham_decode_pixel = out + len;
+	return;
+    }
+
+    init_ham_decoding ();
+    decode_ham (visible_left_border, visible_right_border);
+
+    if (hc->size < len) {
+	uae_u32 *p = realloc (hc->pixels, len * sizeof (uae_u32));
+	if (!p) {
+	    hc->len = 0;
+	    return;
+	}
+	hc->pixels = p;
+	hc->size = len;
+    }
+    memcpy (hc->pixels, ham_linebuf + out, len * sizeof (uae_u32));
+    hc->hash = h;
+    hc->len = len;
+    hc->lastcolor = ham_lastcolor;
+}
+#endif
+
 STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
 {
     static int warned = 0;
@@ -1364,6 +1621,15 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
 	break;
     }
 
+#ifdef SMART_UPDATE
+    {
+	uae_u32 hash = hash_drawn_line (lineno, border, gfx_ypos, do_double ? follow_ypos : -1);
+	if (! frame_redraw_necessary && line_hash[lineno] == hash)
+	    return;
+	line_hash[lineno] = hash;
+    }
+#endif
+
     dh = dh_line;
     xlinebuffer = gfxvidinfo.linemem;
     if (xlinebuffer == 0 && do_double
@@ -1388,12 +1654,17 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
 	/* The problem is that we must call decode_ham() BEFORE we do the
 	   sprites. */
 	if (! border && dp_for_drawing->ham_seen) {
-	    init_ham_decoding ();
 	    if (dip_for_drawing->nr_color_changes == 0) {
 		/* The easy case: need to do HAM decoding only once for the
 		 * full line. */
+#ifdef SMART_UPDATE
+		decode_ham_line (lineno);
+#else
+		init_ham_decoding ();
 		decode_ham (visible_left_border, visible_right_border);
+#endif
 	    } else /* Argh. */ {
+		init_ham_decoding ();
 		do_color_changes (dummy_worker, decode_ham);
 		adjust_drawing_colors (dp_for_drawing->ctable, dp_for_drawing->ham_seen || bplehb);
 	    }
@@ -1599,6 +1870,7 @@ static void init_drawing_frame (void)
     first_drawn_line = 32767;
 
     first_block_line = last_block_line = NO_BLOCK;
+    nr_dirty_rects = 0;
     if (currprefs.test_drawing_speed)
 	frame_redraw_necessary = 1;
     else if (frame_redraw_necessary)
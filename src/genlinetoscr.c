@@ -289,6 +289,107 @@ static void out_linetoscr (DEPTH_T bpp, HMODE_T hmode, int aga)
     outln  (	"");
 }
 
+/*
+ * Vector variants of the line-to-screen converters for 16-bit and 32-bit
+ * destinations. These use GCC's generic vector extensions, so the same
+ * generated source maps to SSE2, AltiVec or NEON. Palette expansion is done
+ * with ordinary loads from the 256-entry colour table into the vector lanes
+ * (no gather), pixel doubling is done with shuffles (or for free at 16 bpp,
+ * where the table entries are already doubled) and pixel halving by
+ * only fetching every second source pixel. Only the plain colour mode is
+ * vectorised; HAM, dual-playfield and EHB lines are passed to the scalar
+ * converter, as is any tail too short to fill a whole vector.
+ */
+static void out_linetoscr_vec_decl (DEPTH_T bpp, HMODE_T hmode, int aga)
+{
+    outlnf ("static int NOINLINE linetoscr_%s%s%s_vec (int spix, int dpix, int stoppos)",
+	    get_depth_str (bpp),
+	    get_hmode_str (hmode), aga ? "_aga" : "");
+}
+
+static void out_linetoscr_vec_lanes (const char *var, int narrow, int first, int lanes, int step, int aga)
+{
+    int i;
+
+    outlnf (	"        %s %s = {", narrow ? "lts_vec_u16" : "lts_vec_u32", var);
+    for (i = 0; i < lanes; i++)
+	outlnf ("            %sacolors[src[%d]%s]%s",
+		narrow ? "(uae_u16) " : "",
+		first + i * step, aga ? " ^ xor_val" : "",
+		i < lanes - 1 ? "," : "");
+    outln (	"        };");
+}
+
+static void out_linetoscr_vec (DEPTH_T bpp, HMODE_T hmode, int aga)
+{
+    int lanes      = bpp == DEPTH_16BPP ? 8 : 4;
+    int src_step   = hmode == HMODE_HALVE ? lanes * 2 : lanes;
+    int dst_step   = hmode == HMODE_DOUBLE ? lanes * 2 : lanes;
+
+    if (aga)
+	outln  ("#ifdef AGA");
+
+    out_linetoscr_vec_decl (bpp, hmode, aga);
+    outln  (	"{");
+    outlnf (	"    %s *buf = (%s *) xlinebuffer;", get_depth_type_str (bpp), get_depth_type_str (bpp));
+    outln  (	"    const xcolnr *acolors = colors_for_drawing.acolors;");
+    if (aga)
+	outln (	"    uae_u8 xor_val = (uae_u8)(dp_for_drawing->bplcon4 >> 8);");
+    outln  (	"");
+    outln  (	"    if (dp_for_drawing->ham_seen || bpldualpf || bplehb)");
+    outlnf (	"        return linetoscr_%s%s%s (spix, dpix, stoppos);",
+		get_depth_str (bpp), get_hmode_str (hmode), aga ? "_aga" : "");
+    outln  (	"");
+    outlnf (	"    while (dpix + %d <= stoppos) {", dst_step);
+    outln  (	"        const uae_u8 *src = &pixdata.apixels[spix];");
+
+    if (hmode == HMODE_DOUBLE && bpp == DEPTH_16BPP) {
+	/* At 16 bpp each colour table entry already holds the pixel value
+	 * twice, so a 32-bit lane is a doubled pair of pixels. */
+	out_linetoscr_vec_lanes ("lo", 0, 0, 4, 1, aga);
+	out_linetoscr_vec_lanes ("hi", 0, 4, 4, 1, aga);
+    } else {
+	out_linetoscr_vec_lanes ("v", bpp == DEPTH_16BPP, 0, lanes,
+				 hmode == HMODE_HALVE ? 2 : 1, aga);
+	if (hmode == HMODE_DOUBLE) {
+	    outln (	"        lts_vec_u32 lo = LTS_SHUFFLE (v, 0, 0, 1, 1);");
+	    outln (	"        lts_vec_u32 hi = LTS_SHUFFLE (v, 2, 2, 3, 3);");
+	}
+    }
+
+    if (hmode == HMODE_DOUBLE) {
+	outln (	"        memcpy (&buf[dpix], &lo, sizeof lo);");
+	outlnf ("        memcpy (&buf[dpix + %d], &hi, sizeof hi);", lanes);
+    } else
+	outln (	"        memcpy (&buf[dpix], &v, sizeof v);");
+
+    outlnf (	"        spix += %d;", src_step);
+    outlnf (	"        dpix += %d;", dst_step);
+    outln  (	"    }");
+    outln  (	"    if (dpix < stoppos)");
+    outlnf (	"        spix = linetoscr_%s%s%s (spix, dpix, stoppos);",
+		get_depth_str (bpp), get_hmode_str (hmode), aga ? "_aga" : "");
+    outln  (	"    return spix;");
+    outln  (	"}");
+
+    if (aga)
+	outln (	"#endif");
+    outln  (	"");
+}
+
+static void out_linetoscr_vec_types (void)
+{
+    outln ("typedef uae_u16 lts_vec_u16 __attribute__ ((vector_size (16)));");
+    outln ("typedef uae_u32 lts_vec_u32 __attribute__ ((vector_size (16)));");
+    outln ("");
+    outln ("#ifdef __clang__");
+    outln ("# define LTS_SHUFFLE(v, ...) __builtin_shufflevector (v, v, __VA_ARGS__)");
+    outln ("#else");
+    outln ("# define LTS_SHUFFLE(v, ...) __builtin_shuffle (v, (__typeof__ (v)) { __VA_ARGS__ })");
+    outln ("#endif");
+    outln ("");
+}
+
 int main (int argc, char *argv[])
 {
    DEPTH_T bpp;
@@ -320,5 +421,16 @@ int main (int argc, char *argv[])
 		out_linetoscr (bpp, hmode, aga);
 	}
     }
+
+   outln ("#ifdef USE_VECTOR_LINETOSCR");
+   outln ("");
+   out_linetoscr_vec_types ();
+   for (bpp = DEPTH_16BPP; bpp <= DEPTH_MAX; bpp++) {
+	for (aga = 0; aga <= 1 ; aga++) {
+	    for (hmode = HMODE_NORMAL; hmode <= HMODE_MAX; hmode++)
+		out_linetoscr_vec (bpp, hmode, aga);
+	}
+    }
+   outln ("#endif /* USE_VECTOR_LINETOSCR */");
     return 0;
 }
@@ -0,0 +1,8 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Target specific stuff, headless version
+  */
+
+#define GFX_NAME "headless"
+#define USE_HEADLESS_GFX
@@ -0,0 +1,422 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Headless graphics target.
+  *
+  * Nothing is displayed. The chipset is emulated exactly as with any other
+  * target - custom.c still makes all its line decisions and computes
+  * collisions - but drawing.c is never asked to render a frame, except
+  * every headless.dump_interval frames when the frame is drawn into a
+  * memory buffer and written out as a PPM or raw image for verification.
+  * Intended for batch runs with cpu_speed=max and sound=none.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "uae.h"
+#include "custom.h"
+#include "xwin.h"
+#include "drawing.h"
+#include "inputdevice.h"
+#include "keyboard.h"
+#include "keybuf.h"
+
+#define DUMP_FORMAT_PPM 0
+#define DUMP_FORMAT_RAW 1
+
+static const char *dump_formats[] = { "ppm", "raw", 0 };
+
+/* Number of emulated frames so far. */
+static unsigned long frame_count;
+
+/*
+ * Frames are only rendered when we want to dump them. Returning zero from
+ * lockscr makes drawing.c skip the whole frame without touching any
+ * chipset state.
+ */
+STATIC_INLINE int want_frame (void)
+{
+    return currprefs.headless_dump_interval > 0
+	&& frame_count % currprefs.headless_dump_interval == 0;
+}
+
+static void dump_frame (struct vidbuf_description *gfxinfo)
+{
+    char name[sizeof currprefs.headless_dump_dir + 32];
+    int raw = currprefs.headless_dump_format == DUMP_FORMAT_RAW;
+    FILE *f;
+    int x, y;
+
+    sprintf (name, "%s/frame%06lu.%s", currprefs.headless_dump_dir,
+	     frame_count, dump_formats[currprefs.headless_dump_format]);
+    f = fopen (name, "wb");
+    if (!f) {
+	write_log ("HEADLESS: cannot write '%s'\n", name);
+	return;
+    }
+
+    if (raw) {
+	for (y = 0; y < gfxinfo->height; y++)
+	    fwrite (gfxinfo->bufmem + y * gfxinfo->rowbytes, gfxinfo->pixbytes, gfxinfo->width, f);
+    } else {
+	uae_u8 *row = malloc (gfxinfo->width * 3);
+
+	fprintf (f, "P6\n%d %d\n255\n", gfxinfo->width, gfxinfo->height);
+	for (y = 0; y < gfxinfo->height && row; y++) {
+	    uae_u32 *src = (uae_u32 *)(gfxinfo->bufmem + y * gfxinfo->rowbytes);
+
+	    for (x = 0; x < gfxinfo->width; x++) {
+		row[x * 3 + 0] = src[x] >> 16;
+		row[x * 3 + 1] = src[x] >> 8;
+		row[x * 3 + 2] = src[x];
+	    }
+	    fwrite (row, 3, gfxinfo->width, f);
+	}
+	free (row);
+    }
+    fclose (f);
+}
+
+static void flush_line_headless (struct vidbuf_description *gfxinfo, int line_no)
+{
+}
+
+static void flush_block_headless (struct vidbuf_description *gfxinfo, int first_line, int last_line)
+{
+}
+
+static void flush_screen_headless (struct vidbuf_description *gfxinfo, int first_line, int last_line)
+{
+}
+
+static void flush_clear_screen_headless (struct vidbuf_description *gfxinfo)
+{
+    memset (gfxinfo->bufmem, 0, gfxinfo->rowbytes * gfxinfo->height);
+}
+
+static int lockscr_headless (struct vidbuf_description *gfxinfo)
+{
+    return want_frame ();
+}
+
+static void unlockscr_headless (struct vidbuf_description *gfxinfo)
+{
+    dump_frame (gfxinfo);
+}
+
+/****************************************************************************/
+
+struct bstring *video_mode_menu = NULL;
+
+void vidmode_menu_selected (int a)
+{
+}
+
+int graphics_setup (void)
+{
+    return 1;
+}
+
+int graphics_init (void)
+{
+    fixup_prefs_dimensions (&currprefs);
+
+    gfxvidinfo.width = currprefs.gfx_width_win;
+    gfxvidinfo.height = currprefs.gfx_height_win;
+    gfxvidinfo.pixbytes = 4;
+    gfxvidinfo.rowbytes = gfxvidinfo.width * gfxvidinfo.pixbytes;
+    gfxvidinfo.bufmem = calloc (gfxvidinfo.rowbytes, gfxvidinfo.height + 1);
+    gfxvidinfo.linemem = 0;
+    gfxvidinfo.emergmem = 0;
+    gfxvidinfo.maxblocklines = 0;
+    if (!gfxvidinfo.bufmem) {
+	write_log ("HEADLESS: Not enough memory.\n");
+	return 0;
+    }
+
+    alloc_colors64k (8, 8, 8, 16, 8, 0, 0, 0, 0, 0);
+
+    gfxvidinfo.lockscr = lockscr_headless;
+    gfxvidinfo.unlockscr = unlockscr_headless;
+    gfxvidinfo.flush_line = flush_line_headless;
+    gfxvidinfo.flush_block = flush_block_headless;
+    gfxvidinfo.flush_rects = 0;
+    gfxvidinfo.flush_screen = flush_screen_headless;
+    gfxvidinfo.flush_clear_screen = flush_clear_screen_headless;
+
+    /* Frame skipping would make custom.c skip its line decisions, and with
+     * them collision detection, so always "draw" every frame; the frames we
+     * don't want are refused in lockscr instead. Run unthrottled, as in
+     * warp mode. */
+    currprefs.gfx_framerate = changed_prefs.gfx_framerate = 1;
+    if (!turbo_emulation)
+	turbo_emulation = currprefs.gfx_framerate;
+
+    frame_count = 0;
+    write_log ("HEADLESS: %dx%d, dumping %s\n", gfxvidinfo.width, gfxvidinfo.height,
+	       currprefs.headless_dump_interval > 0 ? "enabled" : "disabled");
+
+    reset_drawing ();
+
+    return 1;
+}
+
+void graphics_leave (void)
+{
+    free (gfxvidinfo.bufmem);
+    gfxvidinfo.bufmem = 0;
+}
+
+void graphics_notify_state (int state)
+{
+}
+
+/* Called once per emulated frame. */
+void handle_events (void)
+{
+    frame_count++;
+    if (currprefs.headless_frames > 0 && frame_count >= (unsigned long) currprefs.headless_frames)
+	uae_quit ();
+}
+
+/***************************************************************************/
+
+int check_prefs_changed_gfx (void)
+{
+    return 0;
+}
+
+int debuggable (void)
+{
+    return 1;
+}
+
+int mousehack_allowed (void)
+{
+    return 0;
+}
+
+int is_fullscreen (void)
+{
+    return 0;
+}
+
+int is_vsync (void)
+{
+    return 0;
+}
+
+void toggle_fullscreen (void)
+{
+}
+
+void toggle_mousegrab (void)
+{
+}
+
+void screenshot (int mode)
+{
+    dump_frame (&gfxvidinfo);
+}
+
+/*
+ * Mouse inputdevice functions
+ */
+
+/* There is no host mouse, but the input device layer expects one. */
+#define MAX_BUTTONS	3
+#define MAX_AXES	3
+#define FIRST_AXIS	0
+#define FIRST_BUTTON	MAX_AXES
+
+static int init_mouse (void)
+{
+    return 1;
+}
+
+static void close_mouse (void)
+{
+}
+
+static int acquire_mouse (unsigned int num, int flags)
+{
+    return 1;
+}
+
+static void unacquire_mouse (unsigned int num)
+{
+}
+
+static unsigned int get_mouse_num (void)
+{
+    return 1;
+}
+
+static const char *get_mouse_name (unsigned int mouse)
+{
+    return "Default mouse";
+}
+
+static unsigned int get_mouse_widget_num (unsigned int mouse)
+{
+    return MAX_AXES + MAX_BUTTONS;
+}
+
+static int get_mouse_widget_first (unsigned int mouse, int type)
+{
+    switch (type) {
+	case IDEV_WIDGET_BUTTON:
+	    return FIRST_BUTTON;
+	case IDEV_WIDGET_AXIS:
+	    return FIRST_AXIS;
+    }
+    return -1;
+}
+
+static int get_mouse_widget_type (unsigned int mouse, unsigned int num, char *name, uae_u32 *code)
+{
+    if (num >= MAX_AXES && num < MAX_AXES + MAX_BUTTONS) {
+	if (name)
+	    sprintf (name, "Button %d", num + 1 + MAX_AXES);
+	return IDEV_WIDGET_BUTTON;
+    } else if (num < MAX_AXES) {
+	if (name)
+	    sprintf (name, "Axis %d", num + 1);
+	return IDEV_WIDGET_AXIS;
+    }
+    return IDEV_WIDGET_NONE;
+}
+
+static void read_mouse (void)
+{
+}
+
+struct inputdevice_functions inputdevicefunc_mouse = {
+    init_mouse,
+    close_mouse,
+    acquire_mouse,
+    unacquire_mouse,
+    read_mouse,
+    get_mouse_num,
+    get_mouse_name,
+    get_mouse_widget_num,
+    get_mouse_widget_type,
+    get_mouse_widget_first
+};
+
+/*
+ * Keyboard inputdevice functions
+ */
+static unsigned int get_kb_num (void)
+{
+    return 1;
+}
+
+static const char *get_kb_name (unsigned int kb)
+{
+    return "Default keyboard";
+}
+
+static unsigned int get_kb_widget_num (unsigned int kb)
+{
+    return 255;
+}
+
+static int get_kb_widget_first (unsigned int kb, int type)
+{
+    return 0;
+}
+
+static int get_kb_widget_type (unsigned int kb, unsigned int num, char *name, uae_u32 *code)
+{
+    *code = num;
+    return IDEV_WIDGET_KEY;
+}
+
+static int init_kb (void)
+{
+    return 1;
+}
+
+static void close_kb (void)
+{
+}
+
+static void read_kb (void)
+{
+}
+
+static int acquire_kb (unsigned int num, int flags)
+{
+    return 1;
+}
+
+static void unacquire_kb (unsigned int num)
+{
+}
+
+struct inputdevice_functions inputdevicefunc_keyboard =
+{
+    init_kb,
+    close_kb,
+    acquire_kb,
+    unacquire_kb,
+    read_kb,
+    get_kb_num,
+    get_kb_name,
+    get_kb_widget_num,
+    get_kb_widget_type,
+    get_kb_widget_first
+};
+
+int getcapslockstate (void)
+{
+    return 0;
+}
+
+void setcapslockstate (int state)
+{
+}
+
+/*
+ * Default inputdevice config for mouse
+ */
+void input_get_default_mouse (struct uae_input_device *uid)
+{
+    uid[0].eventid[ID_AXIS_OFFSET + 0][0]   = INPUTEVENT_MOUSE1_HORIZ;
+    uid[0].eventid[ID_AXIS_OFFSET + 1][0]   = INPUTEVENT_MOUSE1_VERT;
+    uid[0].eventid[ID_AXIS_OFFSET + 2][0]   = INPUTEVENT_MOUSE1_WHEEL;
+    uid[0].eventid[ID_BUTTON_OFFSET + 0][0] = INPUTEVENT_JOY1_FIRE_BUTTON;
+    uid[0].eventid[ID_BUTTON_OFFSET + 1][0] = INPUTEVENT_JOY1_2ND_BUTTON;
+    uid[0].eventid[ID_BUTTON_OFFSET + 2][0] = INPUTEVENT_JOY1_3RD_BUTTON;
+    uid[0].enabled = 1;
+}
+
+/*
+ * Handle gfx specific cfgfile options
+ */
+void gfx_default_options (struct uae_prefs *p)
+{
+    p->headless_frames = 0;
+    p->headless_dump_interval = 0;
+    p->headless_dump_format = DUMP_FORMAT_PPM;
+    strcpy (p->headless_dump_dir, ".");
+}
+
+void gfx_save_options (FILE *f, const struct uae_prefs *p)
+{
+    cfgfile_write (f, GFX_NAME ".frames=%d\n", p->headless_frames);
+    cfgfile_write (f, GFX_NAME ".dump_interval=%d\n", p->headless_dump_interval);
+    cfgfile_write (f, GFX_NAME ".dump_dir=%s\n", p->headless_dump_dir);
+    cfgfile_write (f, GFX_NAME ".dump_format=%s\n", dump_formats[p->headless_dump_format]);
+}
+
+int gfx_parse_option (struct uae_prefs *p, const char *option, const char *value)
+{
+    return (cfgfile_intval (option, value, "frames", &p->headless_frames, 1)
+	 || cfgfile_intval (option, value, "dump_interval", &p->headless_dump_interval, 1)
+	 || cfgfile_string (option, value, "dump_dir", p->headless_dump_dir, sizeof p->headless_dump_dir)
+	 || cfgfile_strval (option, value, "dump_format", &p->headless_dump_format, dump_formats, 0));
+}
@@ -677,6 +677,23 @@ static void sdl_flush_block (struct vidbuf_description *gfxinfo, int first_line,
     SDL_LockSurface (display);
 }
 
+/* Push all areas redrawn this frame to the screen with one update call. */
+static void sdl_flush_rects (struct vidbuf_description *gfxinfo, const struct dirty_rect *rects, int nr_rects)
+{
+    SDL_Rect sdl_rects[MAX_DIRTY_RECTS];
+    int i;
+
+    DEBUG_LOG ("Function: flush_rects %d\n", nr_rects);
+
+    for (i = 0; i < nr_rects; i++) {
+	sdl_rects[i].x = rects[i].x;
+	sdl_rects[i].y = rects[i].y;
+	sdl_rects[i].w = rects[i].width;
+	sdl_rects[i].h = rects[i].height;
+    }
+    SDL_UpdateRects (display, nr_rects, sdl_rects);
+}
+
 static void sdl_flush_screen_dummy (struct vidbuf_description *gfxinfo, int first_line, int last_line)
 {
 }
@@ -731,6 +748,16 @@ static void sdl_gl_flush_block (struct vidbuf_description *gfxinfo, int first_li
     flush_gl_buffer (&glbuffer, first_line, last_line);
 }
 
+static void sdl_gl_flush_rects (struct vidbuf_description *gfxinfo, const struct dirty_rect *rects, int nr_rects)
+{
+    int i;
+
+    DEBUG_LOG ("Function: sdl_gl_flush_rects %d\n", nr_rects);
+
+    for (i = 0; i < nr_rects; i++)
+	flush_gl_buffer (&glbuffer, rects[i].y, rects[i].y + rects[i].height - 1);
+}
+
 /* Single-buffered flush-screen method */
 static void sdl_gl_flush_screen (struct vidbuf_description *gfxinfo, int first_line, int last_line)
 {
@@ -888,6 +915,7 @@ static int graphics_subinit_gl (void)
 	gfxvidinfo.lockscr = sdl_gl_lock;
 	gfxvidinfo.unlockscr = sdl_gl_unlock;
 	gfxvidinfo.flush_block = sdl_gl_flush_block;
+	gfxvidinfo.flush_rects = sdl_gl_flush_rects;
 	gfxvidinfo.flush_clear_screen = sdl_gl_flush_clear_screen;
 
 	if (dblbuff) {
@@ -1007,10 +1035,12 @@ static int graphics_subinit (void)
 					  screen->format->Rmask, screen->format->Gmask, screen->format->Bmask, 0);
 
 	    gfxvidinfo.flush_screen = sdl_flush_screen_flip;
+	    gfxvidinfo.flush_rects  = 0;
 	} else {
 	    display = screen;
 
 	    gfxvidinfo.flush_screen = sdl_flush_screen_dummy;
+	    gfxvidinfo.flush_rects  = sdl_flush_rects;
 	}
 
 #ifdef PICASSO96
@@ -478,6 +478,39 @@ static void x11_flush_block_mitshm (struct vidbuf_description *gfxinfo, int firs
 		  0);
 }
 
+/*
+ * flush_rects() buffer method for a normal image buffer (no dithering and not low-bandwidth)
+ */
+static void x11_flush_rects (struct vidbuf_description *gfxinfo, const struct dirty_rect *rects, int nr_rects)
+{
+    int i;
+
+    for (i = 0; i < nr_rects; i++)
+	XPutImage (display, mywin, mygc,
+		   ami_dinfo.ximg,
+		   rects[i].x, rects[i].y,
+		   rects[i].x, rects[i].y,
+		   rects[i].width,
+		   rects[i].height);
+}
+
+/*
+ * flush_rects() buffer method for shm image buffer (no dithering and not low-bandwidth)
+ */
+static void x11_flush_rects_mitshm (struct vidbuf_description *gfxinfo, const struct dirty_rect *rects, int nr_rects)
+{
+    int i;
+
+    for (i = 0; i < nr_rects; i++)
+	XShmPutImage (display, mywin, mygc,
+		      ami_dinfo.ximg,
+		      rects[i].x, rects[i].y,
+		      rects[i].x, rects[i].y,
+		      rects[i].width,
+		      rects[i].height,
+		      0);
+}
+
 
 STATIC_INLINE int bitsInMask (unsigned long mask)
 {
@@ -812,6 +845,7 @@ static void graphics_subinit (void)
     picasso_vidinfo.extra_mem = 1;
 
     gfxvidinfo.flush_screen = x11_flush_screen;
+    gfxvidinfo.flush_rects  = 0;
     gfxvidinfo.lockscr      = x11_lock;
     gfxvidinfo.unlockscr    = x11_unlock;
 
@@ -848,10 +882,13 @@ static void graphics_subinit (void)
 	} else {
 	    gfxvidinfo.maxblocklines = MAXBLOCKLINES_MAX;
 
-	    if (shmavail && currprefs.x11_use_mitshm)
+	    if (shmavail && currprefs.x11_use_mitshm) {
 		gfxvidinfo.flush_block  = x11_flush_block_mitshm;
-	    else
+		gfxvidinfo.flush_rects  = x11_flush_rects_mitshm;
+	    } else {
 		gfxvidinfo.flush_block  = x11_flush_block;
+		gfxvidinfo.flush_rects  = x11_flush_rects;
+	    }
 	}
     }
 
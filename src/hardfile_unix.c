@@ -11,6 +11,7 @@
 #include "sysdeps.h"
 
 #include "filesys.h"
+#include "zfile.h"
 
 //#define HDF_DEBUG
 #ifdef  HDF_DEBUG
@@ -92,12 +93,55 @@ static void poscheck (struct hardfiledata *hfd, int len)
     }
 }
 
+/* Read-only hardfiles are read through zfile, which maps plain files and
+ * reads gzip and zip archives in place. Returns -1 for a compressed image
+ * that was asked for with write access, so that the caller fails and the
+ * mount is retried read-only. */
+static int hdf_open_zfile (struct hardfiledata *hfd, const char *name)
+{
+    struct zfile *zf = zfile_fopen (name, "rb");
+
+    if (!zf)
+	return 0;
+    if (!hfd->readonly) {
+	int compressed = zfile_iscompressed (zf);
+	zfile_fclose (zf);
+	if (compressed) {
+	    write_log ("hd: '%s' is compressed and can only be mounted read-only\n", name);
+	    return -1;
+	}
+	return 0;
+    }
+    hfd->zfile = zf;
+    hfd->handle = -1;
+    hfd->cache = 0;
+    strncpy (hfd->device_name, name, sizeof hfd->device_name - 1);
+    zfile_fseek (zf, 0, SEEK_END);
+    hfd->size = hfd->size2 = zfile_ftell (zf);
+    hfd->blocksize = 512;
+    zfile_fseek (zf, 0, SEEK_SET);
+    return 1;
+}
+
 int hdf_open (struct hardfiledata *hfd, const char *name)
 {
-    int handle;
+    int handle, z;
 
     DEBUG_LOG ("called with name=%s\n",name);
 
+    hfd->zfile = 0;
+    z = hdf_open_zfile (hfd, name);
+    if (z < 0)
+	return 0;
+    if (z) {
+	const char *p = strrchr (name, '/');
+	strcpy (hfd->vendor_id, "UAE");
+	strncpy (hfd->product_id, p ? p + 1 : name, 15);
+	strcpy (hfd->product_rev, "0.2");
+	DEBUG_LOG ("okay, read through zfile\n");
+	return 1;
+    }
+
    if ((handle = open (name, hfd->readonly ? O_RDONLY : O_RDWR)) != -1) {
 	int i;
 
@@ -131,7 +175,9 @@ extern int hdf_dup (struct hardfiledata *dhfd, const struct hardfiledata *shfd)
 {
     DEBUG_LOG ("called\n");
 
-    if (shfd->handle >= 0) {
+    if (shfd->zfile) {
+	dhfd->zfile = zfile_fopen (shfd->device_name, "rb");
+    } else if (shfd->handle >= 0) {
 	dhfd->handle = dup (shfd->handle);
     }
 
@@ -142,7 +188,11 @@ void hdf_close (struct hardfiledata *hfd)
 {
     DEBUG_LOG ("called\n");
 
-    close (hfd->handle);
+    if (hfd->zfile) {
+	zfile_fclose (hfd->zfile);
+	hfd->zfile = 0;
+    } else
+	close (hfd->handle);
     hfd->handle = -1;
 }
 
@@ -153,6 +203,12 @@ int hdf_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
     DEBUG_LOG ("called with offset=0x%llx len=%d\n", offset, len);
 
     hfd->cache_valid = 0;
+    if (hfd->zfile) {
+	if (offset >= hfd->size)
+	    return 0;
+	zfile_fseek (hfd->zfile, hfd->offset + offset, SEEK_SET);
+	return zfile_fread (buffer, 1, len, hfd->zfile);
+    }
     hdf_seek (hfd, offset);
     poscheck (hfd, len);
     n = read (hfd->handle, buffer, len);
@@ -169,6 +225,8 @@ int hdf_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
     DEBUG_LOG ("called with offset=0x%llx len=%d\n", offset, len);
 
     hfd->cache_valid = 0;
+    if (hfd->zfile)
+	return 0;
     hdf_seek (hfd, offset);
     poscheck (hfd, len);
     n = write (hfd->handle, buffer, len);
@@ -52,3 +52,53 @@ STATIC_INLINE uae_u32 do_chipmem_lget (uaecptr addr)
 #define chipmem_wput do_chipmem_wput
 #define chipmem_wget do_chipmem_wget
 #define chipmem_lget do_chipmem_lget
+
+/*
+ * Decoded copper lists
+ *
+ * words[] holds the instructions of a list as they were in chip RAM and
+ * stop[i] is the index of the first instruction at or after i that is not
+ * a MOVE to a colour register (len if there is none).
+ */
+#define COPCACHE_MAX 2048
+
+struct copcache {
+    uae_u32 start;	/* chip RAM offset of the first instruction */
+    int len;		/* instructions, 0 if the slot is free */
+    uae_u32 crc;
+    int checked;
+    uae_u16 words[COPCACHE_MAX * 2];
+    uae_u16 stop[COPCACHE_MAX];
+};
+
+STATIC_INLINE int copper_is_colour_move (unsigned int i1)
+{
+    return !(i1 & 1) && (i1 & 0x1FE) >= 0x180 && (i1 & 0x1FE) < 0x1C0;
+}
+
+/* Decode the list at offset START of the SIZE bytes at MEM, up to and
+   including the end marker; returns the number of instructions.  */
+STATIC_INLINE int copper_cache_decode (struct copcache *c, const uae_u8 *mem, uae_u32 start, uae_u32 size)
+{
+    int i, n;
+
+    for (n = 0; n < COPCACHE_MAX && start + n * 4 + 4 <= size; n++) {
+	uae_u16 i1 = do_get_mem_word ((uae_u16 *)(mem + start + n * 4));
+	uae_u16 i2 = do_get_mem_word ((uae_u16 *)(mem + start + n * 4 + 2));
+	c->words[n * 2] = i1;
+	c->words[n * 2 + 1] = i2;
+	if (i1 == 0xFFFF && i2 == 0xFFFE) {
+	    n++;
+	    break;
+	}
+    }
+    for (i = n - 1; i >= 0; i--) {
+	if (!copper_is_colour_move (c->words[i * 2]))
+	    c->stop[i] = i;
+	else
+	    c->stop[i] = i + 1 < n ? c->stop[i + 1] : n;
+    }
+    c->start = start;
+    c->len = n;
+    return n;
+}
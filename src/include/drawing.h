@@ -175,6 +175,32 @@ struct sprite_entry
     unsigned int has_attached;
 };
 
+/* Return the first position from POS up to MAX at which the sprite buffer
+ * BUF (indexed like spixels for an entry, i.e. by sprite position) has any
+ * sprite pixel set, or MAX if there is none. Sprite data is mostly
+ * transparent, so this tests four pixels at a time once aligned; the
+ * buffer of each sprite entry is padded to a multiple of four pixels. */
+STATIC_INLINE int sprite_next_occupied (const uae_u16 *buf, int pos, int max)
+{
+    uae_u64 v;
+
+    while (pos < max && ((uae_uintptr)(buf + pos) & 7) != 0) {
+	if (buf[pos])
+	    return pos;
+	pos++;
+    }
+    while (pos < max) {
+	/* One load, without reading uae_u16s through a uae_u64 */
+	memcpy (&v, buf + pos, sizeof v);
+	if (v)
+	    break;
+	pos += 4;
+    }
+    while (pos < max && !buf[pos])
+	pos++;
+    return pos < max ? pos : max;
+}
+
 union sps_union {
     uae_u8 bytes[2 * MAX_SPR_PIXELS];
     uae_u32 words[2 * MAX_SPR_PIXELS / 4];
@@ -20,6 +20,7 @@ struct hardfiledata {
     int reservedblocks;
     unsigned int blocksize;
     int handle;
+    struct zfile *zfile;	/* read-only hardfiles, instead of handle */
     int readonly;
     int flags;
     uae_u8 *cache;
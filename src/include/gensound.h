@@ -27,6 +27,12 @@ extern void sound_volume (int dir);
 
 extern void switch_audio_interpol (void);
 
+/* For drivers that queue sound: report the queue's fill level and the
+ * level it should be kept at, in any unit, once per buffer handed over.
+ * The sample rate is then nudged slightly to converge on that level. */
+extern void sound_report_fill (int fill, int target);
+extern double sound_get_rate_adjust (void);
+
 extern void sample16_handler (void);
 extern void sample16s_handler (void);
 extern void sample16ss_handler (void);
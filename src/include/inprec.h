@@ -0,0 +1,35 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Input recording and playback
+  */
+
+#define INPREC_RECORD 1
+#define INPREC_PLAYBACK 2
+
+#ifdef SAVESTATE
+
+extern int inprec_mode;
+
+extern void inprec_prepare (const char *filename, int mode);
+extern void inprec_close (void);
+extern void inprec_vsync (void);
+extern void inprec_hsync (void);
+
+extern int inprec_event (int nr, int state, int max, int autofire);
+extern int inprec_keyboard (int code, int state);
+extern int inprec_key (int kc);
+extern int inprec_pulse (int nr);
+
+#else
+
+#define inprec_mode 0
+#define inprec_close()
+#define inprec_vsync()
+#define inprec_hsync()
+#define inprec_event(nr, state, max, autofire) 0
+#define inprec_keyboard(code, state) 0
+#define inprec_key(kc) 0
+#define inprec_pulse(nr) 0
+
+#endif
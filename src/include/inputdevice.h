@@ -94,6 +94,7 @@ extern void inputdevice_updateconfig (struct uae_prefs *prefs);
 extern int inputdevice_translatekeycode (int keyboard, int scancode, int state);
 extern void inputdevice_setkeytranslation (struct uae_input_device_kbr_default *trans);
 extern int handle_input_event (int nr, int state, int max, int autofire);
+extern void inputdevice_pulse_event (int nr);
 extern void inputdevice_do_keyboard (int code, int state);
 void inputdevice_release_all_keys (void);
 
@@ -109,6 +110,7 @@ extern uae_u16 JOY1DAT (void);
 extern void inputdevice_vsync (void);
 extern void inputdevice_hsync (void);
 extern void inputdevice_reset (void);
+extern void inputdevice_inprec_prepare (void);
 
 extern void write_inputdevice_config (const struct uae_prefs *p, FILE *f);
 extern void read_inputdevice_config (struct uae_prefs *p, const char *option, const char *value);
@@ -263,6 +263,15 @@ extern void chipmem_wput (uaecptr, uae_u32) REGPARAM;
 extern void chipmem_bput (uaecptr, uae_u32) REGPARAM;
 
 extern uae_u32 chipmem_mask, kickmem_mask;
+
+/* Chip RAM offsets [copper_cache_lo, copper_cache_hi) hold copper lists
+ * that custom.c has decoded; CPU and blitter writes there must call
+ * copper_cache_write. Disk DMA does not; the lists are checked against
+ * chip RAM once a frame anyway. */
+extern uae_u32 copper_cache_lo, copper_cache_hi;
+extern void copper_cache_write (uae_u32 offset);
+#define copper_cache_check(offset) \
+    do { if ((offset) - copper_cache_lo < copper_cache_hi - copper_cache_lo) copper_cache_write (offset); } while (0)
 extern uae_u8 *kickmemory;
 extern unsigned int kickmem_size;
 extern addrbank dummy_bank;
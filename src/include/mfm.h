@@ -0,0 +1,39 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * MFM encoding and decoding of floppy data
+  */
+
+/*
+ * MFM words are held as host uae_u16s, the first bit on disk in bit 15.
+ * Data bits are the even numbered bits, clock bits the odd numbered ones.
+ */
+
+/* Set the clock bits of WORDS words of data bits; PREV is the word before
+ * them on the track. */
+extern void mfm_clock (uae_u16 *mfm, unsigned int words, uae_u16 prev);
+
+/* Encode LEN bytes as one MFM word each, clock bits included. */
+extern void mfm_encode_bytes (const uae_u8 *src, uae_u16 *mfm, unsigned int len, uae_u16 prev);
+
+/* Split LONGS big-endian longwords into their odd and their even bits, the
+ * way AmigaDOS sectors store them, without clock bits. Returns the XOR of
+ * all resulting odd and even longwords. */
+extern uae_u32 mfm_encode_oddeven (const uae_u8 *src, uae_u16 *odd, uae_u16 *even, unsigned int longs);
+
+/* The reverse, with the MFM stream starting SHIFT bits into the first word
+ * of ODD and EVEN. Returns the XOR of the odd and even longwords read,
+ * clock bits masked out. */
+extern uae_u32 mfm_decode_oddeven (const uae_u16 *odd, const uae_u16 *even, unsigned int shift,
+				   uae_u8 *dst, unsigned int longs);
+
+/* The data bits of one MFM word. */
+STATIC_INLINE uae_u8 mfm_decode_word (uae_u16 mfm)
+{
+    uae_u32 v = mfm & 0x5555;
+
+    v = (v | (v >> 1)) & 0x3333;
+    v = (v | (v >> 2)) & 0x0f0f;
+    v = (v | (v >> 4)) & 0x00ff;
+    return v;
+}
@@ -79,6 +79,8 @@ struct uae_prefs {
     int sound_interpol;
     int sound_adjust;
     int sound_volume;
+    char sound_capture_file[256];
+    int sound_capture_format;
 
 #ifdef JIT
     int comptrustbyte;
@@ -134,6 +136,7 @@ struct uae_prefs {
     int keyboard_leds[3];
     int keyboard_leds_in_use;
     int scsi;
+    int cd32_cache_size;
     int catweasel_io;
     int cpu_idle;
     int cpu_cycle_exact;
@@ -178,6 +181,7 @@ struct uae_prefs {
 
     int nr_floppies;
     int dfxtype[4];
+    char dms_cache_dir[256];
 #ifdef DRIVESOUND
     int dfxclick[4];
     char dfxclickexternal[4][256];
@@ -201,6 +205,13 @@ struct uae_prefs {
     int curses_reverse_video;
 #endif
 
+#ifdef USE_HEADLESS_GFX
+    int headless_frames;
+    int headless_dump_interval;
+    int headless_dump_format;
+    char headless_dump_dir[256];
+#endif
+
 #if defined USE_SDL_GFX || defined USE_X11_GFX
     int map_raw_keys;
 #endif
@@ -0,0 +1,47 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Picasso96 board operations on host memory
+  */
+
+/*
+ * All rectangles are given as a pointer to their top left byte, the number
+ * of bytes between rows and their size; widths are in bytes except where
+ * noted. MINTERM is one of the 16 raster operations, numbered as in
+ * BLIT_OPCODE (bit 3 is the result for src=1/dst=1, bit 2 for src=1/dst=0,
+ * bit 1 for src=0/dst=1 and bit 0 for src=0/dst=0).
+ */
+extern void p96_fill_rect (uae_u8 *dst, int bytes_per_row, int width, int height,
+			   uae_u32 pen, int Bpp);
+extern void p96_invert_rect (uae_u8 *dst, int bytes_per_row, int width, int height,
+			     uae_u8 mask);
+extern void p96_blit_rect_minterm (const uae_u8 *src, int src_bytes_per_row,
+				   uae_u8 *dst, int dst_bytes_per_row,
+				   int width, int height, int minterm);
+extern void p96_blit_rect_masked (const uae_u8 *src, int src_bytes_per_row,
+				  uae_u8 *dst, int dst_bytes_per_row,
+				  int width, int height, uae_u8 mask);
+
+/*
+ * Convert WIDTH x HEIGHT pixels of planar data to one byte per pixel.
+ * PLANES[k] points at the byte holding the first pixel of plane k; a null
+ * pointer stands for a plane of all zeros, or of all ones if bit k of ONES
+ * is set. BITOFFSET is the position of the first pixel within that byte.
+ */
+extern void p96_planar_to_chunky (uae_u8 *image, int image_bytes_per_row,
+				  uae_u8 *const *planes, int depth, uae_u8 ones,
+				  int planes_bytes_per_row, int bitoffset,
+				  int width, int height);
+
+/*
+ * Draw WIDTH x HEIGHT pixels of a one-plane image in pens of BPP bytes.
+ * Row y of the image starts at BITS + y * BITS_BYTES_PER_ROW, with its
+ * first pixel at bit 7 - BITOFFSET of the first byte; one byte past the
+ * end of each row is read. DRAWMODE is JAM1 (0), JAM2 (1) or COMP (2) as
+ * in picasso96.h, and INVERT flips the image for JAM1 and JAM2. MASK only
+ * applies to one-byte pixels and not to COMP.
+ */
+extern void p96_blit_template (uae_u8 *dst, int dst_bytes_per_row,
+			       const uae_u8 *bits, int bits_bytes_per_row, int bitoffset,
+			       int width, int height, int Bpp, int drawmode, int invert,
+			       uae_u32 fgpen, uae_u32 bgpen, uae_u8 mask);
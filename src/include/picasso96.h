@@ -10,6 +10,12 @@
 #ifndef PICASSO96_H
 #define PICASSO96_H
 
+/* Draw modes; p96blit.c uses them without PICASSO96_SUPPORTED too */
+#define JAM1 0
+#define JAM2 1
+#define COMP 2
+#define INVERS 4
+
 #if defined PICASSO96_SUPPORTED
 
 #define PICASSO96
@@ -18,11 +24,6 @@
 #define PIC_READ	(SPECIAL_MEM_READ | SPECIAL_MEM_WRITE)
 #define PIC_WRITE	(SPECIAL_MEM_READ | SPECIAL_MEM_WRITE)
 
-#define JAM1 0
-#define JAM2 1
-#define COMP 2
-#define INVERS 4
-
 typedef enum {
     BLIT_FALSE,
     BLIT_NOR,
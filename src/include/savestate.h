@@ -113,6 +113,7 @@ extern void savestate_initsave (const char *filename, int docompress);
 extern void save_state (const char *filename, const char *description);
 extern void restore_state (const char *filename);
 extern void savestate_restore_finish (void);
+extern void savestate_writer_wait (void);
 
 extern void custom_save_state (void);
 extern void custom_prepare_savestate (void);
@@ -129,7 +130,10 @@ extern void savestate_free (void);
 extern void savestate_init (void);
 extern void savestate_rewind (void);
 extern int savestate_dorewind (int);
+extern int savestate_seek (unsigned int frame);
+extern unsigned int savestate_frame (void);
 extern void savestate_listrewind (void);
+extern void savestate_rewindinfo (void);
 
 #else
 
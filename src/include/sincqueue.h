@@ -0,0 +1,99 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Queue of pending BLEPs for the sinc interpolator
+  *
+  * Every change of a channel's output is remembered as a BLEP (the step
+  * size and when it happened) until it is older than the windowed sinc
+  * integral it is mixed with. Entries are stored with their time stamp
+  * rather than their age, so nothing needs updating as time passes, and in
+  * a ring with every entry written twice, LENGTH entries apart, so that the
+  * live entries can always be read as one contiguous run.
+  */
+
+#ifndef UAE_SINCQUEUE_H
+#define UAE_SINCQUEUE_H
+
+#include "sinctable.h"
+
+/* periods less than this value are replaced by this value. */
+#define MIN_ALLOWED_PERIOD 16
+/* reserve ~20 extra slots in sinc queue for cpu volume or some such updates
+ * even at maximum period. This avoids sinc queue overflow on games like
+ * battle squadron that write these low period values and do cpu-based
+ * updates on paula registers, probably volume. */
+#define NUMBER_OF_CPU_UPDATES_ALLOWED 20
+
+#define SINC_QUEUE_LENGTH (SINC_QUEUE_MAX_AGE / MIN_ALLOWED_PERIOD + NUMBER_OF_CPU_UPDATES_ALLOWED)
+
+struct sinc_queue {
+    unsigned int time[2 * SINC_QUEUE_LENGTH];
+    int output[2 * SINC_QUEUE_LENGTH];
+    unsigned int now;
+    /* Slot for the next entry, and number of live entries before it. */
+    int head, length;
+};
+
+/* Index of the oldest live entry; the newest is at oldest + length - 1. */
+STATIC_INLINE int sinc_queue_oldest (const struct sinc_queue *q)
+{
+    int i = q->head - q->length;
+    return i < 0 ? i + SINC_QUEUE_LENGTH : i;
+}
+
+/* Let DT cycles pass, dropping the entries that have aged out. */
+STATIC_INLINE void sinc_queue_advance (struct sinc_queue *q, unsigned int dt)
+{
+    int i;
+
+    q->now += dt;
+    i = sinc_queue_oldest (q);
+    while (q->length > 0 && q->now - q->time[i] >= SINC_QUEUE_MAX_AGE) {
+	q->length--;
+	if (++i == SINC_QUEUE_LENGTH)
+	    i = 0;
+    }
+}
+
+/* Add a step of OUTPUT that happened AGE cycles ago. If the queue is full,
+ * the oldest entry is dropped and its age returned; otherwise -1. */
+STATIC_INLINE int sinc_queue_push (struct sinc_queue *q, int output, unsigned int age)
+{
+    int dropped = -1;
+    int h = q->head;
+
+    if (q->length == SINC_QUEUE_LENGTH) {
+	dropped = q->now - q->time[h];
+	q->length--;
+    }
+    q->time[h] = q->time[h + SINC_QUEUE_LENGTH] = q->now - age;
+    q->output[h] = q->output[h + SINC_QUEUE_LENGTH] = output;
+    q->head = h + 1 == SINC_QUEUE_LENGTH ? 0 : h + 1;
+    q->length++;
+    return dropped;
+}
+
+/* Sum of all queued steps, each weighted by WINSINC at its age. The loop
+ * keeps four independent sums so that the table lookups, which are the
+ * bulk of the work, can overlap. */
+STATIC_INLINE int sinc_queue_mix (const struct sinc_queue *q, const int *winsinc)
+{
+    const unsigned int *t = q->time + sinc_queue_oldest (q);
+    const int *o = q->output + sinc_queue_oldest (q);
+    unsigned int now = q->now;
+    int n = q->length;
+    int s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int j;
+
+    for (j = 0; j + 4 <= n; j += 4) {
+	s0 += winsinc[now - t[j]] * o[j];
+	s1 += winsinc[now - t[j + 1]] * o[j + 1];
+	s2 += winsinc[now - t[j + 2]] * o[j + 2];
+	s3 += winsinc[now - t[j + 3]] * o[j + 3];
+    }
+    for (; j < n; j++)
+	s0 += winsinc[now - t[j]] * o[j];
+    return s0 + s1 + s2 + s3;
+}
+
+#endif /* UAE_SINCQUEUE_H */
@@ -0,0 +1,30 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Capturing sound output to a file
+  */
+
+#ifndef UAE_SOUNDCAPTURE_H
+#define UAE_SOUNDCAPTURE_H
+
+#define SOUND_CAPTURE_WAV  0
+#define SOUND_CAPTURE_FLAC 1
+
+extern int sound_capture_active;
+
+/* Start capturing 16-bit samples at FREQ Hz with CHANNELS interleaved
+ * channels to FILENAME; FORMAT is one of the SOUND_CAPTURE_* values. */
+extern int sound_capture_start (const char *filename, int format, int freq, int channels);
+extern void sound_capture_stop (void);
+extern int sound_capture_matches (int freq, int channels);
+
+/* Called by the sound drivers with each buffer of samples they output. */
+extern void sound_capture_write_data (const void *buf, int bytes);
+
+STATIC_INLINE void sound_capture_write (const void *buf, int bytes)
+{
+    if (sound_capture_active)
+	sound_capture_write_data (buf, bytes);
+}
+
+#endif /* UAE_SOUNDCAPTURE_H */
@@ -256,6 +256,13 @@ extern z_off_t ZEXPORT unztell OF((unzFile file));
   Give the current position in uncompressed data
 */
 
+extern int ZEXPORT unzGetCurrentFileDataOffset OF((unzFile file,
+						  uLong *poffset));
+/*
+  Give the position of the data of the current file (opened by
+  unzOpenCurrentFile) in the zipfile, before any data was read
+*/
+
 extern int ZEXPORT unzeof OF((unzFile file));
 /*
   return 1 if the end of file was reached, 0 elsewhere
@@ -39,12 +39,26 @@ extern void DitherLine (uae_u8 *l, uae_u16 *r4g4b4, int x, int y, uae_s16 len, i
 
 
 
+/* A rectangle of the display which was redrawn during a frame. */
+struct dirty_rect
+{
+    int x, y;
+    int width, height;
+};
+
+#define MAX_DIRTY_RECTS 64
+
 struct vidbuf_description
 {
     /* Function implemented by graphics driver */
     void (*flush_line)         (struct vidbuf_description *gfxinfo, int line_no);
     void (*flush_block)        (struct vidbuf_description *gfxinfo, int first_line, int end_line);
     void (*flush_screen)       (struct vidbuf_description *gfxinfo, int first_line, int end_line);
+    /* Optional. If set (and maxblocklines is non-zero), the drawing code
+     * collects the areas redrawn during a frame into a list of dirty
+     * rectangles and passes them here in one go, with the screen unlocked,
+     * when the frame is finished. flush_block is then not called. */
+    void (*flush_rects)        (struct vidbuf_description *gfxinfo, const struct dirty_rect *rects, int nr_rects);
     void (*flush_clear_screen) (struct vidbuf_description *gfxinfo);
     int  (*lockscr)            (struct vidbuf_description *gfxinfo);
     void (*unlockscr)          (struct vidbuf_description *gfxinfo);
@@ -26,6 +26,8 @@ extern int execute_command (char *);
 extern int zfile_iscompressed (struct zfile *z);
 extern int zfile_zcompress (struct zfile *dst, void *src, int size);
 extern int zfile_zuncompress (void *dst, int dstsize, struct zfile *src, int srcsize);
+extern int zfile_zcompress_blocks (struct zfile *dst, const void *src, int size, int blocksize);
+extern int zfile_zuncompress_blocks (void *dst, int dstsize, struct zfile *src, int srcsize);
 extern int zfile_gettype (struct zfile *z);
 extern uae_u32 zfile_crc32 (struct zfile *f);
 
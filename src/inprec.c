@@ -0,0 +1,378 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Input recording and playback
+  *
+  * Recording saves a state file next to the recording, restores it, and
+  * from then on logs every input event that comes from the host, stamped
+  * with the frame and line at which it reached the emulation, and a hash
+  * of the machine at the end of each frame. Playback restores the same
+  * state, ignores the host, feeds the events back at the same frame and
+  * line and compares the hashes, so that two runs can be timed against
+  * each other.
+  *
+  * While recording, host events are held back until the next line, where
+  * playback will feed them in, so that both runs see them at the same
+  * point of the emulation.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "memory.h"
+#include "custom.h"
+#include "newcpu.h"
+#include "cia.h"
+#include "keybuf.h"
+#include "inputdevice.h"
+#include "savestate.h"
+#include "crc32.h"
+#include "hrtimer.h"
+#include "uae.h"
+#include "inprec.h"
+
+#ifdef SAVESTATE
+
+#define INPREC_MAGIC "UAEINREC"
+#define INPREC_VERSION 1
+#define INPREC_SEED 0x55414531
+
+/* Record types */
+#define IR_EVENT 'E'	/* handle_input_event () */
+#define IR_KEYBOARD 'D'	/* inputdevice_do_keyboard () */
+#define IR_KEY 'K'	/* record_key () */
+#define IR_PULSE 'P'	/* inputdevice_pulse_event () */
+#define IR_HASH 'H'	/* machine state at the end of the frame */
+#define IR_END 'X'
+
+struct inprec_record {
+    uae_u32 type, frame, line;
+    uae_u32 data[4];
+};
+
+#define IR_LONGS 7
+
+enum { IP_IDLE, IP_SAVE, IP_RESTORE, IP_RUN, IP_DONE };
+
+int inprec_mode;
+
+static int phase;
+static char inprec_fname[MAX_DPATH];
+static char inprec_statefname[MAX_DPATH];
+static FILE *inprec_file;
+static uae_u32 frame, line;
+static int applying;
+
+/* Host events waiting for the next line while recording */
+#define PENDING_SIZE 256
+static struct inprec_record pending[PENDING_SIZE];
+static int pending_count;
+
+/* The next record while playing back */
+static struct inprec_record next;
+static int next_valid;
+
+static unsigned int mismatches;
+static uae_u32 first_mismatch;
+static frame_time_t start_time;
+
+static void write_record (const struct inprec_record *r)
+{
+    uae_u8 buf[IR_LONGS * 4], *p = buf;
+    uae_u32 v[IR_LONGS];
+    int i;
+
+    v[0] = r->type;
+    v[1] = r->frame;
+    v[2] = r->line;
+    memcpy (v + 3, r->data, sizeof r->data);
+    for (i = 0; i < IR_LONGS; i++) {
+	*p++ = v[i] >> 24;
+	*p++ = v[i] >> 16;
+	*p++ = v[i] >> 8;
+	*p++ = v[i];
+    }
+    fwrite (buf, sizeof buf, 1, inprec_file);
+}
+
+static int read_record (struct inprec_record *r)
+{
+    uae_u8 buf[IR_LONGS * 4], *p = buf;
+    uae_u32 v[IR_LONGS];
+    int i;
+
+    if (fread (buf, sizeof buf, 1, inprec_file) != 1)
+	return 0;
+    for (i = 0; i < IR_LONGS; i++, p += 4)
+	v[i] = ((uae_u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    r->type = v[0];
+    r->frame = v[1];
+    r->line = v[2];
+    memcpy (r->data, v + 3, sizeof r->data);
+    return 1;
+}
+
+static void read_next (void)
+{
+    next_valid = read_record (&next) && next.type != IR_END;
+}
+
+static uae_u32 state_hash (void)
+{
+    uae_u8 cpu[18 * 4], *p = cpu;
+    uae_u32 v;
+    int i;
+
+    MakeSR (&regs);
+    for (i = 0; i < 18; i++) {
+	v = i < 16 ? regs.regs[i] : i == 16 ? m68k_getpc (&regs) : regs.sr;
+	*p++ = v >> 24;
+	*p++ = v >> 16;
+	*p++ = v >> 8;
+	*p++ = v;
+    }
+    return get_crc32 (chipmemory, allocated_chipmem) ^ get_crc32 (cpu, sizeof cpu);
+}
+
+static void apply (const struct inprec_record *r)
+{
+    applying = 1;
+    switch (r->type) {
+     case IR_EVENT:
+	handle_input_event (r->data[0], (uae_s32)r->data[1], (uae_s32)r->data[2], r->data[3]);
+	break;
+     case IR_KEYBOARD:
+	inputdevice_do_keyboard (r->data[0], r->data[1]);
+	break;
+     case IR_KEY:
+	record_key (r->data[0]);
+	break;
+     case IR_PULSE:
+	inputdevice_pulse_event (r->data[0]);
+	break;
+    }
+    applying = 0;
+}
+
+static int host_input (uae_u32 type, uae_u32 d0, uae_u32 d1, uae_u32 d2, uae_u32 d3)
+{
+    struct inprec_record *r;
+
+    if (applying || phase != IP_RUN)
+	return 0;
+    if (inprec_mode == INPREC_PLAYBACK)
+	return 1;
+    if (pending_count == PENDING_SIZE) {
+	write_log ("INPREC: event queue overflow, event dropped\n");
+	return 1;
+    }
+    r = &pending[pending_count++];
+    r->type = type;
+    r->data[0] = d0;
+    r->data[1] = d1;
+    r->data[2] = d2;
+    r->data[3] = d3;
+    return 1;
+}
+
+int inprec_event (int nr, int state, int max, int autofire)
+{
+    return host_input (IR_EVENT, nr, state, max, autofire);
+}
+
+int inprec_keyboard (int code, int state)
+{
+    return host_input (IR_KEYBOARD, code, state, 0, 0);
+}
+
+int inprec_key (int kc)
+{
+    return host_input (IR_KEY, kc, 0, 0, 0);
+}
+
+int inprec_pulse (int nr)
+{
+    return host_input (IR_PULSE, nr, 0, 0, 0);
+}
+
+static void report (void)
+{
+    frame_time_t t = uae_gethrtime () - start_time;
+    double ms = t * 1000.0 / uae_gethrtimebase ();
+
+    write_log ("INPREC: %s '%s', %u frames in %d ms (%.1f fps)\n",
+	       inprec_mode == INPREC_RECORD ? "recorded" : "played back", inprec_fname,
+	       frame, (int)ms, ms > 0 ? frame * 1000.0 / ms : 0.0);
+    if (inprec_mode == INPREC_PLAYBACK) {
+	if (mismatches)
+	    write_log ("INPREC: state differs in %u frames, first at frame %u\n",
+		       mismatches, first_mismatch);
+	else
+	    write_log ("INPREC: state matched in all frames\n");
+    }
+}
+
+static void start (void)
+{
+    inputdevice_inprec_prepare ();
+    keybuf_inprec_prepare ();
+    CIA_inprec_prepare ();
+    srand (INPREC_SEED);
+    frame = line = 0;
+    pending_count = 0;
+    mismatches = 0;
+    if (inprec_mode == INPREC_PLAYBACK)
+	read_next ();
+    phase = IP_RUN;
+    write_log ("INPREC: %s '%s'\n",
+	       inprec_mode == INPREC_RECORD ? "recording to" : "playing back", inprec_fname);
+    start_time = uae_gethrtime ();
+}
+
+static void check_hash (uae_u32 hash)
+{
+    /* Events stamped after the last line of the frame would mean that
+     * the frames are not the same length any more. */
+    while (next_valid && next.type != IR_HASH && next.frame <= frame) {
+	apply (&next);
+	read_next ();
+    }
+    if (!next_valid) {
+	report ();
+	fclose (inprec_file);
+	inprec_file = 0;
+	phase = IP_DONE;
+	uae_quit ();
+	return;
+    }
+    if (next.type == IR_HASH && next.frame == frame) {
+	if (next.data[0] != hash && !mismatches++) {
+	    first_mismatch = frame;
+	    write_log ("INPREC: state differs at frame %u\n", frame);
+	}
+	read_next ();
+    }
+}
+
+void inprec_vsync (void)
+{
+    struct inprec_record r;
+
+    switch (phase) {
+     case IP_SAVE:
+	if (savestate_state)
+	    break;
+	inprec_file = fopen (inprec_fname, "wb");
+	if (!inprec_file) {
+	    write_log ("INPREC: can't create '%s'\n", inprec_fname);
+	    inprec_mode = 0;
+	    phase = IP_IDLE;
+	    break;
+	}
+	fwrite (INPREC_MAGIC, 8, 1, inprec_file);
+	memset (&r, 0, sizeof r);
+	r.type = INPREC_VERSION;
+	write_record (&r);
+	/* Both runs start from the restored state, not from this one */
+	savestate_initsave (inprec_statefname, 0);
+	save_state (inprec_statefname, "input recording");
+	savestate_state = STATE_DORESTORE;
+	phase = IP_RESTORE;
+	break;
+     case IP_RESTORE:
+	if (!savestate_state)
+	    start ();
+	break;
+     case IP_RUN:
+	if (inprec_mode == INPREC_RECORD) {
+	    memset (&r, 0, sizeof r);
+	    r.type = IR_HASH;
+	    r.frame = frame;
+	    r.data[0] = state_hash ();
+	    write_record (&r);
+	} else {
+	    check_hash (state_hash ());
+	}
+	frame++;
+	line = 0;
+	break;
+    }
+}
+
+void inprec_hsync (void)
+{
+    int i;
+
+    if (phase != IP_RUN)
+	return;
+    line++;
+    if (inprec_mode == INPREC_RECORD) {
+	for (i = 0; i < pending_count; i++) {
+	    pending[i].frame = frame;
+	    pending[i].line = line;
+	    write_record (&pending[i]);
+	    apply (&pending[i]);
+	}
+	pending_count = 0;
+    } else {
+	while (next_valid && next.type != IR_HASH && next.frame == frame && next.line == line) {
+	    apply (&next);
+	    read_next ();
+	}
+    }
+}
+
+void inprec_prepare (const char *filename, int mode)
+{
+    struct inprec_record r;
+    char magic[8];
+
+    inprec_close ();
+    /* Room for the name of the state file too */
+    if (strlen (filename) + 4 >= sizeof inprec_statefname) {
+	write_log ("INPREC: file name '%s' is too long\n", filename);
+	return;
+    }
+    strncpy (inprec_fname, filename, sizeof inprec_fname - 1);
+    snprintf (inprec_statefname, sizeof inprec_statefname, "%s.uss", filename);
+    if (mode == INPREC_PLAYBACK) {
+	inprec_file = fopen (inprec_fname, "rb");
+	if (!inprec_file || fread (magic, 8, 1, inprec_file) != 1
+	    || memcmp (magic, INPREC_MAGIC, 8) || !read_record (&r) || r.type != INPREC_VERSION) {
+	    write_log ("INPREC: '%s' is not an input recording\n", inprec_fname);
+	    if (inprec_file)
+		fclose (inprec_file);
+	    inprec_file = 0;
+	    return;
+	}
+	strcpy (savestate_fname, inprec_statefname);
+	savestate_state = STATE_DORESTORE;
+	phase = IP_RESTORE;
+    } else {
+	phase = IP_SAVE;
+    }
+    inprec_mode = mode;
+}
+
+void inprec_close (void)
+{
+    struct inprec_record r;
+
+    if (phase == IP_RUN)
+	report ();
+    if (inprec_file) {
+	if (inprec_mode == INPREC_RECORD) {
+	    memset (&r, 0, sizeof r);
+	    r.type = IR_END;
+	    r.frame = frame;
+	    write_record (&r);
+	}
+	fclose (inprec_file);
+	inprec_file = 0;
+    }
+    inprec_mode = 0;
+    phase = IP_IDLE;
+}
+
+#endif /* SAVESTATE */
@@ -41,6 +41,7 @@
 #include "disk.h"
 #include "audio.h"
 #include "savestate.h"
+#include "inprec.h"
 
 #include <ctype.h>
 
@@ -98,6 +99,8 @@ const struct inputevent events[] = {
 
 static struct inputdevice_functions idev[3];
 
+static int do_input_event (int nr, int state, int max, int autofire);
+
 static int sublevdir[2][MAX_INPUT_SUB_EVENT];
 
 struct uae_input_device2 {
@@ -129,7 +132,7 @@ int inputdevice_uaelib (const char *s, const char *parm)
 
     for (i = 1; events[i].name; i++) {
 	if (!strcmp (s, events[i].confname)) {
-	    handle_input_event (i, atol (parm), 1, 0);
+	    do_input_event (i, atol (parm), 1, 0);
 	    return 1;
 	}
     }
@@ -599,9 +602,9 @@ static void mouseupdate (int pct)
 
 	v = mouse_delta[i][2] * pct / 100;
 	if (v > 0)
-	    record_key (0x7a << 1);
+	    record_key_direct (0x7a << 1);
 	else if (v < 0)
-	    record_key (0x7b << 1);
+	    record_key_direct (0x7b << 1);
 	if (!mouse_deltanoreset[i][2])
 	    mouse_delta[i][2] = 0;
 
@@ -846,6 +849,7 @@ void inputdevice_hsync (void)
 {
     int joy;
 
+    inprec_hsync ();
     for (joy = 0; joy < 2; joy++) {
 	if (potgo_hsync >= 0) {
 	    int active;
@@ -971,7 +975,7 @@ static void queue_input_event (int event, int state, int max, int framecnt, int
 	iq->framecnt = -1;
 	iq->event = 0;
 	if (iq->state == 0)
-	    handle_input_event (event, 0, 1, 0);
+	    do_input_event (event, 0, 1, 0);
     } else if (i < 0) {
 	for (i = 0; i < INPUT_QUEUE_SIZE; i++) {
 	    iq = &input_queue[i];
@@ -1011,7 +1015,7 @@ void inputdevice_add_inputcode (int code, int state)
     inputcode_pending_state = state;
 }
 
-void inputdevice_do_keyboard (int code, int state)
+static void do_keyboard (int code, int state)
 {
     if (code < 0x80) {
 	uae_u8 key = code | (state ? 0x00 : 0x80);
@@ -1021,12 +1025,20 @@ void inputdevice_do_keyboard (int code, int state)
 	    memset (keybuf, 0, sizeof (keybuf));
 	    uae_reset (r);
 	}
-	record_key ((uae_u8)((key << 1) | (key >> 7)));
+	record_key_direct ((uae_u8)((key << 1) | (key >> 7)));
 	return;
     }
     inputdevice_add_inputcode (code, state);
 }
 
+void inputdevice_do_keyboard (int code, int state)
+{
+    /* AKS input codes act on the emulator, not the emulation */
+    if (code < 0x80 && inprec_keyboard (code, state))
+	return;
+    do_keyboard (code, state);
+}
+
 void inputdevice_handle_inputcode (void)
 {
     int code = inputcode_pending;
@@ -1197,7 +1209,7 @@ void inputdevice_handle_inputcode (void)
     }
 }
 
-int handle_input_event (int nr, int state, int max, int autofire)
+static int do_input_event (int nr, int state, int max, int autofire)
 {
     const struct inputevent *ie;
     int joy;
@@ -1310,12 +1322,33 @@ int handle_input_event (int nr, int state, int max, int autofire)
 	    }
 	break;
 	case 0: /* ->KEY */
-	    inputdevice_do_keyboard (ie->data, state);
+	    do_keyboard (ie->data, state);
 	break;
     }
     return 1;
 }
 
+/* A press now and its release next frame, as from a mouse wheel; from
+ * the host like handle_input_event(). */
+void inputdevice_pulse_event (int nr)
+{
+    if (nr <= 0 || inprec_pulse (nr))
+	return;
+    do_input_event (nr, 1, 1, 0);
+    queue_input_event (nr, 0, 1, 1, 0); /* send release event next frame */
+}
+
+/* Input from the host; events from the emulation itself (autofire,
+ * uaelib) go to do_input_event() directly and are never recorded. */
+int handle_input_event (int nr, int state, int max, int autofire)
+{
+    if (nr <= 0)
+	return 0;
+    if (inprec_event (nr, state, max, autofire))
+	return 1;
+    return do_input_event (nr, state, max, autofire);
+}
+
 void inputdevice_vsync (void)
 {
     struct input_queue_struct *iq;
@@ -1327,7 +1360,7 @@ void inputdevice_vsync (void)
 	    iq->framecnt--;
 	    if (iq->framecnt == 0) {
 		if (iq->state) iq->state = 0; else iq->state = iq->storedstate;
-		handle_input_event (iq->event, iq->state, iq->max, 0);
+		do_input_event (iq->event, iq->state, iq->max, 0);
 		iq->framecnt = iq->nextframecnt;
 	    }
 	}
@@ -1340,6 +1373,7 @@ void inputdevice_vsync (void)
     inputdevice_handle_inputcode ();
     if (ievent_alive > 0)
 	ievent_alive--;
+    inprec_vsync ();
 #ifdef ARCADIA
     if (arcadia_rom)
 	arcadia_vsync ();
@@ -1351,6 +1385,36 @@ void inputdevice_reset (void)
     ievent_alive = 0;
 }
 
+/* Forget the host side input state, so that recording and playback both
+ * start from the same one. */
+void inputdevice_inprec_prepare (void)
+{
+    int i;
+
+    memset (mouse_x, 0, sizeof mouse_x);
+    memset (mouse_y, 0, sizeof mouse_y);
+    memset (mouse_delta, 0, sizeof mouse_delta);
+    memset (mouse_frame_x, 0, sizeof mouse_frame_x);
+    memset (mouse_frame_y, 0, sizeof mouse_frame_y);
+    memset (joybutton, 0, sizeof joybutton);
+    memset (joydir, 0, sizeof joydir);
+    memset (joydirpot, 0, sizeof joydirpot);
+    memset (oleft, 0, sizeof oleft);
+    memset (oright, 0, sizeof oright);
+    memset (otop, 0, sizeof otop);
+    memset (obot, 0, sizeof obot);
+    memset (potdats, 0, sizeof potdats);
+    for (i = 0; i < INPUT_QUEUE_SIZE; i++) {
+	input_queue[i].framecnt = input_queue[i].nextframecnt = -1;
+	input_queue[i].event = 0;
+    }
+    memset (keybuf, 0, sizeof keybuf);
+    inputcode_pending = 0;
+    potgo_hsync = 0;
+    input_read = 0;
+    input_vpos = 0;
+}
+
 static void setbuttonstateall (struct uae_input_device *id, struct uae_input_device2 *id2, int button, int state)
 {
     int event, autofire, i;
@@ -1368,8 +1432,7 @@ static void setbuttonstateall (struct uae_input_device *id, struct uae_input_dev
 	    continue;
 	autofire = (id->flags[ID_BUTTON_OFFSET + button][sublevdir[state <= 0 ? 1 : 0][i]] & ID_FLAG_AUTOFIRE) ? 1 : 0;
 	if (state < 0) {
-	    handle_input_event (event, 1, 1, 0);
-	    queue_input_event (event, 0, 1, 1, 0); /* send release event next frame */
+	    inputdevice_pulse_event (event);
 	} else {
 	    if ((omask ^ nmask) & mask)
 		handle_input_event (event, state, 1, autofire);
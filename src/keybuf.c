@@ -22,6 +22,7 @@
 #include "inputdevice.h"
 #include "custom.h"
 #include "savestate.h"
+#include "inprec.h"
 
 static int fakestate[2][7] = { {0},{0} };
 
@@ -69,7 +70,8 @@ static void do_fake (int nr)
     setjoybuttonstate (nr, 2, fake[6]);
 }
 
-void record_key (int kc)
+/* Keys that the emulation generates itself, never recorded */
+void record_key_direct (int kc)
 {
     int fs = 0;
     int kpb_next = kpb_first + 1;
@@ -184,6 +186,19 @@ void record_key (int kc)
     kpb_first = kpb_next;
 }
 
+void record_key (int kc)
+{
+    if (inprec_key (kc))
+	return;
+    record_key_direct (kc);
+}
+
+void keybuf_inprec_prepare (void)
+{
+    kpb_first = kpb_last = 0;
+    memset (fakestate, 0, sizeof fakestate);
+}
+
 void joystick_setting_changed (void)
 {
     fs_np = fs_ck = fs_se = 0;
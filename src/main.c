@@ -40,6 +40,7 @@
 #include "scsidev.h"
 #include "akiko.h"
 #include "savestate.h"
+#include "inprec.h"
 #include "hrtimer.h"
 #include "sleep.h"
 #include "version.h"
@@ -773,6 +774,7 @@ static void do_exit_machine (void)
     hardfile_cleanup ();
 #endif
 #ifdef SAVESTATE
+    inprec_close ();
     savestate_free ();
 #endif
     memory_cleanup ();
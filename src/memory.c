@@ -329,6 +329,7 @@ void REGPARAM2 chipmem_lput_ce2 (uaecptr addr, uae_u32 l)
 #endif
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     m = (uae_u32 *)(chipmemory + addr);
     ce2_timeout ();
     do_put_mem_long (m, l);
@@ -343,6 +344,7 @@ void REGPARAM2 chipmem_wput_ce2 (uaecptr addr, uae_u32 w)
 #endif
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     m = (uae_u16 *)(chipmemory + addr);
     ce2_timeout ();
     do_put_mem_word (m, w);
@@ -355,6 +357,7 @@ void REGPARAM2 chipmem_bput_ce2 (uaecptr addr, uae_u32 b)
 #endif
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     ce2_timeout ();
     chipmemory[addr] = b;
 }
@@ -394,6 +397,7 @@ void REGPARAM2 chipmem_lput (uaecptr addr, uae_u32 l)
 
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     m = (uae_u32 *)(chipmemory + addr);
     do_put_mem_long (m, l);
 }
@@ -405,6 +409,7 @@ void REGPARAM2 chipmem_wput (uaecptr addr, uae_u32 w)
 
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     m = (uae_u16 *)(chipmemory + addr);
     do_put_mem_word (m, w);
 }
@@ -413,6 +418,7 @@ void REGPARAM2 chipmem_bput (uaecptr addr, uae_u32 b)
 {
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    copper_cache_check (addr);
     chipmemory[addr] = b;
 }
 
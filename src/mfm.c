@@ -0,0 +1,244 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * MFM encoding and decoding of floppy data
+  *
+  * Everything works on four MFM words at a time, packed into a 64-bit
+  * integer with the first one in the top bits, so that the clock bits and
+  * the odd/even split are a handful of shifts and masks per 64 bits of
+  * track rather than a loop over bits or words.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "mfm.h"
+
+#define MFMMASK64 0x5555555555555555ULL
+
+#ifdef WORDS_BIGENDIAN
+
+/* Word 0 in bits 48-63, so the 64 bits are in track order. */
+
+STATIC_INLINE uae_u64 load4 (const uae_u16 *p)
+{
+    uae_u64 v;
+    memcpy (&v, p, sizeof v);
+    return v;
+}
+
+STATIC_INLINE void store4 (uae_u16 *p, uae_u64 v)
+{
+    memcpy (p, &v, sizeof v);
+}
+
+/* Four words starting SHIFT bits into P. */
+STATIC_INLINE uae_u64 load4_shifted (const uae_u16 *p, unsigned int shift)
+{
+    uae_u64 v = load4 (p);
+
+    if (shift)
+	v = (v << shift) | (p[4] >> (16 - shift));
+    return v;
+}
+
+/* Eight bytes of big-endian longwords as four words. */
+#define load4_bytes(p) load4 ((const uae_u16 *)(p))
+#define store4_bytes(p, v) store4 ((uae_u16 *)(p), (v))
+
+/* The lowest data bit of the last word. */
+#define last_bit(v) ((int)(v) & 1)
+
+/* A clock bit is set when the data bits on both sides of it are clear;
+ * ABOVE is the data bit that precedes V on the track. */
+STATIC_INLINE uae_u64 add_clocks (uae_u64 v, int above)
+{
+    uae_u64 nlv = MFMMASK64 & ~v;
+
+    return v | ((nlv << 1) & ((nlv >> 1) | ((uae_u64)!above << 63)));
+}
+
+/* XOR of the two longwords in V. */
+#define fold_longs(v) ((uae_u32)((v) ^ ((v) >> 32)))
+
+#else
+
+/* Word 0 in bits 0-15: each word is in track order, but the words are
+ * reversed, so the bits that cross from one word to the next have to be
+ * moved between the 16-bit lanes separately. */
+
+#define LANE_LSB 0x0001000100010001ULL
+#define LANE_MSB 0x8000800080008000ULL
+
+STATIC_INLINE uae_u64 load4 (const uae_u16 *p)
+{
+    uae_u64 v;
+    memcpy (&v, p, sizeof v);
+    return v;
+}
+
+STATIC_INLINE void store4 (uae_u16 *p, uae_u64 v)
+{
+    memcpy (p, &v, sizeof v);
+}
+
+STATIC_INLINE uae_u64 load4_shifted (const uae_u16 *p, unsigned int shift)
+{
+    uae_u64 v = load4 (p);
+
+    if (shift) {
+	uae_u64 low = LANE_LSB * ((1 << shift) - 1);
+	v = ((v << shift) & ~low) | ((v >> (32 - shift)) & low)
+	    | ((uae_u64)(p[4] >> (16 - shift)) << 48);
+    }
+    return v;
+}
+
+STATIC_INLINE uae_u64 swap_lane_bytes (uae_u64 v)
+{
+    return ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+}
+
+STATIC_INLINE uae_u64 load4_bytes (const uae_u8 *p)
+{
+    uae_u64 v;
+    memcpy (&v, p, sizeof v);
+    return swap_lane_bytes (v);
+}
+
+STATIC_INLINE void store4_bytes (uae_u8 *p, uae_u64 v)
+{
+    v = swap_lane_bytes (v);
+    memcpy (p, &v, sizeof v);
+}
+
+#define last_bit(v) ((int)((v) >> 48) & 1)
+
+STATIC_INLINE uae_u64 add_clocks (uae_u64 v, int above)
+{
+    uae_u64 nlv = MFMMASK64 & ~v;
+    uae_u64 right = ((nlv >> 1) & ~LANE_MSB) | ((nlv << 31) & LANE_MSB) | ((uae_u64)!above << 15);
+
+    return v | ((nlv << 1) & right);
+}
+
+STATIC_INLINE uae_u32 fold_longs (uae_u64 v)
+{
+    uae_u32 x = (uae_u32)(v ^ (v >> 32));
+    return (x << 16) | (x >> 16);
+}
+
+#endif
+
+STATIC_INLINE uae_u32 load2_shifted (const uae_u16 *p, unsigned int shift)
+{
+    uae_u32 v = ((uae_u32)p[0] << 16) | p[1];
+
+    if (shift)
+	v = (v << shift) | (p[2] >> (16 - shift));
+    return v;
+}
+
+/* Spread the 32 bits of V to the data bits of four MFM words; the bytes
+ * of V end up in the lanes in memory order. */
+STATIC_INLINE uae_u64 spread32 (uae_u32 v)
+{
+    uae_u64 x = v;
+
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & MFMMASK64;
+    return x;
+}
+
+/* Megalomania does not like zero MFM words, so the clock bits matter. */
+void mfm_clock (uae_u16 *mfm, unsigned int words, uae_u16 prev)
+{
+    int above = prev & 1;
+    unsigned int i = 0;
+
+    for (; i + 4 <= words; i += 4) {
+	uae_u64 v = load4 (mfm + i);
+	store4 (mfm + i, add_clocks (v, above));
+	above = last_bit (v);
+    }
+    for (; i < words; i++) {
+	uae_u32 v = mfm[i];
+	uae_u32 nlv = 0x55555555 & ~((above << 16) | v);
+	mfm[i] = (uae_u16)(v | ((nlv << 1) & (nlv >> 1)));
+	above = v & 1;
+    }
+}
+
+void mfm_encode_bytes (const uae_u8 *src, uae_u16 *mfm, unsigned int len, uae_u16 prev)
+{
+    int above = prev & 1;
+    unsigned int i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+	uae_u32 b;
+	uae_u64 v;
+	memcpy (&b, src + i, sizeof b);
+	v = spread32 (b);
+	store4 (mfm + i, add_clocks (v, above));
+	above = last_bit (v);
+    }
+    for (; i < len; i++)
+	mfm[i] = (uae_u16)spread32 (src[i]);
+    if (i > (len & ~3u))
+	mfm_clock (mfm + (len & ~3u), len & 3, above);
+}
+
+uae_u32 mfm_encode_oddeven (const uae_u8 *src, uae_u16 *odd, uae_u16 *even, unsigned int longs)
+{
+    uae_u64 check = 0;
+    uae_u32 tail = 0;
+    unsigned int i = 0;
+
+    for (; i + 2 <= longs; i += 2) {
+	uae_u64 v = load4_bytes (src + i * 4);
+	uae_u64 o = (v >> 1) & MFMMASK64, e = v & MFMMASK64;
+	store4 (odd + i * 2, o);
+	store4 (even + i * 2, e);
+	check ^= o ^ e;
+    }
+    if (i < longs) {
+	const uae_u8 *p = src + i * 4;
+	uae_u32 v = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	uae_u32 o = (v >> 1) & 0x55555555, e = v & 0x55555555;
+	odd[i * 2] = o >> 16;
+	odd[i * 2 + 1] = o;
+	even[i * 2] = e >> 16;
+	even[i * 2 + 1] = e;
+	tail = o ^ e;
+    }
+    return fold_longs (check) ^ tail;
+}
+
+uae_u32 mfm_decode_oddeven (const uae_u16 *odd, const uae_u16 *even, unsigned int shift,
+			    uae_u8 *dst, unsigned int longs)
+{
+    uae_u64 check = 0;
+    uae_u32 tail = 0;
+    unsigned int i = 0;
+
+    for (; i + 2 <= longs; i += 2) {
+	uae_u64 o = load4_shifted (odd + i * 2, shift) & MFMMASK64;
+	uae_u64 e = load4_shifted (even + i * 2, shift) & MFMMASK64;
+	store4_bytes (dst + i * 4, (o << 1) | e);
+	check ^= o ^ e;
+    }
+    if (i < longs) {
+	uae_u32 o = load2_shifted (odd + i * 2, shift) & 0x55555555;
+	uae_u32 e = load2_shifted (even + i * 2, shift) & 0x55555555;
+	uae_u32 v = (o << 1) | e;
+	dst[i * 4] = v >> 24;
+	dst[i * 4 + 1] = v >> 16;
+	dst[i * 4 + 2] = v >> 8;
+	dst[i * 4 + 3] = v;
+	tail = o ^ e;
+    }
+    return fold_longs (check) ^ tail;
+}
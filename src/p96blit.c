@@ -0,0 +1,314 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Picasso96 board operations on host memory
+  *
+  * The rendering that picasso96.c does in the emulated board's frame buffer
+  * for FillRect, InvertRect, BlitRect, BlitPlanar2Chunky, BlitTemplate and
+  * BlitPattern. Everything works on 64-bit words where it can, which the
+  * compiler is free to widen further; fills are built from the first row
+  * by doubling memcpy()s.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "memory.h"
+#include "picasso96.h"
+#include "p96blit.h"
+
+STATIC_INLINE uae_u64 load64 (const uae_u8 *p)
+{
+    uae_u64 v;
+    memcpy (&v, p, 8);
+    return v;
+}
+
+STATIC_INLINE void store64 (uae_u8 *p, uae_u64 v)
+{
+    memcpy (p, &v, 8);
+}
+
+void p96_fill_rect (uae_u8 *dst, int bytes_per_row, int width, int height,
+		    uae_u32 pen, int Bpp)
+{
+    int len = width * Bpp;
+    int n, y;
+
+    if (width <= 0 || height <= 0)
+	return;
+
+    if (Bpp == 1) {
+	for (y = 0; y < height; y++, dst += bytes_per_row)
+	    memset (dst, pen, width);
+	return;
+    }
+
+    /* Store the first pixel in the byte order the board uses... */
+    switch (Bpp) {
+    case 2:
+	do_put_mem_word ((uae_u16 *)dst, (uae_u16)pen);
+	break;
+    case 3: {
+	uae_u16 gb = (pen & 0x00FFFF00) >> 8;
+	do_put_mem_byte (dst, (uae_u8)pen);
+	memcpy (dst + 1, &gb, 2);
+	break;
+    }
+    case 4:
+	do_put_mem_long ((uae_u32 *)dst, pen);
+	break;
+    default:
+	return;
+    }
+
+    /* ...replicate it along the first row... */
+    for (n = Bpp; n < len; n *= 2)
+	memcpy (dst + n, dst, n < len - n ? n : len - n);
+
+    /* ...and copy that row to all others. */
+    for (y = 1; y < height; y++)
+	memcpy (dst + y * bytes_per_row, dst, len);
+}
+
+void p96_invert_rect (uae_u8 *dst, int bytes_per_row, int width, int height,
+		      uae_u8 mask)
+{
+    uae_u64 x = 0x0101010101010101ULL * mask;
+    int y;
+
+    for (y = 0; y < height; y++, dst += bytes_per_row) {
+	uae_u8 *p = dst;
+	int i = 0;
+
+	for (; i + 8 <= width; i += 8)
+	    store64 (p + i, load64 (p + i) ^ x);
+	for (; i < width; i++)
+	    p[i] ^= mask;
+    }
+}
+
+void p96_blit_rect_minterm (const uae_u8 *src, int src_bytes_per_row,
+			    uae_u8 *dst, int dst_bytes_per_row,
+			    int width, int height, int minterm)
+{
+    /* Each minterm bit selects one of the four src/dst combinations. */
+    uae_u64 m3 = (minterm & 8) ? ~(uae_u64)0 : 0;
+    uae_u64 m2 = (minterm & 4) ? ~(uae_u64)0 : 0;
+    uae_u64 m1 = (minterm & 2) ? ~(uae_u64)0 : 0;
+    uae_u64 m0 = (minterm & 1) ? ~(uae_u64)0 : 0;
+    int y;
+
+#define MINTERM(s, d) \
+    (((s) & (d) & m3) | ((s) & ~(d) & m2) | (~(s) & (d) & m1) | (~(s) & ~(d) & m0))
+
+    for (y = 0; y < height; y++, src += src_bytes_per_row, dst += dst_bytes_per_row) {
+	int i = 0;
+
+	for (; i + 8 <= width; i += 8) {
+	    uae_u64 s = load64 (src + i), d = load64 (dst + i);
+	    store64 (dst + i, MINTERM (s, d));
+	}
+	for (; i < width; i++) {
+	    uae_u64 s = src[i], d = dst[i];
+	    dst[i] = (uae_u8) MINTERM (s, d);
+	}
+    }
+#undef MINTERM
+}
+
+void p96_blit_rect_masked (const uae_u8 *src, int src_bytes_per_row,
+			   uae_u8 *dst, int dst_bytes_per_row,
+			   int width, int height, uae_u8 mask)
+{
+    uae_u64 m = 0x0101010101010101ULL * mask;
+    int y;
+
+    for (y = 0; y < height; y++, src += src_bytes_per_row, dst += dst_bytes_per_row) {
+	int i = 0;
+
+	for (; i + 8 <= width; i += 8)
+	    store64 (dst + i, (load64 (dst + i) & ~m) | (load64 (src + i) & m));
+	for (; i < width; i++)
+	    dst[i] = (dst[i] & ~mask) | (src[i] & mask);
+    }
+}
+
+/* Byte i of p2c_table[v] is bit 7 - i of v, so a table entry shifted left
+ * by k gives plane k's contribution to eight chunky pixels in memory
+ * order, whatever the host's byte order. */
+static uae_u64 p2c_table[256];
+static int p2c_table_done;
+
+static void init_p2c_table (void)
+{
+    int v, i;
+
+    for (v = 0; v < 256; v++) {
+	uae_u8 b[8];
+	for (i = 0; i < 8; i++)
+	    b[i] = (v >> (7 - i)) & 1;
+	memcpy (&p2c_table[v], b, 8);
+    }
+    p2c_table_done = 1;
+}
+
+void p96_planar_to_chunky (uae_u8 *image, int image_bytes_per_row,
+			   uae_u8 *const *planes, int depth, uae_u8 ones,
+			   int planes_bytes_per_row, int bitoffset,
+			   int width, int height)
+{
+    const uae_u8 *active[8];
+    int shift[8];
+    int nactive = 0;
+    uae_u64 fixed = 0;
+    int k, y;
+
+    if (!p2c_table_done)
+	init_p2c_table ();
+
+    /* Constant planes contribute the same bits to every pixel. */
+    for (k = 0; k < depth; k++) {
+	if (planes[k]) {
+	    active[nactive] = planes[k];
+	    shift[nactive++] = k;
+	} else if (ones & (1 << k))
+	    fixed |= 0x0101010101010101ULL << k;
+    }
+
+    for (y = 0; y < height; y++, image += image_bytes_per_row) {
+	int cols;
+
+	for (cols = 0; cols < width; cols += 8) {
+	    uae_u64 pix = fixed;
+	    int i;
+
+	    for (i = 0; i < nactive; i++) {
+		const uae_u8 *p = active[i] + (cols >> 3);
+		uae_u8 data = (uae_u8)(((p[0] << 8) | p[1]) >> (8 - bitoffset));
+		pix |= p2c_table[data] << shift[i];
+	    }
+	    if (width - cols >= 8)
+		store64 (image + cols, pix);
+	    else
+		memcpy (image + cols, &pix, width - cols);
+	}
+	for (k = 0; k < nactive; k++)
+	    active[k] += planes_bytes_per_row;
+    }
+}
+
+/* One pixel of BPP > 1 bytes, stored as PixelWrite () in picasso96.c does. */
+STATIC_INLINE void put_pixel (uae_u8 *d, int i, uae_u32 pen, int Bpp)
+{
+    switch (Bpp) {
+    case 2:
+	do_put_mem_word ((uae_u16 *)d + i, (uae_u16)pen);
+	break;
+    case 3: {
+	uae_u16 gb = (pen & 0x00FFFF00) >> 8;
+	do_put_mem_byte (d + i * 3, (uae_u8)pen);
+	memcpy (d + i * 3 + 1, &gb, 2);
+	break;
+    }
+    case 4:
+	do_put_mem_long ((uae_u32 *)d + i, pen);
+	break;
+    }
+}
+
+STATIC_INLINE void xor_pixel (uae_u8 *d, int i, uae_u32 pen, int Bpp)
+{
+    switch (Bpp) {
+    case 2: {
+	uae_u16 *a = (uae_u16 *)d + i;
+	do_put_mem_word (a, (uae_u16)(do_get_mem_word (a) ^ pen));
+	break;
+    }
+    case 3: {
+	uae_u32 *a = (uae_u32 *)(d + i * 3);
+	do_put_mem_long (a, do_get_mem_long (a) ^ (pen & 0x00FFFFFF));
+	break;
+    }
+    case 4: {
+	uae_u32 *a = (uae_u32 *)d + i;
+	do_put_mem_long (a, do_get_mem_long (a) ^ pen);
+	break;
+    }
+    }
+}
+
+void p96_blit_template (uae_u8 *dst, int dst_bytes_per_row,
+			const uae_u8 *bits, int bits_bytes_per_row, int bitoffset,
+			int width, int height, int Bpp, int drawmode, int invert,
+			uae_u32 fgpen, uae_u32 bgpen, uae_u8 mask)
+{
+    uae_u8 flip = invert && drawmode != COMP ? 0xFF : 0;
+    uae_u64 fg = 0x0101010101010101ULL * (uae_u8)fgpen;
+    uae_u64 bg = 0x0101010101010101ULL * (uae_u8)bgpen;
+    uae_u64 m = 0x0101010101010101ULL * mask;
+    int y;
+
+    if (!p2c_table_done)
+	init_p2c_table ();
+
+    for (y = 0; y < height; y++, dst += dst_bytes_per_row, bits += bits_bytes_per_row) {
+	const uae_u8 *p = bits;
+	uae_u8 *d = dst;
+	int cols;
+
+	for (cols = 0; cols < width; cols += 8, p++, d += Bpp * 8) {
+	    int n = width - cols < 8 ? width - cols : 8;
+	    uae_u8 data = (uae_u8)((((p[0] << 8) | p[1]) >> (8 - bitoffset)) ^ flip);
+	    int i;
+
+	    data &= 0xFF << (8 - n);
+	    if (!data && drawmode != JAM2)
+		continue;
+
+	    if (Bpp == 1) {
+		/* 0xFF in each byte whose pixel is set */
+		uae_u64 set = p2c_table[data] * 0xFF, old = 0, v;
+
+		if (n == 8)
+		    old = load64 (d);
+		else
+		    memcpy (&old, d, n);
+		switch (drawmode) {
+		case JAM1:
+		    v = (old & ~(set & m)) | (fg & set & m);
+		    break;
+		case JAM2:
+		    v = (old & ~m) | (((fg & set) | (bg & ~set)) & m);
+		    break;
+		default:
+		    v = old ^ (fg & set);
+		    break;
+		}
+		if (n == 8)
+		    store64 (d, v);
+		else
+		    memcpy (d, &v, n);
+		continue;
+	    }
+
+	    for (i = 0; i < n; i++, data <<= 1) {
+		int bit_set = data & 0x80;
+		switch (drawmode) {
+		case JAM1:
+		    if (bit_set)
+			put_pixel (d, i, fgpen, Bpp);
+		    break;
+		case JAM2:
+		    put_pixel (d, i, bit_set ? fgpen : bgpen, Bpp);
+		    break;
+		default:
+		    if (bit_set)
+			xor_pixel (d, i, fgpen, Bpp);
+		    break;
+		}
+	    }
+	}
+    }
+}
@@ -43,6 +43,7 @@
 #include "newcpu.h"
 #include "xwin.h"
 #include "picasso96.h"
+#include "p96blit.h"
 #include "uae_endian.h"
 #include "gcc_warnings.h"
 
@@ -105,8 +106,6 @@ static int set_panning_called = 0;
    SetPanning call.  */
 //static uaecptr oldscr;
 
-static uae_u32 p2ctab[256][2];
-
 /*
  * Picasso96 seems to have a bug which screws the palette emulation in
  * ARGB32 modes. We work around this by using a BGRA32 framebuffer instead,
@@ -661,22 +660,20 @@ static void do_invertrect (struct RenderInfo *ri, int Bpp, int x, int y,
 
 
 /*
- * Successive writes to the P96 framebuffer frequently occur in the same line. We
- * optimize for this case by not flushing each write immediately to the screen.
- * Instead, we delay until data is written to a different framebuffer line.
- * Then we flush the line containing the previous data written.
- */
-
-/* When successive writes to the framebuffer occur on the same line, we need to
- * remember these details about that line. Note: these are address in Amiga
- * memory space.
+ * Writes to the P96 framebuffer are not flushed to the screen one by one.
+ * Instead, gfx memory is divided into granules of GFXMEM_DIRTY_SIZE bytes
+ * and every write sets the bit of the granule(s) it touches in a bitmap.
+ * Once per vsync, and before any operation that works on the screen
+ * directly, flush_dirty_lines() turns the dirty granules under the visible
+ * screen into runs of lines for DX_Invalidate and, for targets with a
+ * separate screen buffer, into the dirty span of each line to copy.
  */
-static uaecptr currline_start;   /* start address of the line in the framebuffer */
-static uaecptr currline_end;     /* end address of the line in the framebuffer plus one */
-static uaecptr currline_min;     /* address of the left-most byte modified */
-static uaecptr currline_max;     /* address of the right-most byte modfied plus one */
-static int     currline_y;       /* row number of this line */
+#define GFXMEM_DIRTY_SHIFT 6
+#define GFXMEM_DIRTY_SIZE  (1 << GFXMEM_DIRTY_SHIFT)
 
+/* One bit per granule of the largest supported gfx memory (32 MB). */
+static uae_u32 gfxmem_dirty[0x2000000 >> (GFXMEM_DIRTY_SHIFT + 5)];
+static int gfxmem_dirty_pending;
 
 /*
  * Write line from the framebuffer to the screen
@@ -723,47 +720,91 @@ STATIC_INLINE void write_currline (uae_u8 *srcp, int line_no, int first_byte, in
     }
 }
 
-static void flush_currline (void)
+/* Find the first or last dirty granule in [FIRST, LAST], or -1.  */
+static int find_dirty_granule (int first, int last, int backwards)
+{
+    int step = backwards ? -1 : 1;
+    int g = backwards ? last : first;
+
+    while (g >= first && g <= last) {
+	uae_u32 w = gfxmem_dirty[g >> 5];
+	if (w == 0) {
+	    /* Skip to the next word.  */
+	    g = backwards ? (g & ~31) - 1 : (g | 31) + 1;
+	    continue;
+	}
+	if (w & (1u << (g & 31)))
+	    return g;
+	g += step;
+    }
+    return -1;
+}
+
+static void clear_gfxmem_dirty (void)
+{
+    memset (gfxmem_dirty, 0, sizeof gfxmem_dirty);
+    gfxmem_dirty_pending = 0;
+}
+
+static void flush_dirty_lines (void)
 {
-    int line_no = currline_y - picasso96_state.YOffset;
+    uae_u8 fb_bpp = picasso96_state.BytesPerPixel;
+    uae_u32 screen = picasso96_state.Address - gfxmem_start
+		     + picasso96_state.YOffset * picasso96_state.BytesPerRow;
+    uae_u32 line_bytes = picasso96_state.Width * fb_bpp;
+    int first_dirty_line = -1;
+    int y;
 
-    /* We only need to flush this line to the screen if the line
-     * is acutally visible on screen */
-    if (line_no >= 0 && line_no < picasso96_state.Height) {
+    gfxmem_dirty_pending = 0;
+    if (picasso96_state.Height <= 0 || line_bytes == 0
+	|| screen + picasso96_state.Height * picasso96_state.BytesPerRow > allocated_gfxmem) {
+	clear_gfxmem_dirty ();
+	return;
+    }
 
-	/* Tell the graphics system that this line needs to be
-	 * redrawn */
-	DX_Invalidate (line_no, line_no);
+    for (y = 0; y < picasso96_state.Height; y++) {
+	uae_u32 start = screen + y * picasso96_state.BytesPerRow + picasso96_state.XOffset * fb_bpp;
+	int g0 = start >> GFXMEM_DIRTY_SHIFT;
+	int g1 = (start + line_bytes - 1) >> GFXMEM_DIRTY_SHIFT;
+	int first = find_dirty_granule (g0, g1, 0);
+
+	if (first < 0) {
+	    if (first_dirty_line >= 0)
+		DX_Invalidate (first_dirty_line, y - 1);
+	    first_dirty_line = -1;
+	    continue;
+	}
+	if (first_dirty_line < 0)
+	    first_dirty_line = y;
 
 	/* If our graphics system uses a separate buffer, then
-	* that must be updated too */
+	 * that must be updated too */
 	if (picasso_vidinfo.extra_mem) {
-	    uae_u8 fb_bpp  = picasso96_state.BytesPerPixel;
-	    int byte_count = (currline_max - currline_min);
-	    int first_byte = currline_min - currline_start
-			     - (picasso96_state.XOffset * fb_bpp);
-	    uae_u8 *srcp   = (currline_min - gfxmem_start) + gfxmemory;
-
-	    if (first_byte < 0) {
-		byte_count += first_byte;
-		srcp       += first_byte;
-		first_byte = 0;
-	    }
-	    if ((first_byte + byte_count) > (picasso96_state.Width * fb_bpp))
-		byte_count = picasso96_state.Width * fb_bpp - first_byte;
-
-	    if (byte_count > 0)
-		write_currline (srcp, line_no, first_byte, byte_count);
+	    uae_u32 lo = (uae_u32)first << GFXMEM_DIRTY_SHIFT;
+	    uae_u32 hi = ((uae_u32)find_dirty_granule (first, g1, 1) + 1) << GFXMEM_DIRTY_SHIFT;
+
+	    if (lo < start)
+		lo = start;
+	    if (hi > start + line_bytes)
+		hi = start + line_bytes;
+	    write_currline (gfxmemory + lo, y, lo - start, hi - lo);
 	}
     }
-    currline_start = 0xFFFFFFFF;
+    if (first_dirty_line >= 0)
+	DX_Invalidate (first_dirty_line, picasso96_state.Height - 1);
+
+    /* Granules may be shared by neighbouring lines, so only clear the
+     * bits once all lines have been looked at. */
+    memset (gfxmem_dirty + (screen >> (GFXMEM_DIRTY_SHIFT + 5)), 0,
+	    (((screen + picasso96_state.Height * picasso96_state.BytesPerRow - 1)
+	      >> (GFXMEM_DIRTY_SHIFT + 5)) - (screen >> (GFXMEM_DIRTY_SHIFT + 5)) + 1) * sizeof (uae_u32));
 }
 
 STATIC_INLINE void wgfx_flushline (void)
 {
-    if (currline_start == 0xFFFFFFFF || !picasso_on)
+    if (!gfxmem_dirty_pending || !picasso_on)
 	return;
-    flush_currline ();
+    flush_dirty_lines ();
 }
 
 STATIC_INLINE int renderinfo_is_current_screen (struct RenderInfo *ri)
@@ -862,155 +903,30 @@ STATIC_INLINE void do_blitrect_frame_buffer (struct RenderInfo *ri,
 	    } else if (dsty < srcy) {
 		unsigned long i;
 		for (i = 0; i < height; i++, src += ri->BytesPerRow, dst += dstri->BytesPerRow)
-		    memcpy (dst, src, total_width);
+		    memmove (dst, src, total_width);
 	    } else {
 		unsigned long i;
 		src += (height-1) * ri->BytesPerRow;
 		dst += (height-1) * dstri->BytesPerRow;
 		for (i = 0; i < height; i++, src -= ri->BytesPerRow, dst -= dstri->BytesPerRow)
-		    memcpy (dst, src, total_width);
+		    memmove (dst, src, total_width);
 	    }
 	    return;
-	} else {
-	    uae_u8  *src2 = src;
-	    uae_u8  *dst2 = dst;
-	    uae_u32 *src2_32 = (uae_u32*)src;
-	    uae_u32 *dst2_32 = (uae_u32*)dst;
-	    unsigned int y;
-
-	    for (y = 0; y < height; y++) {
-		uae_u32 *bound = (uae_u32 *)(src + total_width - 4);
-		    //copy now the longs
-		    for (src2_32 = (uae_u32*)src, dst2_32 = (uae_u32*)dst; src2_32 < bound; src2_32++, dst2_32++ ) {
-			switch ((uae_u8) opcode) {
-			    case BLIT_FALSE:
-				*dst2_32 = 0;
-				break;
-			    case BLIT_NOR:
-				*dst2_32 = ~(*src2_32 | *dst2_32);
-				break;
-			    case BLIT_ONLYDST:
-				*dst2_32 = *dst2_32 & ~(*src2_32);
-				break;
-			    case BLIT_NOTSRC:
-				*dst2_32 = ~(*src2_32);
-				break;
-			    case BLIT_ONLYSRC:
-				*dst2_32 = *src2_32 & ~(*dst2_32);
-				break;
-			    case BLIT_NOTDST:
-				*dst2_32 = ~(*dst2_32);
-				break;
-			    case BLIT_EOR:
-				*dst2_32 = *src2_32 ^ *dst2_32;
-				break;
-			    case BLIT_NAND:
-				*dst2_32 = ~(*src2_32 & *dst2_32);
-				break;
-			    case BLIT_AND:
-				*dst2_32 = *src2_32 & *dst2_32;
-				break;
-			    case BLIT_NEOR:
-				*dst2_32 = ~(*src2_32 ^ *dst2_32);
-				break;
-			    case BLIT_DST:
-				write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_DST!\n");
-				break;
-			    case BLIT_NOTONLYSRC:
-				*dst2_32 = ~(*src2_32) | *dst2_32;
-				break;
-			    case BLIT_SRC:
-				write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_SRC!\n");
-				break;
-			    case BLIT_NOTONLYDST:
-				*dst2_32 = ~(*dst2_32) | *src2_32;
-				break;
-			    case BLIT_OR:
-				*dst2_32 = *src2_32 | *dst2_32;
-				break;
-			    case BLIT_TRUE:
-				*dst2_32 = 0xFFFFFFFF;
-				break;
-			    case 30: {
-				/* code for swap source with dest in byte */
-				uae_u32 temp;
-				temp     = *src2_32;
-				*src2_32 = *dst2_32;
-				*dst2_32 = temp;
-				break;
-			    }
-			    case BLIT_LAST:
-				write_log ( "P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_LAST!\n");
-				break;
-			} /* switch opcode */
-		    } // for end
-		    //now copy the rest few bytes
-		    for (src2 = (uae_u8*)src2_32, dst2 = (uae_u8*)dst2_32; src2 < src + total_width; src2++, dst2++ ) {
-			switch ((uae_u8)opcode) {
-			    case BLIT_FALSE:
-				*dst2 = 0;
-				break;
-			    case BLIT_NOR:
-				*dst2 = ~(*src2 | *dst2);
-				break;
-			    case BLIT_ONLYDST:
-				*dst2 = *dst2 & ~(*src2);
-				break;
-			    case BLIT_NOTSRC:
-				*dst2 = ~(*src2);
-				break;
-			    case BLIT_ONLYSRC:
-				*dst2 = *src2 & ~(*dst2);
-				break;
-			    case BLIT_NOTDST:
-				*dst2 = ~(*dst2);
-				break;
-			    case BLIT_EOR:
-				*dst2 = *src2 ^ *dst2;
-				break;
-			    case BLIT_NAND:
-				*dst2 = ~(*src2 & *dst2);
-				break;
-			    case BLIT_AND:
-				*dst2 = *src2 & *dst2;
-				break;
-			    case BLIT_NEOR:
-				*dst2 = ~(*src2 ^ *dst2);
-				break;
-			    case BLIT_DST:
-				write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_DST!\n");
-				break;
-			    case BLIT_NOTONLYSRC:
-				*dst2 = ~(*src2) | *dst2;
-				break;
-			    case BLIT_SRC:
-				write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_SRC!\n");
-				break;
-			    case BLIT_NOTONLYDST:
-				*dst2 = ~(*dst2) | *src2;
-				break;
-			    case BLIT_OR:
-				*dst2 = *src2 | *dst2;
-				break;
-			    case BLIT_TRUE:
-				*dst2 = 0xFF;
-				break;
-			    case BLIT_LAST:
-				write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get BLIT_LAST!\n");
-				break;
-			    case 30: {
-				/* code for swap source with dest in long */
-				uae_u8 temp;
-				temp  = *src2;
-				*src2 = *dst2;
-				*dst2 = temp;
-				break;
-			    }
-			} /* switch opcode */
-		    } /* for width */
-		src += ri->BytesPerRow;
-		dst += dstri->BytesPerRow;
-	    } /* for height */
+	} else if (opcode == BLIT_DST || opcode == BLIT_LAST) {
+	    write_log ("P96: ERROR - do_blitrect_frame_buffer shouldn't get opcode %d!\n", opcode);
+	} else if (opcode < BLIT_LAST) {
+	    p96_blit_rect_minterm (src, ri->BytesPerRow, dst, dstri->BytesPerRow,
+				   total_width, height, opcode);
+	} else if (opcode == 30) {
+	    /* code for swap source with dest */
+	    unsigned long i, j;
+	    for (i = 0; i < height; i++, src += ri->BytesPerRow, dst += dstri->BytesPerRow) {
+		for (j = 0; j < total_width; j++) {
+		    uae_u8 temp = src[j];
+		    src[j] = dst[j];
+		    dst[j] = temp;
+		}
+	    }
 	}
 	return;
     }
@@ -1024,13 +940,7 @@ STATIC_INLINE void do_blitrect_frame_buffer (struct RenderInfo *ri,
 	memcpy (tmp2, src, total_width);
 
     /* copy the temporary buffer to the destination */
-    for (lines = 0; lines < height; lines++, dst += dstri->BytesPerRow, tmp += linewidth) {
-	unsigned long cols;
-	for (cols = 0; cols < width; cols++) {
-	    dst[cols] &= ~mask;
-	    dst[cols] |= tmp[cols] & mask;
-	}
-    }
+    p96_blit_rect_masked (tmp, linewidth, dst, dstri->BytesPerRow, width, height, mask);
     /* free the temp-buf */
     free (tmp3);
 }
@@ -1328,7 +1238,7 @@ uae_u32 REGPARAM2 picasso_SetSwitch (struct regstruct *regs)
 
 void picasso_enablescreen (int on)
 {
-    currline_start = 0xFFFFFFFF;
+    clear_gfxmem_dirty ();
     picasso_refresh (1);
 }
 
@@ -1492,7 +1402,7 @@ static void init_picasso_screen (void)
 			      picasso96_state.RGBFormat);
     DX_SetPalette (0, 256);
 
-    currline_start = 0xFFFFFFFF;
+    clear_gfxmem_dirty ();
     picasso_refresh (1);
 }
 
@@ -1585,36 +1495,6 @@ uae_u32 REGPARAM2 picasso_SetPanning (struct regstruct *regs)
     return 1;
 }
 
-static void do_xor8 (uae_u8 * ptr, long len, uae_u32 val)
-{
-    int i;
-#if 0 && defined ALIGN_POINTER_TO32
-    int align_adjust = ALIGN_POINTER_TO32 (ptr);
-    int len2;
-
-    len -= align_adjust;
-    while (align_adjust) {
-	*ptr ^= val;
-	ptr++;
-	align_adjust--;
-    }
-    len2 = len >> 2;
-    len -= len2 << 2;
-    for (i = 0; i < len2; i++, ptr += 4) {
-	*(uae_u32 *) ptr ^= val;
-    }
-    while (len) {
-	*ptr ^= val;
-	ptr++;
-	len--;
-    }
-    return;
-#endif
-    for (i = 0; i < len; i++, ptr++) {
-	do_put_mem_byte (ptr, do_get_mem_byte (ptr) ^ val);
-    }
-}
-
 /*
  * InvertRect:
  *
@@ -1641,10 +1521,8 @@ uae_u32 REGPARAM2 picasso_InvertRect (struct regstruct *regs)
     uae_u8 mask          = (uae_u8) m68k_dreg (regs, 4);
     int Bpp     = GetBytesPerPixel (m68k_dreg (regs, 7));
 
-    uae_u32 xorval;
-    unsigned int lines;
     struct RenderInfo ri;
-    uae_u8 *uae_mem, *rectstart;
+    uae_u8 *rectstart;
     unsigned long width_in_bytes;
     int result = 0;
 
@@ -1656,12 +1534,10 @@ uae_u32 REGPARAM2 picasso_InvertRect (struct regstruct *regs)
 	if (mask != 0xFF && Bpp > 1)
 	    mask = 0xFF;
 
-	xorval = 0x01010101 * (mask & 0xFF);
 	width_in_bytes = Bpp * Width;
-	rectstart = uae_mem = ri.Memory + Y*ri.BytesPerRow + X*Bpp;
+	rectstart = ri.Memory + Y*ri.BytesPerRow + X*Bpp;
 
-	for (lines = 0; lines < Height; lines++, uae_mem += ri.BytesPerRow)
-	    do_xor8 (uae_mem, width_in_bytes, xorval);
+	p96_invert_rect (rectstart, ri.BytesPerRow, width_in_bytes, Height, mask);
 
 	if (renderinfo_is_current_screen (&ri)) {
 	    if (mask == 0xFF)
@@ -1683,53 +1559,8 @@ STATIC_INLINE void do_fillrect_frame_buffer (struct RenderInfo *ri,
 					     uae_u32 Pen, int Bpp,
 					     RGBFTYPE RGBFormat)
 {
-    int cols;
-    uae_u8 *start, *oldstart;
-    uae_u8 *src, *dst;
-    int lines;
-
-    /* Do our virtual frame-buffer memory.  First, we do a single line
-     * fill by hand */
-    oldstart = start = src = ri->Memory + X * Bpp + Y * ri->BytesPerRow;
-
-    switch (Bpp) {
-	case 1:
-	    memset (start, Pen, Width);
-	    break;
-	case 2:
-	    for (cols = 0; cols < Width; cols++) {
-		do_put_mem_word ((uae_u16 *)start, (uae_u16)Pen);
-		start += 2;
-	    }
-	    break;
-	case 3:
-	    for (cols = 0; cols < Width; cols++) {
-		do_put_mem_byte (start, (uae_u8)Pen);
-		start++;
-		*(uae_u16 *)(start) = (Pen & 0x00FFFF00) >> 8;
-		start+=2;
-	    }
-	    break;
-	case 4:
-	    for (cols = 0; cols < Width; cols++) {
-		do_put_mem_long ((uae_u32 *)start, Pen);
-		start += 4;
-	    }
-	    break;
-    } /* switch (Bpp) */
-
-    src = oldstart;
-    dst = src + ri->BytesPerRow;
-
-    /* next, we do the remaining line fills via memcpy() for > 1 BPP,
-     * otherwise some more memset() calls */
-    if (Bpp > 1) {
-	for (lines = 0; lines < (Height - 1); lines++, dst += ri->BytesPerRow)
-	    memcpy (dst, src, Width * Bpp);
-    } else {
-	for (lines = 0; lines < (Height - 1); lines++, dst += ri->BytesPerRow)
-	    memset( dst, Pen, Width );
-    }
+    p96_fill_rect (ri->Memory + X * Bpp + Y * ri->BytesPerRow, ri->BytesPerRow,
+		   Width, Height, Pen, Bpp);
 }
 
 /***********************************************************
@@ -2210,81 +2041,33 @@ uae_u32 REGPARAM picasso_BlitPattern (struct regstruct *regs)
 	    result = 1;
 
 	if (result) {
-			uae_u32 fgpen, bgpen;
+	    /* The pattern rows as they come down the rectangle, each repeated
+	     * across it, with room for the byte read past the end of a row */
+	    unsigned long prows = H < (1UL << pattern.Size) ? H : 1UL << pattern.Size;
+	    int rowbytes = (W + 15) / 16 * 2 + 1;
+	    uae_u8 *bits;
 #           if P96TRACING_ENABLED
 		DumpPattern (&pattern);
 #           endif
 	    ysize_mask = (1 << pattern.Size) - 1;
 	    xshift = pattern.XOffset & 15;
-		fgpen = pattern.FgPen;
-		bgpen = pattern.BgPen;
-	    for (rows = 0; rows < H; rows++, uae_mem += ri.BytesPerRow) {
+	    bits = xmalloc (prows * rowbytes);
+	    for (rows = 0; rows < prows; rows++) {
 		unsigned long prow = (rows + pattern.YOffset) & ysize_mask;
 		unsigned int d = do_get_mem_word (((uae_u16 *)pattern.Memory) + prow);
-		uae_u8 *uae_mem2 = uae_mem;
-		unsigned long cols;
+		uae_u8 *p = bits + rows * rowbytes;
+		int i;
 
 		if (xshift != 0)
 		    d = (d << xshift) | (d >> (16 - xshift));
-
-		for (cols = 0; cols < W; cols += 16, uae_mem2 += Bpp << 4) {
-		    long bits;
-		    long max = W - cols;
-		    unsigned int data = d;
-
-		    if (max > 16)
-			max = 16;
-
-		    for (bits = 0; bits < max; bits++) {
-			int bit_set = data & 0x8000;
-			data <<= 1;
-			switch (pattern.DrawMode) {
-			    case JAM1:
-				if (inversion)
-				    bit_set = !bit_set;
-				if (bit_set)
-				    PixelWrite (uae_mem2, bits, fgpen, Bpp, Mask);
-				break;
-			    case JAM2:
-				if (inversion)
-				    bit_set = !bit_set;
-				if (bit_set)
-				    PixelWrite (uae_mem2, bits, fgpen, Bpp, Mask);
-				else
-				    PixelWrite (uae_mem2, bits, bgpen, Bpp, Mask);
-				break;
-			    case COMP:
-				if (bit_set) {
-				    fgpen = pattern.FgPen;
-
-				    switch (Bpp) {
-					case 1: {
-					    uae_u8 *addr = uae_mem2 + bits;
-					    do_put_mem_byte (addr, (uae_u8)(do_get_mem_byte (addr) ^ fgpen));
-					    break;
-					}
-					case 2: {
-					    uae_u16 *addr = ((uae_u16 *)uae_mem2) + bits;
-					    do_put_mem_word (addr, (uae_u16)(do_get_mem_word (addr) ^ fgpen));
-					    break;
-					}
-					case 3: {
-					    uae_u32 *addr = (uae_u32 *)(uae_mem2 + bits * 3);
-					    do_put_mem_long (addr, do_get_mem_long (addr) ^ (fgpen & 0x00FFFFFF));
-					    break;
-					}
-					case 4: {
-					    uae_u32 *addr = ((uae_u32 *)uae_mem2) + bits;
-					    do_put_mem_long (addr, do_get_mem_long (addr) ^ fgpen);
-					    break;
-					}
-				    } /* switch (Bpp) */
-				}
-				break;
-			} /* switch (pattern.DrawMode) */
-		    } /* for (bits) */
-		} /* for (cols) */
-	    } /* for (rows) */
+		for (i = 0; i < rowbytes; i++)
+		    p[i] = i & 1 ? d : d >> 8;
+	    }
+	    for (rows = 0; rows < H; rows += prows, uae_mem += prows * ri.BytesPerRow)
+		p96_blit_template (uae_mem, ri.BytesPerRow, bits, rowbytes, 0,
+				   W, H - rows < prows ? H - rows : prows, Bpp,
+				   pattern.DrawMode, inversion, pattern.FgPen, pattern.BgPen, Mask);
+	    free (bits);
 
 	    /* If we need to update a second-buffer (extra_mem is set), then do it only if visible! */
 	    if (picasso_vidinfo.extra_mem && renderinfo_is_current_screen (&ri))
@@ -2329,9 +2112,7 @@ uae_u32 REGPARAM2 picasso_BlitTemplate (struct regstruct *regs)
     uae_u8 inversion = 0;
     struct Template tmp;
     struct RenderInfo ri;
-    unsigned long rows;
     int bitoffset;
-    uae_u32 fgpen;
     uae_u8 *uae_mem, Bpp;
     uae_u8 *tmpl_base;
     uae_u32 result = 0;
@@ -2372,7 +2153,6 @@ uae_u32 REGPARAM2 picasso_BlitTemplate (struct regstruct *regs)
 #endif
 
 	if (result) {
-			uae_u32 fgpen, bgpen;
 	    P96TRACE (("P96: BlitTemplate() xy(%d,%d), wh(%d,%d) draw 0x%x fg 0x%x bg 0x%x\n",
 		X, Y, W, H, tmp.DrawMode, tmp.FgPen, tmp.BgPen));
 
@@ -2384,79 +2164,8 @@ uae_u32 REGPARAM2 picasso_BlitTemplate (struct regstruct *regs)
 
 	    tmpl_base = tmp.Memory + tmp.XOffset / 8;
 
-		fgpen = tmp.FgPen;
-		bgpen = tmp.BgPen;
-	    for (rows = 0; rows < H; rows++, uae_mem += ri.BytesPerRow, tmpl_base += tmp.BytesPerRow) {
-		unsigned long cols;
-		uae_u8 *tmpl_mem = tmpl_base;
-		uae_u8 *uae_mem2 = uae_mem;
-		unsigned int data = *tmpl_mem;
-
-		for (cols = 0; cols < W; cols += 8, uae_mem2 += Bpp << 3) {
-		    unsigned int byte;
-		    long bits;
-		    long max = W - cols;
-
-		    if (max > 8)
-			max = 8;
-
-		    data <<= 8;
-		    data |= *++tmpl_mem;
-
-		    byte = data >> (8 - bitoffset);
-
-		    for (bits = 0; bits < max; bits++) {
-			int bit_set = (byte & 0x80);
-			byte <<= 1;
-			switch (tmp.DrawMode) {
-			    case JAM1:
-				if (inversion)
-				    bit_set = !bit_set;
-				if (bit_set) {
-				    fgpen = tmp.FgPen;
-				    PixelWrite (uae_mem2, bits, fgpen, Bpp, Mask);
-				}
-				break;
-			    case JAM2:
-				if (inversion)
-				    bit_set = !bit_set;
-				fgpen = tmp.BgPen;
-				if (bit_set)
-				    fgpen = tmp.FgPen;
-				PixelWrite (uae_mem2, bits, fgpen, Bpp, Mask);
-				break;
-			    case COMP:
-				if (bit_set) {
-				    fgpen = tmp.FgPen;
-
-				    switch (Bpp) {
-					case 1: {
-					    uae_u8 *addr = uae_mem2 + bits;
-					    do_put_mem_byte (addr, (uae_u8) (do_get_mem_byte (addr) ^ fgpen));
-					    break;
-					}
-					case 2: {
-					    uae_u16 *addr = ((uae_u16 *)uae_mem2) + bits;
-					    do_put_mem_word (addr, (uae_u16) (do_get_mem_word (addr) ^ fgpen));
-					    break;
-					}
-					case 3: {
-					    uae_u32 *addr = (uae_u32 *)(uae_mem2 + bits * 3);
-					    do_put_mem_long (addr, do_get_mem_long (addr) ^ (fgpen & 0x00FFFFFF));
-					    break;
-					}
-					case 4: {
-					    uae_u32 *addr = ((uae_u32 *)uae_mem2) + bits;
-					    do_put_mem_long (addr, do_get_mem_long (addr) ^ fgpen);
-					    break;
-					}
-				    } /* switch (Bpp) */
-				} /* if (bit_set) */
-				break;
-			} /* switch (tmp.DrawMode) */
-		    } /* for (bits) */
-		} /* for (cols) */
-	    } /* for (rows) */
+	    p96_blit_template (uae_mem, ri.BytesPerRow, tmpl_base, tmp.BytesPerRow, bitoffset,
+			       W, H, Bpp, tmp.DrawMode, inversion, tmp.FgPen, tmp.BgPen, (uae_u8)Mask);
 
 	    /* If we need to update a second-buffer (extra_mem is set), then do it only if visible! */
 	    if (picasso_vidinfo.extra_mem && renderinfo_is_current_screen (&ri))
@@ -2518,64 +2227,24 @@ static void PlanarToChunky (struct RenderInfo *ri, struct BitMap *bm,
 			    unsigned long width, unsigned long height,
 			    uae_u8 mask)
 {
+    uae_u8 *planes[8];
+    uae_u8 *image = ri->Memory + dstx * GetBytesPerPixel (ri->RGBFormat) + dsty * ri->BytesPerRow;
+    uae_u8 ones = 0;
     int j;
 
-	uae_u8 *PLANAR[8], *image = ri->Memory + dstx * GetBytesPerPixel (ri->RGBFormat) + dsty * ri->BytesPerRow;
-	int Depth = bm->Depth;
-	unsigned long rows, bitoffset = srcx & 7;
-	long eol_offset;
-
     /* Set up our bm->Planes[] pointers to the right horizontal offset */
-    for (j = 0; j < Depth; j++) {
+    for (j = 0; j < bm->Depth; j++) {
 	uae_u8 *p = bm->Planes[j];
-	if (p != &all_zeros_bitmap && p != &all_ones_bitmap)
-	    p += srcx / 8 + srcy * bm->BytesPerRow;
-	PLANAR[j] = p;
-	if ((mask & (1 << j)) == 0)
-	    PLANAR[j] = &all_zeros_bitmap;
-    }
-    eol_offset = (long) bm->BytesPerRow - (long) ((width + 7) >> 3);
-    for (rows = 0; rows < height; rows++, image += ri->BytesPerRow) {
-	unsigned long cols;
-
-	for (cols = 0; cols < width; cols += 8) {
-	    int k;
-	    uae_u32 a = 0, b = 0;
-	    unsigned int msk = 0xFF;
-	    long tmp = cols + 8 - width;
-	    if (tmp > 0) {
-		msk <<= tmp;
-		b = do_get_mem_long ((uae_u32 *) (image + cols + 4));
-		if (tmp < 4)
-		    b &= 0xFFFFFFFF >> (32 - tmp * 8);
-		else if (tmp > 4) {
-		    a = do_get_mem_long ((uae_u32 *) (image + cols));
-		    a &= 0xFFFFFFFF >> (64 - tmp * 8);
-		}
-	    }
-	    for (k = 0; k < Depth; k++) {
-		unsigned int data;
-		if (PLANAR[k] == &all_zeros_bitmap)
-		    data = 0;
-		else if (PLANAR[k] == &all_ones_bitmap)
-		    data = 0xFF;
-		else {
-		    data = (uae_u8) (do_get_mem_word ((uae_u16 *) PLANAR[k]) >> (8 - bitoffset));
-		    PLANAR[k]++;
-		}
-		data &= msk;
-		a |= p2ctab[data][0] << k;
-		b |= p2ctab[data][1] << k;
-	    }
-	    do_put_mem_long ((uae_u32 *) (image + cols), a);
-	    do_put_mem_long ((uae_u32 *) (image + cols + 4), b);
-	}
-	for (j = 0; j < Depth; j++) {
-	    if (PLANAR[j] != &all_zeros_bitmap && PLANAR[j] != &all_ones_bitmap) {
-		PLANAR[j] += eol_offset;
-	    }
-	}
+	planes[j] = 0;
+	if ((mask & (1 << j)) == 0 || p == &all_zeros_bitmap)
+	    continue;
+	if (p == &all_ones_bitmap)
+	    ones |= 1 << j;
+	else
+	    planes[j] = p + srcx / 8 + srcy * bm->BytesPerRow;
     }
+    p96_planar_to_chunky (image, ri->BytesPerRow, planes, bm->Depth, ones,
+			  bm->BytesPerRow, srcx & 7, width, height);
 }
 
 /*
@@ -2815,47 +2484,21 @@ uae_u32 REGPARAM2 picasso_BlitPlanar2Direct (struct regstruct *regs)
  */
 
 /*
- * Check whether data written to the P96 framebuffer needs to be flushed
- * to the real screen
+ * Mark data written to the P96 framebuffer as needing to be flushed to
+ * the real screen at the next flush_dirty_lines().
  *
  * addr = address in Amiga memory of data written.
  * size = size of data written in bytes
  */
 STATIC_INLINE void flush_write (uaecptr addr, uae_u8 size)
 {
-    if (picasso_on) {
-	/* Is this data on the same framebuffer line as previous
-	 * successive writes? */
-	if (addr >= currline_start && (addr + size) <= currline_end) {
-	    /* Yes. Don't flush now. We'll flush the whole line later */
-	    if (addr < currline_min)
-		currline_min = addr;
-	    if ((addr + size) > currline_max)
-		currline_max = addr + size;
-	} else {
-	    /* Otherwise, this data is on different line, or
-	     * we don't have a current line */
-	    int line_no;
-
-	    /* If there is a current line, flush it to the display now */
-	    if (currline_start != 0xFFFFFFFF)
-		 flush_currline ();
-
-	    /* Now we need to set up a new current line, starting with this
-	     * write.*/
-	    line_no = (addr - picasso96_state.Address)/picasso96_state.BytesPerRow;
-
-	    /* If this line is outside of the p96 screen in the framebuffer
-	     * we ignore it */
-	    if ((line_no >= picasso96_state.YOffset) && (line_no < picasso96_state.YOffset + picasso96_state.Height)) {
-		currline_start = picasso96_state.Address + line_no * picasso96_state.BytesPerRow;
-		currline_end   = currline_start + picasso96_state.BytesPerRow;
-		currline_min   = addr;
-		currline_max   = addr+size;
-		currline_y     = line_no;
-	    }
-	}
-    }
+    uae_u32 first = ((addr - gfxmem_start) & gfxmem_mask) >> GFXMEM_DIRTY_SHIFT;
+    uae_u32 last  = ((addr + size - 1 - gfxmem_start) & gfxmem_mask) >> GFXMEM_DIRTY_SHIFT;
+
+    /* Mark both ends; a write never spans more than two granules. */
+    gfxmem_dirty[first >> 5] |= 1u << (first & 31);
+    gfxmem_dirty[last >> 5]  |= 1u << (last & 31);
+    gfxmem_dirty_pending = 1;
 }
 
 /*
@@ -2997,16 +2640,6 @@ void InitPicasso96 (void)
     if (first_time) {
 	int i;
 
-	for (i = 0; i < 256; i++) {
-	    p2ctab[i][0] = (((i & 128) ? 0x01000000 : 0)
-			  | ((i & 64)  ? 0x010000 : 0)
-			  | ((i & 32)  ? 0x0100 : 0)
-			  | ((i & 16)  ? 0x01 : 0));
-	    p2ctab[i][1] = (((i & 8)   ? 0x01000000 : 0)
-			  | ((i & 4)   ? 0x010000 : 0)
-			  | ((i & 2)   ? 0x0100 : 0)
-			  | ((i & 1)   ? 0x01 : 0));
-	}
 	mode_count = DX_FillResolutions (&picasso96_pixel_format);
 
 	qsort (DisplayModes, mode_count, sizeof (struct PicassoResolution),
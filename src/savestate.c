@@ -59,6 +59,11 @@
 #include "gui.h"
 #include "audio.h"
 #include "version.h"
+#include "hrtimer.h"
+#include "debug.h"
+#ifdef SUPPORT_THREADS
+#include "threaddep/thread.h"
+#endif
 
 #define console_out printf
 
@@ -66,24 +71,70 @@
 
 int savestate_state = 0;
 
-#define MAX_STATERECORDS 1024 /* must be power of 2 */
+/* Rewind records, each a malloc()ed block, oldest first in a ring that
+ * grows as needed. Their total size is kept within replaybuffersize by
+ * dropping the oldest. Frames are counted from the start of emulation
+ * and go back with the state on rewind, so they identify a record,
+ * except that the debugger can force more records within a frame. */
 struct staterecord {
-    uae_u8 *start;
-    uae_u8 *end;
-    uae_u8 *next;
-    uae_u8 *cpu;
+    uae_u8 *data;
+    size_t len;
+    size_t ramofs;	/* where the RAM pages start in data */
+    unsigned int frame;
+    int forced;		/* taken by the debugger, not at the end of the frame */
 };
-static int replaycounter;
-static int replaylastreloaded = -1;
+static struct staterecord *staterecords;
+static int staterecords_max, staterecords_first, staterecords_count;
+static size_t replayused;
+static unsigned int replayframe, seekframe;
+static int rewindtarget = -1;
 static int frameextra;
+static uae_u8 *capturebuf;
+static size_t capturebufsize;
+static frame_time_t capturetime_last, capturetime_total;
+static int capturecount;
 
 struct zfile *savestate_file;
-static uae_u8 *replaybuffer, *replaybufferend;
 static int savestate_docompress, savestate_specialdump;
 static int replaybuffersize;
 
 char savestate_fname[MAX_DPATH];
-static struct staterecord staterecords[MAX_STATERECORDS];
+
+/* Chip, bogo, fast and Z3 RAM as they were at the last capture. A record
+ * only keeps the pages that changed since the capture before it, with
+ * their contents from then, so rewinding copies the RAM back from here
+ * and then rolls this copy back by one record. */
+#define STATE_RAMS 4
+#define STATE_PAGESIZE 4096
+static struct {
+    uae_u8 *mem;
+    uae_u32 size;
+} ramshadow[STATE_RAMS];
+
+/* RAM chunks are compressed in blocks of this size, see below. */
+#define STATE_BLOCKSIZE (256 * 1024)
+
+#define MAX_RAMCHUNKS 5
+struct ramchunk {
+    const char *name;
+    uae_u8 *mem;
+    uae_u32 len;
+};
+
+#ifdef SUPPORT_THREADS
+/* The RAM chunks of a compressed state save are written by a thread, from
+ * a copy of the RAM taken at the time of the save, while the emulation
+ * goes on. The emulation closes the file once the thread is done, as
+ * the zfile list is not thread safe. */
+static struct {
+    struct zfile *f;
+    struct ramchunk rams[MAX_RAMCHUNKS];
+    int nrams;
+    volatile int done;
+} statewriter;
+static uae_thread_id statewriter_tid;
+static int statewriter_running;
+#endif
 
 #endif
 
@@ -206,7 +257,7 @@ static void save_chunk (struct zfile *f, uae_u8 *chunk, size_t len, const char *
     /* chunk flags */
     flags = 0;
     dst = &tmp[0];
-    save_u32 (flags | compress);
+    save_u32 (flags | (compress ? 2 : 0));
     zfile_fwrite (&tmp[0], 1, 4, f);
     /* chunk data */
     if (compress) {
@@ -214,7 +265,7 @@ static void save_chunk (struct zfile *f, uae_u8 *chunk, size_t len, const char *
 	dst = &tmp[0];
 	save_u32 (len);
 	zfile_fwrite (&tmp[0], 1, 4, f);
-	len = zfile_zcompress (f, chunk, len);
+	len = zfile_zcompress_blocks (f, chunk, len, STATE_BLOCKSIZE);
 	if (len > 0) {
 	    zfile_fseek (f, pos, SEEK_SET);
 	    dst = &tmp[0];
@@ -267,7 +318,7 @@ static uae_u8 *restore_chunk (struct zfile *f, char *name, size_t *len, size_t *
     src = tmp;
     flags = restore_u32 ();
     *totallen = *len;
-    if (flags & 1) {
+    if (flags & 3) {
 	zfile_fread (tmp, 1, 4, f);
 	src = tmp;
 	*totallen = restore_u32();
@@ -311,12 +362,15 @@ void restore_ram (size_t filepos, uae_u8 *memory)
     size = restore_u32 ();
     flags = restore_u32 ();
     size -= 4 + 4 + 4;
-    if (flags & 1) {
+    if (flags & 3) {
 	zfile_fread (tmp, 1, 4, savestate_file);
 	src = tmp;
 	fullsize = restore_u32 ();
 	size -= 4;
-	zfile_zuncompress (memory, fullsize, savestate_file, size);
+	if (flags & 2)
+	    zfile_zuncompress_blocks (memory, fullsize, savestate_file, size);
+	else
+	    zfile_zuncompress (memory, fullsize, savestate_file, size);
     } else {
 	zfile_fread (memory, 1, size, savestate_file);
     }
@@ -349,6 +403,7 @@ void restore_state (const char *filename)
     size_t filepos;
 
     chunk = 0;
+    savestate_writer_wait ();
     f = zfile_fopen (filename, "rb");
     if (!f)
 	goto error;
@@ -504,27 +559,110 @@ void savestate_initsave (const char *filename, int mode)
     savestate_specialdump = (mode == 3) ? 1 : (mode == 4) ? 2 : 0;
 }
 
-static void save_rams (struct zfile *f, int comp)
+static int get_ramchunks (struct ramchunk *rc)
 {
-    uae_u8 *dst;
-    uae_u32 len;
-
-    dst = save_cram (&len);
-    save_chunk (f, dst, len, "CRAM", comp);
-    dst = save_bram (&len);
-    save_chunk (f, dst, len, "BRAM", comp);
+    int n = 0;
+
+    rc[n].name = "CRAM";
+    rc[n].mem = save_cram (&rc[n].len);
+    n++;
+    rc[n].name = "BRAM";
+    rc[n].mem = save_bram (&rc[n].len);
+    n++;
 #ifdef AUTOCONFIG
-    dst = save_fram (&len);
-    save_chunk (f, dst, len, "FRAM", comp);
-    dst = save_zram (&len);
-    save_chunk (f, dst, len, "ZRAM", comp);
+    rc[n].name = "FRAM";
+    rc[n].mem = save_fram (&rc[n].len);
+    n++;
+    rc[n].name = "ZRAM";
+    rc[n].mem = save_zram (&rc[n].len);
+    n++;
 #endif
 #ifdef PICASSO96
-    dst = save_pram (&len);
-    save_chunk (f, dst, len, "PRAM", comp);
+    rc[n].name = "PRAM";
+    rc[n].mem = save_pram (&rc[n].len);
+    n++;
    // dst = save_p96 (&len, 0);
    // save_chunk (f, dst, len, "P96 ", comp);
 #endif
+    return n;
+}
+
+static void save_end (struct zfile *f)
+{
+    zfile_fwrite ("END ", 1, 4, f);
+    zfile_fwrite ("\0\0\0\08", 1, 4, f);
+}
+
+#ifdef SUPPORT_THREADS
+
+static void *statewriter_thread (void *unused)
+{
+    int i;
+
+    for (i = 0; i < statewriter.nrams; i++) {
+	struct ramchunk *rc = &statewriter.rams[i];
+	save_chunk (statewriter.f, rc->mem, rc->len, rc->name, 1);
+	free (rc->mem);
+    }
+    save_end (statewriter.f);
+    statewriter.done = 1;
+    return 0;
+}
+
+/* Wait for a state save in the background to finish and close it. */
+void savestate_writer_wait (void)
+{
+    if (!statewriter_running)
+	return;
+    uae_wait_thread (statewriter_tid);
+    zfile_fclose (statewriter.f);
+    statewriter_running = 0;
+    write_log ("Save of state complete\n");
+}
+
+/* Copy the RAM and have a thread write it out, and the end of the file,
+ * in place of save_rams (). Returns 0 if that can't be done. */
+static int save_rams_background (struct zfile *f)
+{
+    struct ramchunk *rc = statewriter.rams;
+    int n = get_ramchunks (rc), i;
+
+    for (i = 0; i < n; i++) {
+	uae_u8 *mem = rc[i].mem;
+	if (!mem)
+	    continue;
+	rc[i].mem = malloc (rc[i].len);
+	if (!rc[i].mem)
+	    break;
+	memcpy (rc[i].mem, mem, rc[i].len);
+    }
+    statewriter.f = f;
+    statewriter.nrams = n;
+    statewriter.done = 0;
+    if (i == n && uae_start_thread (statewriter_thread, NULL, &statewriter_tid)) {
+	statewriter_running = 1;
+	return 1;
+    }
+    while (i-- > 0)
+	free (rc[i].mem);
+    return 0;
+}
+
+#else
+
+void savestate_writer_wait (void)
+{
+}
+
+#endif
+
+static void save_rams (struct zfile *f, int comp)
+{
+    struct ramchunk rc[MAX_RAMCHUNKS];
+    int n = get_ramchunks (rc), i;
+
+    for (i = 0; i < n; i++)
+	save_chunk (f, rc[i].mem, rc[i].len, rc[i].name, comp);
 }
 
 /* Save all subsystems */
@@ -540,6 +678,8 @@ void save_state (const char *filename, const char *description)
     char name[5];
     int comp = savestate_docompress;
 
+    savestate_writer_wait ();
+
 #ifdef FILESYS
     if (nr_units (currprefs.mountinfo)) {
 	gui_message ("WARNING: State saves do not support hard drive emulation");
@@ -651,7 +791,6 @@ void save_state (const char *filename, const char *description)
     dst = save_expansion (&len, 0);
     save_chunk (f, dst, len, "EXPA", 0);
 #endif
-    save_rams (f, comp);
 
     dst = save_rom (1, &len, 0);
     do {
@@ -677,11 +816,18 @@ void save_state (const char *filename, const char *description)
 #endif
 #endif
 
-    zfile_fwrite ("END ", 1, 4, f);
-    zfile_fwrite ("\0\0\0\08", 1, 4, f);
+    /* RAM last, so that it can be left to the writer thread */
+    savestate_state = 0;
+#ifdef SUPPORT_THREADS
+    if (comp && save_rams_background (f)) {
+	write_log ("Saving '%s' in the background\n", filename);
+	return;
+    }
+#endif
+    save_rams (f, comp);
+    save_end (f);
     write_log ("Save of '%s' complete\n", filename);
     zfile_fclose (f);
-    savestate_state = 0;
 }
 
 void savestate_quick (int slot, int save)
@@ -716,66 +862,277 @@ void savestate_quick (int slot, int save)
     }
 }
 
-static struct staterecord *canrewind (int pos)
+static uae_u8 *state_ram (int i, uae_u32 *len)
+{
+    switch (i) {
+	case 0:
+	return save_cram (len);
+	case 1:
+	return save_bram (len);
+#ifdef AUTOCONFIG
+	case 2:
+	return save_fram (len);
+	case 3:
+	return save_zram (len);
+#endif
+    }
+    *len = 0;
+    return 0;
+}
+
+static void ramshadow_free (void)
 {
     int i;
+
+    for (i = 0; i < STATE_RAMS; i++) {
+	free (ramshadow[i].mem);
+	ramshadow[i].mem = 0;
+	ramshadow[i].size = 0;
+    }
+}
+
+static struct staterecord *staterecord_get (int i)
+{
+    return &staterecords[(staterecords_first + i) % staterecords_max];
+}
+
+static void staterecord_free (struct staterecord *st)
+{
+    replayused -= st->len;
+    free (st->data);
+    st->data = 0;
+}
+
+static void staterecord_drop_oldest (void)
+{
+    staterecord_free (staterecord_get (0));
+    staterecords_first = (staterecords_first + 1) % staterecords_max;
+    staterecords_count--;
+}
+
+static void staterecord_drop_newest (void)
+{
+    staterecord_free (staterecord_get (staterecords_count - 1));
+    staterecords_count--;
+}
+
+static void staterecord_clear (void)
+{
+    while (staterecords_count > 0)
+	staterecord_drop_oldest ();
+    staterecords_first = 0;
+}
+
+/* Add a record, taking over DATA. Makes room within the buffer size by
+ * dropping the oldest records. */
+static int staterecord_add (uae_u8 *data, size_t len, size_t ramofs, int forced)
+{
     struct staterecord *st;
 
-    if (!replaybuffer)
+    if (len > (size_t)replaybuffersize) {
+	write_log ("can't save, too small capture buffer\n");
 	return 0;
-    i = replaycounter;
-    st = &staterecords[i];
-    if (st->start)
-	return st;
-    return 0;
+    }
+    while (staterecords_count > 0 && replayused + len > (size_t)replaybuffersize)
+	staterecord_drop_oldest ();
+    if (staterecords_count == staterecords_max) {
+	int max = staterecords_max ? staterecords_max * 2 : 64, i;
+	struct staterecord *n = malloc (max * sizeof *n);
+	if (!n)
+	    return 0;
+	for (i = 0; i < staterecords_count; i++)
+	    n[i] = *staterecord_get (i);
+	free (staterecords);
+	staterecords = n;
+	staterecords_max = max;
+	staterecords_first = 0;
+    }
+    st = staterecord_get (staterecords_count++);
+    st->data = data;
+    st->len = len;
+    st->ramofs = ramofs;
+    st->frame = replayframe;
+    st->forced = forced;
+    replayused += len;
+    return 1;
+}
+
+/* Start over from a full copy of the RAM if there is none yet or the
+ * memory configuration changed. The records taken before can't be
+ * rewound to after that. */
+static int ramshadow_check (void)
+{
+    uae_u32 len;
+    int i;
+
+    for (i = 0; i < STATE_RAMS; i++) {
+	state_ram (i, &len);
+	if (len != ramshadow[i].size || (len && !ramshadow[i].mem))
+	    break;
+    }
+    if (i == STATE_RAMS)
+	return 1;
+    ramshadow_free ();
+    staterecord_clear ();
+    for (i = 0; i < STATE_RAMS; i++) {
+	uae_u8 *mem = state_ram (i, &len);
+	if (!len)
+	    continue;
+	ramshadow[i].mem = malloc (len);
+	if (!ramshadow[i].mem) {
+	    ramshadow_free ();
+	    return 0;
+	}
+	ramshadow[i].size = len;
+	memcpy (ramshadow[i].mem, mem, len);
+    }
+    return 1;
+}
+
+/* Bring the copy up to date with the pages listed in a record just
+ * captured. */
+static void ramshadow_update (const uae_u8 *p)
+{
+    uae_u32 len, npages, pg;
+    int i;
+
+    for (i = 0; i < STATE_RAMS; i++) {
+	uae_u8 *mem = state_ram (i, &len);
+	p += 4;
+	npages = restore_u32_func (&p);
+	while (npages-- > 0) {
+	    pg = restore_u32_func (&p);
+	    len = ramshadow[i].size - pg < STATE_PAGESIZE ? ramshadow[i].size - pg : STATE_PAGESIZE;
+	    memcpy (ramshadow[i].mem + pg, mem + pg, len);
+	    p += len;
+	}
+    }
+}
+
+/* Roll the copy back to the capture before the one the RAM section at P
+ * belongs to. Returns the end of the section, or 0 if it does not fit
+ * the current memory configuration. */
+static const uae_u8 *ramshadow_undo (const uae_u8 *p)
+{
+    uae_u32 len, npages, pg;
+    int i;
+
+    for (i = 0; i < STATE_RAMS; i++) {
+	len = restore_u32_func (&p);
+	if (len != ramshadow[i].size)
+	    return 0;
+	npages = restore_u32_func (&p);
+	while (npages-- > 0) {
+	    pg = restore_u32_func (&p);
+	    len = ramshadow[i].size - pg < STATE_PAGESIZE ? ramshadow[i].size - pg : STATE_PAGESIZE;
+	    memcpy (ramshadow[i].mem + pg, p, len);
+	    p += len;
+	}
+    }
+    return p;
+}
+
+/* The newest record captured at the end of FRAME or before, or -1. */
+static int staterecord_find (unsigned int frame)
+{
+    int lo = 0, hi = staterecords_count - 1, found = -1;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (staterecord_get (mid)->frame <= frame) {
+	    found = mid;
+	    lo = mid + 1;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    while (found >= 0 && staterecord_get (found)->forced)
+	found--;
+    return found;
 }
 
 int savestate_dorewind (int pos)
 {
-    if (canrewind (pos)) {
+    if (staterecords_count > 0) {
+	rewindtarget = staterecords_count - 1;
+	seekframe = 0;
 	savestate_state = STATE_DOREWIND;
 	return 1;
     }
     return 0;
 }
 
+/* Go back to the state captured at or before FRAME and, if it was before,
+ * run on to FRAME and stop there in the debugger. */
+int savestate_seek (unsigned int frame)
+{
+    int i = staterecord_find (frame);
+
+    if (i < 0)
+	return 0;
+    rewindtarget = i;
+    seekframe = staterecord_get (i)->frame < frame ? frame : 0;
+    savestate_state = STATE_DOREWIND;
+    return 1;
+}
+
+unsigned int savestate_frame (void)
+{
+    return replayframe;
+}
+
 void savestate_listrewind (void)
 {
-    int i = replaycounter;
-    int cnt;
+    int i;
     const uae_u8 *p;
     uae_u32 pc;
 
-    cnt = 1;
-    for (;;) {
-	struct staterecord *st;
-	st = &staterecords[i];
-	if (!st->start)
-	    break;
-	p = st->cpu + 17 * 4;
+    for (i = staterecords_count - 1; i >= 0; i--) {
+	struct staterecord *st = staterecord_get (i);
+	p = st->data + 17 * 4;
 	pc = restore_u32_func (&p);
-	console_out ("%d: PC=%08X %c\n", cnt, pc, regs.pc == pc ? '*' : ' ');
-	cnt++;
-	i--;
-	if (i < 0)
-	    i += MAX_STATERECORDS;
+	console_out ("%d: frame %u PC=%08X %c\n", staterecords_count - i, st->frame, pc, regs.pc == pc ? '*' : ' ');
     }
 }
 
+void savestate_rewindinfo (void)
+{
+    uae_u32 shadow = 0;
+    int i;
+
+    for (i = 0; i < STATE_RAMS; i++)
+	shadow += ramshadow[i].size;
+    console_out ("Frame %u, %d records", replayframe, staterecords_count);
+    if (staterecords_count > 0)
+	console_out (" (frames %u-%u)", staterecord_get (0)->frame, staterecord_get (staterecords_count - 1)->frame);
+    console_out ("\nBuffer %lu of %d bytes used, RAM copy %u bytes\n",
+		 (unsigned long)replayused, replaybuffersize, shadow);
+    if (capturecount > 0)
+	console_out ("Capture time last %d us, average %d us over %d captures\n",
+		     (int)(capturetime_last * 1000000.0 / uae_gethrtimebase ()),
+		     (int)(capturetime_total * 1000000.0 / uae_gethrtimebase () / capturecount), capturecount);
+}
+
 void savestate_rewind (void)
 {
-    unsigned int len;
     unsigned int i, dummy;
     const uae_u8 *p, *p2;
     struct staterecord *st;
 
-    st = canrewind (1);
-    if (!st)
+    if (rewindtarget < 0 || rewindtarget >= staterecords_count)
 	return;
     frameextra = timeframes % currprefs.statecapturerate;
-    p =  st->start;
-    p2 = st->end;
-    write_log ("rewinding from %d\n", replaycounter);
+    write_log ("rewinding from frame %u to %u\n", replayframe, staterecord_get (rewindtarget)->frame);
+    /* The copy of the RAM goes back to the target first. */
+    while (staterecords_count - 1 > rewindtarget) {
+	st = staterecord_get (staterecords_count - 1);
+	if (!ramshadow_undo (st->data + st->ramofs))
+	    goto fail;
+	staterecord_drop_newest ();
+    }
+    st = staterecord_get (rewindtarget);
+    p = st->data;
+    p2 = st->data + st->len;
     p = restore_cpu (p);
 #ifdef FPUEMU
     if (restore_u32_func (&p))
@@ -799,20 +1156,15 @@ void savestate_rewind (void)
 #ifdef AUTOCONFIG
     p = restore_expansion (p);
 #endif
-    len = restore_u32_func (&p);
-    memcpy (chipmemory, p, currprefs.chipmem_size > len ? len : currprefs.chipmem_size);
-    p += len;
-    len = restore_u32_func (&p);
-    memcpy (save_bram (&dummy), p, currprefs.bogomem_size > len ? len : currprefs.bogomem_size);
-    p += len;
-#ifdef AUTOCONFIG
-    len = restore_u32_func (&p);
-    memcpy (save_fram (&dummy), p, currprefs.fastmem_size > len ? len : currprefs.fastmem_size);
-    p += len;
-    len = restore_u32_func (&p);
-    memcpy (save_zram (&dummy), p, currprefs.z3fastmem_size > len ? len : currprefs.z3fastmem_size);
-    p += len;
-#endif
+    for (i = 0; i < STATE_RAMS; i++) {
+	uae_u8 *mem = state_ram (i, &dummy);
+	if (dummy != ramshadow[i].size)
+	    goto fail;
+	memcpy (mem, ramshadow[i].mem, dummy);
+    }
+    p = ramshadow_undo (p);
+    if (!p)
+	goto fail;
 #ifdef ACTION_REPLAY
     if (restore_u32_func (&p))
 	p = restore_action_replay (p);
@@ -820,221 +1172,224 @@ void savestate_rewind (void)
     p += 4;
     if (p != p2) {
 	gui_message ("reload failure, address mismatch %p != %p", p, p2);
-	uae_reset (0);
-	return;
+	goto reset;
     }
-    st->start = st->next = 0;
-    replaycounter--;
-    if (replaycounter < 0)
-	replaycounter += MAX_STATERECORDS;
+    replayframe = st->frame;
+    staterecord_drop_newest ();
+    rewindtarget = -1;
+    return;
+
+fail:
+    gui_message ("reload failure, memory size changed");
+reset:
+    staterecord_clear ();
+    rewindtarget = -1;
+    uae_reset (0);
 }
 
 #define BS 10000
 
-static int bufcheck (uae_u8 **pp, int len)
+/* Room for LEN more bytes at POS in the capture buffer, plus some for
+ * the small state blocks that don't say how big they are. */
+static uae_u8 *capture_reserve (size_t pos, size_t len)
 {
-    uae_u8 *p = *pp;
-    if (p + len + BS >= replaybuffer + replaybuffersize) {
-	//write_log ("capture buffer wrap-around\n");
-	return 1;
+    if (pos + len + BS > capturebufsize) {
+	size_t size = (pos + len + BS) * 2;
+	uae_u8 *n = realloc (capturebuf, size);
+	if (!n)
+	    return 0;
+	capturebuf = n;
+	capturebufsize = size;
     }
-    return 0;
+    return capturebuf + pos;
 }
 
 void savestate_capture (int force)
 {
-    uae_u8 *p, *p2, *p3, *dst;
+    uae_u8 *p, *p3, *data;
     uae_u32 len;
-    int i, tlen, retrycnt;
-    struct staterecord *st, *stn;
+    size_t pos, ramofs;
+    int i;
+    frame_time_t start;
 
+#ifdef SUPPORT_THREADS
+    if (statewriter_running && statewriter.done)
+	savestate_writer_wait ();
+#endif
+    if (!force) {
+	replayframe++;
+#ifdef DEBUGGER
+	if (seekframe && replayframe == seekframe) {
+	    seekframe = 0;
+	    activate_debugger ();
+	}
+#endif
+    }
 #ifdef FILESYS
     if (nr_units (currprefs.mountinfo))
 	return;
 #endif
-    if (!replaybuffer)
+    if (!replaybuffersize)
 	return;
     if (!force && (!currprefs.statecapture || !currprefs.statecapturerate || ((timeframes + frameextra) % currprefs.statecapturerate)))
 	return;
-
-    retrycnt = 0;
-retry2:
-    st = &staterecords[replaycounter];
-    if (st->next == 0) {
-	replaycounter = 0;
-	st = &staterecords[replaycounter];
-	st->next = replaybuffer;
+    if (!ramshadow_check ()) {
+	write_log ("can't save, out of memory\n");
+	return;
     }
-    stn = &staterecords[(replaycounter + 1) & (MAX_STATERECORDS - 1)];
-    p = p2 = st->next;
-    tlen = 0;
-    if (bufcheck (&p, 0))
-	goto retry;
-    stn->cpu = p;
+    start = uae_gethrtime ();
+
+    pos = 0;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_cpu (&len, p);
-    tlen += len;
-    p += len;
+    pos += len;
 #ifdef FPUEMU
-    if (bufcheck (&p, 0))
-	goto retry;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     p3 = p;
     save_u32_func (&p, 0);
-    tlen += 4;
     if (save_fpu (&len, p)) {
 	save_u32_func (&p3, 1);
-	tlen += len;
 	p += len;
     }
+    pos = p - capturebuf;
 #endif
     for (i = 0; i < 4; i++) {
-	if (bufcheck (&p, 0))
-	    goto retry;
+	if (!(p = capture_reserve (pos, 0)))
+	    goto nomem;
 	save_disk (i, &len, p);
-	tlen += len;
-	p += len;
+	pos += len;
     }
-    if (bufcheck (&p, 0))
-	goto retry;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_floppy (&len, p);
-    tlen += len;
-    p += len;
-    if (bufcheck (&p, 0))
-	goto retry;
+    pos += len;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_custom (&len, p, 0);
-    tlen += len;
-    p += len;
-    if (bufcheck (&p, 0))
-	goto retry;
+    pos += len;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_blitter (&len, p);
-    tlen += len;
-    p += len;
-    if (bufcheck (&p, 0))
-	goto retry;
+    pos += len;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_custom_agacolors (&len, p);
-    tlen += len;
-    p += len;
+    pos += len;
     for (i = 0; i < 8; i++) {
-	if (bufcheck (&p, 0))
-	    goto retry;
+	if (!(p = capture_reserve (pos, 0)))
+	    goto nomem;
 	save_custom_sprite (i, &len, p);
-	tlen += len;
-	p += len;
+	pos += len;
     }
     for (i = 0; i < 4; i++) {
-	if (bufcheck (&p, 0))
-	    goto retry;
+	if (!(p = capture_reserve (pos, 0)))
+	    goto nomem;
 	save_audio (i, &len, p);
-	tlen += len;
-	p += len;
+	pos += len;
     }
-    if (bufcheck (&p, 0))
-	goto retry;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_cia (0, &len, p);
-    tlen += len;
-    p += len;
-    if (bufcheck (&p, 0))
-	goto retry;
+    pos += len;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_cia (1, &len, p);
-    tlen += len;
-    p += len;
+    pos += len;
 #ifdef AUTOCONFIG
-    if (bufcheck (&p, 0))
-	goto retry;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     save_expansion (&len, p);
-    tlen += len;
-    p += len;
-#endif
-    dst = save_cram (&len);
-    if (bufcheck (&p, len))
-	goto retry;
-    save_u32_func (&p, len);
-    memcpy (p, dst, len);
-    tlen += len + 4;
-    p += len;
-    dst = save_bram (&len);
-    if (bufcheck (&p, len))
-	goto retry;
-    save_u32_func (&p, len);
-    memcpy (p, dst, len);
-    tlen += len + 4;
-    p += len;
-#ifdef AUTOCONFIG
-    dst = save_fram (&len);
-    if (bufcheck (&p, len))
-	goto retry;
-    save_u32_func (&p, len);
-    memcpy (p, dst, len);
-    tlen += len + 4;
-    p += len;
-    dst = save_zram (&len);
-    if (bufcheck (&p, len))
-	goto retry;
-    save_u32_func (&p, len);
-    memcpy (p, dst, len);
-    tlen += len + 4;
-    p += len;
+    pos += len;
 #endif
+    ramofs = pos;
+    for (i = 0; i < STATE_RAMS; i++) {
+	uae_u8 *mem = state_ram (i, &len);
+	uae_u8 *old = ramshadow[i].mem;
+	uae_u32 pg, n, npages = 0;
+	size_t npagespos;
+
+	if (!(p = capture_reserve (pos, 8)))
+	    goto nomem;
+	save_u32_func (&p, len);
+	npagespos = pos + 4;
+	pos += 8;
+	for (pg = 0; pg < len; pg += STATE_PAGESIZE) {
+	    n = len - pg < STATE_PAGESIZE ? len - pg : STATE_PAGESIZE;
+	    if (!memcmp (mem + pg, old + pg, n))
+		continue;
+	    if (!(p = capture_reserve (pos, n + 4)))
+		goto nomem;
+	    save_u32_func (&p, pg);
+	    memcpy (p, old + pg, n);
+	    pos += n + 4;
+	    npages++;
+	}
+	p = capturebuf + npagespos;
+	save_u32_func (&p, npages);
+    }
 #ifdef ACTION_REPLAY
-    if (bufcheck (&p, 0))
-	goto retry;
+    if (!(p = capture_reserve (pos, 0)))
+	goto nomem;
     p3 = p;
     save_u32_func (&p, 0);
-    tlen += 4;
     if (save_action_replay (&len, p)) {
 	save_u32_func (&p3, 1);
-	tlen += len;
 	p += len;
     }
+    pos = p - capturebuf;
 #endif
-    save_u32_func (&p, tlen);
-    stn->next = p;
-    stn->start = p2;
-    stn->end = p;
-    replaylastreloaded = -1;
-    replaycounter++;
-    replaycounter &= (MAX_STATERECORDS - 1);
-    i = (replaycounter + 1) & (MAX_STATERECORDS - 1);
-    staterecords[i].next = staterecords[i].start = 0;
-    i = replaycounter - 1;
-    while (i != replaycounter) {
-	if (i < 0)
-	    i += MAX_STATERECORDS;
-	st = &staterecords[i];
-	if (p2 <= st->start && p >= st->end) {
-	    st->start = st->next = 0;
-	    break;
-	}
-	i--;
-    }
-    //write_log ("state capture %d (%d bytes)\n", replaycounter, p - p2);
-    return;
-retry:
-    staterecords[replaycounter].next = replaybuffer;
-    retrycnt++;
-    if (retrycnt > 1) {
-	write_log ("can't save, too small capture buffer\n");
+    if (!(p = capture_reserve (pos, 4)))
+	goto nomem;
+    save_u32_func (&p, pos);
+    pos += 4;
+
+    data = malloc (pos);
+    if (!data)
+	goto nomem;
+    memcpy (data, capturebuf, pos);
+    if (!staterecord_add (data, pos, ramofs, force)) {
+	free (data);
 	return;
     }
-    goto retry2;
+    ramshadow_update (data + ramofs);
+    capturetime_last = uae_gethrtime () - start;
+    capturetime_total += capturetime_last;
+    capturecount++;
+    //write_log ("state capture at frame %u (%d bytes)\n", replayframe, pos);
+    return;
+
+nomem:
+    write_log ("can't save, out of memory\n");
 }
 
+/* Must be called before zfile_exit (), which frees every open zfile,
+ * including that of a state still being written in the background. */
 void savestate_free (void)
 {
-    free (replaybuffer);
-    replaybuffer = 0;
+    savestate_writer_wait ();
+    staterecord_clear ();
+    free (staterecords);
+    staterecords = 0;
+    staterecords_max = 0;
+    free (capturebuf);
+    capturebuf = 0;
+    capturebufsize = 0;
+    replaybuffersize = 0;
+    ramshadow_free ();
 }
 
 void savestate_init (void)
 {
     savestate_free ();
-    memset (staterecords, 0, sizeof (staterecords));
-    replaycounter = 0;
-    replaylastreloaded = -1;
+    rewindtarget = -1;
+    seekframe = 0;
     frameextra = 0;
-    if (currprefs.statecapture && currprefs.statecapturebuffersize && currprefs.statecapturerate) {
+    capturetime_last = capturetime_total = 0;
+    capturecount = 0;
+    if (currprefs.statecapture && currprefs.statecapturebuffersize && currprefs.statecapturerate)
 	replaybuffersize = currprefs.statecapturebuffersize;
-	replaybuffer = malloc (replaybuffersize);
-    }
 }
 
 /*
@@ -1057,6 +1412,9 @@ HUNK HEADER (beginning of every hunk)
 	hunk flags
 
 	bit 0 = chunk contents are compressed with zlib (maybe RAM chunks only?)
+	bit 1 = chunk contents are compressed with zlib in independent blocks:
+		block size 4, number of blocks 4, compressed size of each
+		block 4 (bit 31 set = block stored uncompressed), blocks
 
 HEADER
 
@@ -1249,7 +1607,7 @@ RAM SPACE
 	start address           4 ("bank"=chip/slow/fast etc..)
 	of RAM "bank"
 	RAM "bank" size         4
-	RAM flags               4 (bit 0 = zlib compressed)
+	RAM flags               4 (bit 0 = zlib compressed, bit 1 = in blocks)
 	RAM "bank" contents
 
 ROM SPACE
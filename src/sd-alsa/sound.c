@@ -19,24 +19,293 @@
 #include "options.h"
 #include "gensound.h"
 #include "sounddep/sound.h"
+#ifdef SUPPORT_THREADS
+# include "threaddep/thread.h"
+#endif
 
 #include <alsa/asoundlib.h>
 
 char alsa_device[256];
 int  alsa_verbose;
+int  alsa_ring_periods;
 
-static int have_sound = 0;
+unsigned int have_sound = 0;
 
 uae_u16 sndbuffer[44100];
 uae_u16 *sndbufpt;
 int sndbufsize;
 
-snd_pcm_t *alsa_playback_handle = 0;
-int bytes_per_frame;
+static snd_pcm_t *alsa_playback_handle = 0;
+static int bytes_per_frame;
+static int alsa_underruns;
 
+/* alsa_xrun_recovery() function is copied from ALSA manual. why the hell did
+   they make ALSA this hard?! i bet 95% of ALSA programmers would like a
+   simpler way to do error handling.. let the 5% use tricky APIs.
+*/
+static int alsa_xrun_recovery(snd_pcm_t *handle, int err)
+{
+  if (err == -EPIPE) {
+    /* under-run */
+    alsa_underruns++;
+    err = snd_pcm_prepare(handle);
+    if (err < 0)
+      fprintf(stderr, "uae: no recovery with alsa from underrun, prepare failed: %s\n", snd_strerror(err));
+    return 0;
+  } else if (err == -ESTRPIPE) {
+    while ((err = snd_pcm_resume(handle)) == -EAGAIN) {
+      /* wait until the suspend flag is released */
+      fprintf(stderr, "uae: sleeping for alsa.\n");
+      sleep(1);
+    }
+    if (err < 0) {
+      err = snd_pcm_prepare(handle);
+      if (err < 0)
+	fprintf(stderr, "uae: no recovery with alsa from suspend, prepare failed: %s\n", snd_strerror(err));
+    }
+    return 0;
+  }
+  return err;
+}
+
+static void write_period (const uae_u8 *buf)
+{
+  int frames = sndbufsize / bytes_per_frame;
+  int ret;
+
+  while (frames > 0) {
+    ret = snd_pcm_writei(alsa_playback_handle, buf, frames);
+    if (ret < 0) {
+      if (ret == -EAGAIN || ret == -EINTR)
+	continue;
+      if (alsa_xrun_recovery(alsa_playback_handle, ret) < 0) {
+	fprintf(stderr, "uae: write error with alsa: %s\n", snd_strerror(ret));
+	exit(-1);
+      }
+      continue;
+    }
+    frames -= ret;
+    buf += ret * bytes_per_frame;
+  }
+}
+
+#ifdef SUPPORT_THREADS
+
+/*
+ * Finished periods go through a single-producer/single-consumer ring to an
+ * output thread, so that a slow or stalled snd_pcm_writei() doesn't hold up
+ * the emulation. HEAD and TAIL count periods written and played; only the
+ * emulation moves HEAD and only the output thread moves TAIL, and each
+ * publishes its update with a barrier after touching the slot data.
+ *
+ * The emulation waits only when more than ring_target periods are queued,
+ * which paces it by the sound card as the blocking write used to. The
+ * target grows by a period whenever the device underruns and creeps back
+ * towards its minimum after a while without underruns.
+ */
+#define MAX_RING_PERIODS 64
+#define RING_CMD_PAUSE   1
+#define RING_CMD_RESUME  2
+#define RING_CMD_QUIT    3
+
+static uae_u8 *ring_buffer;
+static unsigned int ring_periods;
+static volatile unsigned int ring_head, ring_tail;
+static volatile int ring_target, ring_producer_waiting, ring_cmd;
+static int ring_target_min, ring_target_max, ring_calm_periods;
+static uae_sem_t ring_data_sem, ring_space_sem, ring_cmd_sem;
+static uae_thread_id ring_tid;
+static int ring_running;
+
+/* Fill level seen by the emulation, for alsa.verbose. */
+static unsigned int stat_fill_min, stat_fill_max, stat_fill_sum, stat_pushes;
+static int stat_underruns;
+
+#define ring_barrier() __sync_synchronize ()
+
+static void *sound_thread (void *dummy)
+{
+    int calm = 0;
+
+    for (;;) {
+	unsigned int tail;
+	int underruns;
+
+	uae_sem_wait (&ring_data_sem);
+
+	switch (ring_cmd) {
+	case RING_CMD_PAUSE:
+	    snd_pcm_drop (alsa_playback_handle);
+	    ring_tail = ring_head;
+	    break;
+	case RING_CMD_RESUME:
+	    snd_pcm_prepare (alsa_playback_handle);
+	    break;
+	case RING_CMD_QUIT:
+	    ring_cmd = 0;
+	    uae_sem_post (&ring_cmd_sem);
+	    return 0;
+	}
+	if (ring_cmd) {
+	    ring_cmd = 0;
+	    uae_sem_post (&ring_cmd_sem);
+	    continue;
+	}
+
+	tail = ring_tail;
+	if (tail == ring_head)
+	    continue;
+	ring_barrier ();
+
+	underruns = alsa_underruns;
+	write_period (ring_buffer + (tail % ring_periods) * sndbufsize);
+	if (alsa_underruns != underruns) {
+	    calm = 0;
+	    if (ring_target < ring_target_max)
+		ring_target++;
+	} else if (++calm >= ring_calm_periods) {
+	    calm = 0;
+	    if (ring_target > ring_target_min)
+		ring_target--;
+	}
+
+	ring_barrier ();
+	ring_tail = tail + 1;
+	ring_barrier ();
+	if (ring_producer_waiting) {
+	    ring_producer_waiting = 0;
+	    uae_sem_post (&ring_space_sem);
+	}
+    }
+}
+
+static void ring_command (int cmd)
+{
+    ring_cmd = cmd;
+    uae_sem_post (&ring_data_sem);
+    uae_sem_wait (&ring_cmd_sem);
+}
+
+static void report_ring_stats (void)
+{
+    if (stat_pushes)
+	write_log ("ALSA: queue fill min %u avg %u.%02u max %u periods, target %d, %d underruns, rate %+.3f%%.\n",
+		   stat_fill_min, stat_fill_sum / stat_pushes, stat_fill_sum % stat_pushes * 100 / stat_pushes,
+		   stat_fill_max, ring_target, alsa_underruns - stat_underruns,
+		   sound_get_rate_adjust () * 100.0);
+    stat_fill_min = ~0;
+    stat_fill_max = stat_fill_sum = stat_pushes = 0;
+    stat_underruns = alsa_underruns;
+}
+
+void finish_sound_buffer (void)
+{
+    unsigned int head = ring_head, fill;
+
+    /* Never overwrite a period that hasn't been played yet. */
+    while (head - ring_tail >= ring_periods) {
+	ring_producer_waiting = 1;
+	ring_barrier ();
+	if (head - ring_tail >= ring_periods)
+	    uae_sem_wait (&ring_space_sem);
+    }
+
+    memcpy (ring_buffer + (head % ring_periods) * sndbufsize, sndbuffer, sndbufsize);
+    ring_barrier ();
+    ring_head = head + 1;
+    uae_sem_post (&ring_data_sem);
+
+    fill = ring_head - ring_tail;
+    if (fill < stat_fill_min)
+	stat_fill_min = fill;
+    if (fill > stat_fill_max)
+	stat_fill_max = fill;
+    stat_fill_sum += fill;
+    /* When the emulation is paced by us, the queue holds one more period
+     * than the target at this point. */
+    sound_report_fill (fill, ring_target + 1);
+    if (alsa_verbose && ++stat_pushes >= (unsigned int)ring_calm_periods)
+	report_ring_stats ();
+
+    /* Let the sound card catch up if we're too far ahead. */
+    while ((int)(ring_head - ring_tail) > ring_target) {
+	ring_producer_waiting = 1;
+	ring_barrier ();
+	if ((int)(ring_head - ring_tail) > ring_target)
+	    uae_sem_wait (&ring_space_sem);
+    }
+}
+
+static int start_sound_thread (int rate, int period_frames)
+{
+    ring_periods = alsa_ring_periods;
+    if (ring_periods < 2)
+	ring_periods = 2;
+    if (ring_periods > MAX_RING_PERIODS)
+	ring_periods = MAX_RING_PERIODS;
+
+    ring_buffer = malloc (ring_periods * sndbufsize);
+    if (!ring_buffer)
+	return 0;
+
+    ring_head = ring_tail = 0;
+    ring_cmd = ring_producer_waiting = 0;
+    ring_target_min = 1;
+    ring_target_max = ring_periods - 1;
+    ring_target = ring_target_min;
+    /* Try lowering the target after about ten seconds without underruns. */
+    ring_calm_periods = rate * 10 / period_frames;
+    if (ring_calm_periods < 1)
+	ring_calm_periods = 1;
+    stat_fill_min = ~0;
+    stat_fill_max = stat_fill_sum = stat_pushes = 0;
+    stat_underruns = alsa_underruns = 0;
+
+    uae_sem_init (&ring_data_sem, 0, 0);
+    uae_sem_init (&ring_space_sem, 0, 0);
+    uae_sem_init (&ring_cmd_sem, 0, 0);
+    if (!uae_start_thread (sound_thread, NULL, &ring_tid)) {
+	uae_sem_destroy (&ring_data_sem);
+	uae_sem_destroy (&ring_space_sem);
+	uae_sem_destroy (&ring_cmd_sem);
+	free (ring_buffer);
+	ring_buffer = 0;
+	return 0;
+    }
+    ring_running = 1;
+    return 1;
+}
+
+static void stop_sound_thread (void)
+{
+    if (!ring_running)
+	return;
+    if (alsa_verbose)
+	report_ring_stats ();
+    ring_command (RING_CMD_QUIT);
+    uae_wait_thread (ring_tid);
+    uae_sem_destroy (&ring_data_sem);
+    uae_sem_destroy (&ring_space_sem);
+    uae_sem_destroy (&ring_cmd_sem);
+    free (ring_buffer);
+    ring_buffer = 0;
+    ring_running = 0;
+}
+
+#else
+
+void finish_sound_buffer (void)
+{
+    write_period ((uae_u8 *)sndbuffer);
+}
+
+#endif
 
 void close_sound (void)
 {
+#ifdef SUPPORT_THREADS
+  stop_sound_thread ();
+#endif
   if (alsa_playback_handle) {
     snd_pcm_close (alsa_playback_handle);
     alsa_playback_handle = 0;
@@ -232,6 +501,14 @@ int init_sound (void)
 
     sndbufpt = sndbuffer;
 
+#ifdef SUPPORT_THREADS
+    if (!start_sound_thread (rate, period_frames)) {
+	write_log ("ALSA: Cannot start sound output thread.\n");
+	goto nosound;
+    }
+    write_log ("ALSA: Queueing up to %u periods ahead of the device.\n", ring_periods);
+#endif
+
     return 1;
 
  nosound:
@@ -251,12 +528,24 @@ void reset_sound (void)
 
 void pause_sound (void)
 {
+#ifdef SUPPORT_THREADS
+    if (ring_running) {
+	ring_command (RING_CMD_PAUSE);
+	return;
+    }
+#endif
     if (alsa_playback_handle)
 	snd_pcm_drop (alsa_playback_handle);
 }
 
 void resume_sound (void)
 {
+#ifdef SUPPORT_THREADS
+    if (ring_running) {
+	ring_command (RING_CMD_RESUME);
+	return;
+    }
+#endif
     if (alsa_playback_handle)
 	snd_pcm_prepare (alsa_playback_handle);
 }
@@ -272,16 +561,19 @@ void audio_default_options (struct uae_prefs *p)
 {
     strncpy (alsa_device, "default", 256);
     alsa_verbose = 0;
+    alsa_ring_periods = 8;
 }
 
 void audio_save_options (FILE *f, const struct uae_prefs *p)
 {
     cfgfile_write (f, "alsa.device=%s\n", alsa_device);
     cfgfile_write (f, "alsa.verbose=%s\n", alsa_verbose ? "true" : "false");
+    cfgfile_write (f, "alsa.queue_periods=%d\n", alsa_ring_periods);
 }
 
 int audio_parse_option (struct uae_prefs *p, const char *option, const char *value)
 {
     return (cfgfile_string (option, value, "device",   alsa_device, 256)
-	 || cfgfile_yesno  (option, value, "verbose", &alsa_verbose));
+	 || cfgfile_yesno  (option, value, "verbose", &alsa_verbose)
+	 || cfgfile_intval (option, value, "queue_periods", &alsa_ring_periods, 1));
 }
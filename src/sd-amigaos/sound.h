@@ -18,6 +18,8 @@
 #include <proto/dos.h>
 #include <clib/alib_protos.h>
 
+#include "soundcapture.h"
+
 extern struct AHIRequest *AHIio[];
 extern struct AHIRequest *linkio;
 
@@ -59,6 +61,7 @@ STATIC_INLINE void check_sound_buffers (void)
 #ifdef DRIVESOUND
         driveclick_mix ((uae_s16*)sndbuffer, sndbufsize >> 1);
 #endif
+	sound_capture_write (sndbuffer, sndbufsize);
 	flush_sound_buffer ();
     }
 }
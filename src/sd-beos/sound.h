@@ -7,6 +7,8 @@
   * Copyright 2003-2007 Richard Drummond
   */
 
+#include "soundcapture.h"
+
 extern uae_u16 *sndbuffer;
 extern uae_u16 *sndbufpt;
 extern int sndbufsize;
@@ -15,6 +17,7 @@ extern void finish_sound_buffer (void);
 STATIC_INLINE void check_sound_buffers (void)
 {
     if ((char *)sndbufpt - (char *)sndbuffer >= sndbufsize) {
+	sound_capture_write (sndbuffer, sndbufsize);
 	finish_sound_buffer ();
     }
 }
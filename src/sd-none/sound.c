@@ -14,15 +14,37 @@
 #include "gensound.h"
 #include "sounddep/sound.h"
 
-int init_sound (void)
+unsigned int have_sound;
+
+uae_u16 sndbuffer[4096];
+uae_u16 *sndbufpt;
+int sndbufsize;
+
+int setup_sound (void)
 {
-    currprefs.produce_sound = 0;
+    /* Sound can only be captured. */
+    sound_available = currprefs.sound_capture_file[0] != 0;
+    if (!sound_available)
+	currprefs.produce_sound = 0;
     return 1;
 }
 
-int setup_sound (void)
+int init_sound (void)
 {
-    currprefs.produce_sound = 0;
+    if (!currprefs.sound_capture_file[0] || currprefs.produce_sound < 2) {
+	currprefs.produce_sound = 0;
+	have_sound = 0;
+	return 1;
+    }
+
+    obtainedfreq = currprefs.sound_freq;
+    sndbufsize = sizeof sndbuffer;
+    sndbufpt = sndbuffer;
+    init_sound_table16 ();
+    sample_handler = currprefs.sound_stereo ? sample16s_handler : sample16_handler;
+    have_sound = 1;
+    write_log ("Sound output disabled, capturing only: %d Hz %s\n",
+	       obtainedfreq, currprefs.sound_stereo ? "stereo" : "mono");
     return 1;
 }
 
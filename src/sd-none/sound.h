@@ -6,14 +6,26 @@
   * Copyright 1997 Bernd Schmidt
   */
 
+#include "soundcapture.h"
+
+/* There is no device to play to, but samples are still produced when they
+ * are being captured to a file. */
+extern uae_u16 sndbuffer[];
+extern uae_u16 *sndbufpt;
+extern int sndbufsize;
+
 STATIC_INLINE void check_sound_buffers (void)
 {
+    if ((char *)sndbufpt - (char *)sndbuffer >= sndbufsize) {
+	sound_capture_write (sndbuffer, sndbufsize);
+	sndbufpt = sndbuffer;
+    }
 }
 
 #define AUDIO_NAME "dummyaudio"
 
-#define PUT_SOUND_BYTE(b) do { ; } while (0)
-#define PUT_SOUND_WORD(b) do { ; } while (0)
+#define PUT_SOUND_BYTE(b) do { *(uae_u8 *)sndbufpt = b; sndbufpt = (uae_u16 *)(((uae_u8 *)sndbufpt) + 1); } while (0)
+#define PUT_SOUND_WORD(b) do { *(uae_u16 *)sndbufpt = b; sndbufpt = (uae_u16 *)(((uae_u8 *)sndbufpt) + 2); } while (0)
 #define PUT_SOUND_BYTE_LEFT(b) PUT_SOUND_BYTE(b)
 #define PUT_SOUND_WORD_LEFT(b) PUT_SOUND_WORD(b)
 #define PUT_SOUND_BYTE_RIGHT(b) PUT_SOUND_BYTE(b)
@@ -27,6 +39,8 @@ STATIC_INLINE void check_sound_buffers (void)
 #define DEFAULT_SOUND_FREQ 44100
 #define DEFAULT_SOUND_LATENCY 100
 
+#define HAVE_STEREO_SUPPORT
+
 #define UNSUPPORTED_OPTION_B
 #define UNSUPPORTED_OPTION_R
 #define UNSUPPORTED_OPTION_b
@@ -6,6 +6,8 @@
   * Copyright 1997 Bernd Schmidt
   */
 
+#include "soundcapture.h"
+
 extern int sound_fd;
 extern uae_u16 sndbuffer[];
 extern uae_u16 *sndbufpt;
@@ -24,6 +26,7 @@ STATIC_INLINE void check_sound_buffers (void)
 #ifdef DRIVESOUND
         driveclick_mix ((uae_s16*)sndbuffer, sndbufsize >> 1);
 #endif
+	sound_capture_write (sndbuffer, sndbufsize);
 	finish_sound_buffer ();
 	sndbufpt = sndbuffer;
     }
@@ -7,6 +7,8 @@
   * Copyright 2007       Richard Drummond
   */
 
+#include "soundcapture.h"
+
 extern uae_u16 sndbuffer[];
 extern uae_u16 *sndbufpt;
 extern int sound_fd;
@@ -21,6 +23,7 @@ STATIC_INLINE void flush_sound_buffer (void)
 STATIC_INLINE void check_sound_buffers (void)
 {
     if ((char *)sndbufpt - (char *)sndbuffer >= sndbufsize) {
+	sound_capture_write (sndbuffer, sndbufsize);
 	flush_sound_buffer ();
     }
 }
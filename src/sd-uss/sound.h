@@ -6,6 +6,8 @@
   * Copyright 1997 Bernd Schmidt
   */
 
+#include "soundcapture.h"
+
 extern int sound_fd;
 extern uae_u16 sndbuffer[];
 extern uae_u16 *sndbufpt;
@@ -14,6 +16,7 @@ extern int sndbufsize;
 STATIC_INLINE void check_sound_buffers (void)
 {
     int size = (char *)sndbufpt - (char *)sndbuffer;
+    sound_capture_write (sndbuffer, size);
     write (sound_fd, sndbuffer, size);
     sndbufpt = sndbuffer;
 }
@@ -0,0 +1,622 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Capturing sound output to a WAV or FLAC file
+  *
+  * The sound drivers pass every buffer they output to sound_capture_write().
+  * The samples are queued in a ring buffer from which a writer thread
+  * encodes them and writes them out in large chunks, so the emulation
+  * doesn't wait for the disk unless the ring fills up.
+  *
+  * The FLAC encoder is a simple one: fixed blocks of 4096 samples, channels
+  * coded independently, the best of the fixed predictors for each subframe
+  * and partitioned Rice coding of the residual.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "soundcapture.h"
+#ifdef SUPPORT_THREADS
+# include "threaddep/thread.h"
+#endif
+
+int sound_capture_active;
+
+static FILE *capture_file;
+static char *capture_file_buffer;
+static int capture_format, capture_freq, capture_channels;
+static uae_u64 capture_bytes;
+static int capture_error;
+
+#define CAPTURE_FILE_BUFFER_SIZE 262144
+
+static void capture_fwrite (const void *buf, size_t len)
+{
+    if (capture_error)
+	return;
+    if (fwrite (buf, 1, len, capture_file) != len) {
+	write_log ("Sound capture: write failed, stopping capture.\n");
+	capture_error = 1;
+    }
+}
+
+static void put_le16 (uae_u8 *p, uae_u32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32 (uae_u8 *p, uae_u32 v)
+{
+    put_le16 (p, v);
+    put_le16 (p + 2, v >> 16);
+}
+
+/*
+ * WAV
+ */
+
+static void write_wav_header (void)
+{
+    uae_u8 h[44];
+    uae_u32 data_bytes = capture_bytes > 0xFFFFFFDBu ? 0xFFFFFFDBu : (uae_u32)capture_bytes;
+
+    memcpy (h, "RIFF", 4);
+    put_le32 (h + 4, 36 + data_bytes);
+    memcpy (h + 8, "WAVEfmt ", 8);
+    put_le32 (h + 16, 16);
+    put_le16 (h + 20, 1);
+    put_le16 (h + 22, capture_channels);
+    put_le32 (h + 24, capture_freq);
+    put_le32 (h + 28, capture_freq * capture_channels * 2);
+    put_le16 (h + 32, capture_channels * 2);
+    put_le16 (h + 34, 16);
+    memcpy (h + 36, "data", 4);
+    put_le32 (h + 40, data_bytes);
+    capture_fwrite (h, sizeof h);
+}
+
+static void wav_output (const uae_u8 *data, int len)
+{
+#ifdef WORDS_BIGENDIAN
+    uae_u8 tmp[4096];
+
+    while (len > 0) {
+	int n = len < (int)sizeof tmp ? len : (int)sizeof tmp;
+	int i;
+	for (i = 0; i < n; i += 2) {
+	    tmp[i] = data[i + 1];
+	    tmp[i + 1] = data[i];
+	}
+	capture_fwrite (tmp, n);
+	data += n;
+	len -= n;
+    }
+#else
+    capture_fwrite (data, len);
+#endif
+}
+
+/*
+ * FLAC
+ */
+
+#define FLAC_BLOCK_SIZE 4096
+#define FLAC_MAX_PARTITION_ORDER 6
+#define FLAC_MAX_RICE_PARAM 14
+#define FLAC_MAX_FRAME_BYTES (32 + 2 * (FLAC_BLOCK_SIZE * 2 + 8))
+
+struct bitwriter {
+    uae_u8 *buf;
+    int pos, bits;
+    uae_u64 acc;
+};
+
+static uae_s16 flac_block[FLAC_BLOCK_SIZE * 2];
+static int flac_block_bytes;
+static uae_u32 flac_frame_number;
+static uae_u8 *flac_frame;
+static uae_u8 crc8_table[256];
+static uae_u16 crc16_table[256];
+
+static void init_crc_tables (void)
+{
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+	unsigned int c8 = i, c16 = i << 8;
+	for (j = 0; j < 8; j++) {
+	    c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+	    c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+	}
+	crc8_table[i] = c8;
+	crc16_table[i] = c16;
+    }
+}
+
+static uae_u8 crc8 (const uae_u8 *p, int len)
+{
+    uae_u8 crc = 0;
+    while (len-- > 0)
+	crc = crc8_table[crc ^ *p++];
+    return crc;
+}
+
+static uae_u16 crc16 (const uae_u8 *p, int len)
+{
+    uae_u16 crc = 0;
+    while (len-- > 0)
+	crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+    return crc;
+}
+
+STATIC_INLINE void put_bits (struct bitwriter *bw, uae_u32 v, int n)
+{
+    bw->acc = (bw->acc << n) | (v & (((uae_u64)1 << n) - 1));
+    bw->bits += n;
+    while (bw->bits >= 8) {
+	bw->bits -= 8;
+	bw->buf[bw->pos++] = (uae_u8)(bw->acc >> bw->bits);
+    }
+}
+
+static void align_bits (struct bitwriter *bw)
+{
+    if (bw->bits)
+	put_bits (bw, 0, 8 - bw->bits);
+}
+
+static void write_flac_header (void)
+{
+    uae_u8 h[42];
+    struct bitwriter bw = { h, 0, 0, 0 };
+
+    memcpy (h, "fLaC", 4);
+    bw.pos = 4;
+    /* Last metadata block, STREAMINFO, 34 bytes. */
+    put_bits (&bw, 0x80, 8);
+    put_bits (&bw, 34, 24);
+    put_bits (&bw, FLAC_BLOCK_SIZE, 16);
+    put_bits (&bw, FLAC_BLOCK_SIZE, 16);
+    put_bits (&bw, 0, 24);
+    put_bits (&bw, 0, 24);
+    put_bits (&bw, capture_freq, 20);
+    put_bits (&bw, capture_channels - 1, 3);
+    put_bits (&bw, 16 - 1, 5);
+    {
+	uae_u64 frames = capture_bytes / (2 * capture_channels);
+	put_bits (&bw, (uae_u32)(frames >> 32) & 15, 4);
+	put_bits (&bw, (uae_u32)frames, 32);
+    }
+    /* No MD5 signature. */
+    memset (h + bw.pos, 0, 16);
+    capture_fwrite (h, sizeof h);
+}
+
+/* Residual of the fixed predictor of ORDER at sample I. */
+STATIC_INLINE int fixed_residual (const int *x, int i, int order)
+{
+    switch (order) {
+    case 0: return x[i];
+    case 1: return x[i] - x[i - 1];
+    case 2: return x[i] - 2 * x[i - 1] + x[i - 2];
+    case 3: return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+    default: return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+    }
+}
+
+STATIC_INLINE uae_u32 zigzag (int r)
+{
+    return ((uae_u32)r << 1) ^ (uae_u32)(r >> 31);
+}
+
+/* Estimated bits for CNT residuals summing to SUM (folded) with Rice
+ * parameter K; never less than the real size. */
+STATIC_INLINE uae_u64 rice_bits (uae_u64 sum, int cnt, int k)
+{
+    return (uae_u64)cnt * (k + 1) + (sum >> k);
+}
+
+static int best_rice_param (uae_u64 sum, int cnt, uae_u64 *bits)
+{
+    int k, best_k = 0;
+    uae_u64 best = rice_bits (sum, cnt, 0);
+
+    for (k = 1; k <= FLAC_MAX_RICE_PARAM; k++) {
+	uae_u64 b = rice_bits (sum, cnt, k);
+	if (b < best) {
+	    best = b;
+	    best_k = k;
+	}
+    }
+    *bits = best;
+    return best_k;
+}
+
+static void encode_subframe (struct bitwriter *bw, const int *x, int n)
+{
+    static uae_u32 res[FLAC_BLOCK_SIZE];
+    uae_u64 psum[1 << FLAC_MAX_PARTITION_ORDER];
+    uae_u64 best_bits, order_sum[5];
+    int params[1 << FLAC_MAX_PARTITION_ORDER];
+    int order, best_order, porder, best_porder, i, p;
+
+    for (i = 1; i < n && x[i] == x[0]; i++)
+	;
+    if (i == n) {
+	put_bits (bw, 0x00, 8);
+	put_bits (bw, x[0], 16);
+	return;
+    }
+
+    best_order = 0;
+    for (order = 0; order <= 4 && order < n; order++) {
+	order_sum[order] = 0;
+	for (i = order; i < n; i++) {
+	    int r = fixed_residual (x, i, order);
+	    order_sum[order] += r < 0 ? -r : r;
+	}
+	if (order_sum[order] < order_sum[best_order])
+	    best_order = order;
+    }
+    order = best_order;
+    for (i = order; i < n; i++)
+	res[i] = zigzag (fixed_residual (x, i, order));
+
+    /* Pick the partition order: sums for the finest split first, then
+     * merge pairs of partitions going up. */
+    porder = 0;
+    while (porder < FLAC_MAX_PARTITION_ORDER && (n & ((1 << (porder + 1)) - 1)) == 0
+	   && (n >> (porder + 1)) > order)
+	porder++;
+    for (p = 0; p < 1 << porder; p++) {
+	int start = p == 0 ? order : p * (n >> porder);
+	int end = (p + 1) * (n >> porder);
+	psum[p] = 0;
+	for (i = start; i < end; i++)
+	    psum[p] += res[i];
+    }
+    best_bits = ~(uae_u64)0;
+    best_porder = 0;
+    for (;;) {
+	uae_u64 bits = 0, b;
+	for (p = 0; p < 1 << porder; p++) {
+	    int cnt = (n >> porder) - (p == 0 ? order : 0);
+	    best_rice_param (psum[p], cnt, &b);
+	    bits += 4 + b;
+	}
+	if (bits < best_bits) {
+	    best_bits = bits;
+	    best_porder = porder;
+	}
+	if (porder == 0)
+	    break;
+	for (p = 0; p < 1 << (porder - 1); p++)
+	    psum[p] = psum[2 * p] + psum[2 * p + 1];
+	porder--;
+    }
+
+    if (order * 16 + 6 + best_bits >= (uae_u64)n * 16) {
+	put_bits (bw, 0x02, 8);
+	for (i = 0; i < n; i++)
+	    put_bits (bw, x[i], 16);
+	return;
+    }
+
+    porder = best_porder;
+    for (p = 0; p < 1 << porder; p++) {
+	int start = p == 0 ? order : p * (n >> porder);
+	int end = (p + 1) * (n >> porder);
+	uae_u64 sum = 0, b;
+	for (i = start; i < end; i++)
+	    sum += res[i];
+	params[p] = best_rice_param (sum, end - start, &b);
+    }
+
+    put_bits (bw, (0x08 | order) << 1, 8);
+    for (i = 0; i < order; i++)
+	put_bits (bw, x[i], 16);
+    put_bits (bw, 0, 2);
+    put_bits (bw, porder, 4);
+    for (p = 0; p < 1 << porder; p++) {
+	int start = p == 0 ? order : p * (n >> porder);
+	int end = (p + 1) * (n >> porder);
+	int k = params[p];
+	put_bits (bw, k, 4);
+	for (i = start; i < end; i++) {
+	    uae_u32 q = res[i] >> k;
+	    while (q >= 32) {
+		put_bits (bw, 0, 32);
+		q -= 32;
+	    }
+	    if (q)
+		put_bits (bw, 0, q);
+	    put_bits (bw, (1 << k) | (res[i] & ((1 << k) - 1)), k + 1);
+	}
+    }
+}
+
+static void encode_flac_frame (int n)
+{
+    static int x[FLAC_BLOCK_SIZE];
+    struct bitwriter bw = { flac_frame, 0, 0, 0 };
+    uae_u32 fn = flac_frame_number++;
+    uae_u16 crc;
+    int ch, i;
+
+    put_bits (&bw, 0x3FFE, 14);
+    put_bits (&bw, 0, 2);
+    put_bits (&bw, n == FLAC_BLOCK_SIZE ? 12 : 7, 4);
+    put_bits (&bw, 0, 4);
+    put_bits (&bw, capture_channels - 1, 4);
+    put_bits (&bw, 4, 3);
+    put_bits (&bw, 0, 1);
+    /* Frame number, UTF-8 style. */
+    if (fn < 0x80) {
+	put_bits (&bw, fn, 8);
+    } else {
+	int extra = fn < 0x800 ? 1 : fn < 0x10000 ? 2 : fn < 0x200000 ? 3 : fn < 0x4000000 ? 4 : 5;
+	put_bits (&bw, ((1 << (extra + 1)) - 1) << 1, extra + 2);
+	put_bits (&bw, fn >> (6 * extra), 6 - extra);
+	for (i = extra - 1; i >= 0; i--)
+	    put_bits (&bw, 0x80 | ((fn >> (6 * i)) & 0x3F), 8);
+    }
+    if (n != FLAC_BLOCK_SIZE)
+	put_bits (&bw, n - 1, 16);
+    put_bits (&bw, crc8 (flac_frame, bw.pos), 8);
+
+    for (ch = 0; ch < capture_channels; ch++) {
+	for (i = 0; i < n; i++)
+	    x[i] = flac_block[i * capture_channels + ch];
+	encode_subframe (&bw, x, n);
+    }
+    align_bits (&bw);
+    crc = crc16 (flac_frame, bw.pos);
+    put_bits (&bw, crc, 16);
+    capture_fwrite (flac_frame, bw.pos);
+}
+
+static void flac_output (const uae_u8 *data, int len)
+{
+    while (len > 0) {
+	int n = sizeof flac_block - flac_block_bytes;
+	if (n > len)
+	    n = len;
+	memcpy ((uae_u8 *)flac_block + flac_block_bytes, data, n);
+	flac_block_bytes += n;
+	data += n;
+	len -= n;
+	if (flac_block_bytes == (int)(FLAC_BLOCK_SIZE * 2 * capture_channels)) {
+	    encode_flac_frame (FLAC_BLOCK_SIZE);
+	    flac_block_bytes = 0;
+	}
+    }
+}
+
+/*
+ * Queueing
+ */
+
+static void capture_output (const uae_u8 *data, int len)
+{
+    capture_bytes += len;
+    if (capture_format == SOUND_CAPTURE_FLAC)
+	flac_output (data, len);
+    else
+	wav_output (data, len);
+}
+
+#ifdef SUPPORT_THREADS
+
+/* Same scheme as the ALSA driver's period queue: only the emulation moves
+ * the head and only the writer thread moves the tail. */
+#define RING_SIZE  (1 << 20)
+#define RING_KICK  65536
+
+static uae_u8 *ring_buffer;
+static volatile unsigned int ring_head, ring_tail;
+static volatile int ring_producer_waiting, ring_quit;
+static unsigned int ring_kicked;
+static uae_sem_t ring_data_sem, ring_space_sem;
+static uae_thread_id ring_tid;
+
+#define ring_barrier() __sync_synchronize ()
+
+static void *capture_thread (void *dummy)
+{
+    for (;;) {
+	unsigned int head, tail;
+	int quit;
+
+	uae_sem_wait (&ring_data_sem);
+	ring_barrier ();
+	quit = ring_quit;
+	head = ring_head;
+	tail = ring_tail;
+	while (tail != head) {
+	    unsigned int off = tail & (RING_SIZE - 1);
+	    unsigned int n = head - tail;
+	    if (n > RING_SIZE - off)
+		n = RING_SIZE - off;
+	    capture_output (ring_buffer + off, n);
+	    tail += n;
+	    ring_barrier ();
+	    ring_tail = tail;
+	    ring_barrier ();
+	    if (ring_producer_waiting) {
+		ring_producer_waiting = 0;
+		uae_sem_post (&ring_space_sem);
+	    }
+	}
+	if (quit)
+	    return 0;
+    }
+}
+
+void sound_capture_write_data (const void *buf, int bytes)
+{
+    const uae_u8 *src = buf;
+
+    while (bytes > 0) {
+	unsigned int head = ring_head;
+	unsigned int off = head & (RING_SIZE - 1);
+	unsigned int n = RING_SIZE - (head - ring_tail);
+
+	if (n == 0) {
+	    ring_producer_waiting = 1;
+	    ring_barrier ();
+	    uae_sem_post (&ring_data_sem);
+	    if (RING_SIZE - (head - ring_tail) == 0)
+		uae_sem_wait (&ring_space_sem);
+	    continue;
+	}
+	if (n > RING_SIZE - off)
+	    n = RING_SIZE - off;
+	if (n > (unsigned int)bytes)
+	    n = bytes;
+	memcpy (ring_buffer + off, src, n);
+	ring_barrier ();
+	ring_head = head + n;
+	src += n;
+	bytes -= n;
+    }
+    if (ring_head - ring_kicked >= RING_KICK) {
+	ring_kicked = ring_head;
+	uae_sem_post (&ring_data_sem);
+    }
+}
+
+static int start_capture_thread (void)
+{
+    ring_buffer = malloc (RING_SIZE);
+    if (!ring_buffer)
+	return 0;
+    ring_head = ring_tail = ring_kicked = 0;
+    ring_producer_waiting = ring_quit = 0;
+    uae_sem_init (&ring_data_sem, 0, 0);
+    uae_sem_init (&ring_space_sem, 0, 0);
+    if (!uae_start_thread (capture_thread, NULL, &ring_tid)) {
+	uae_sem_destroy (&ring_data_sem);
+	uae_sem_destroy (&ring_space_sem);
+	free (ring_buffer);
+	ring_buffer = 0;
+	return 0;
+    }
+    return 1;
+}
+
+static void stop_capture_thread (void)
+{
+    ring_quit = 1;
+    ring_barrier ();
+    uae_sem_post (&ring_data_sem);
+    uae_wait_thread (ring_tid);
+    uae_sem_destroy (&ring_data_sem);
+    uae_sem_destroy (&ring_space_sem);
+    free (ring_buffer);
+    ring_buffer = 0;
+}
+
+#else
+
+void sound_capture_write_data (const void *buf, int bytes)
+{
+    capture_output (buf, bytes);
+}
+
+#endif
+
+int sound_capture_start (const char *filename, int format, int freq, int channels)
+{
+    if (sound_capture_active)
+	sound_capture_stop ();
+
+    capture_file = fopen (filename, "wb");
+    if (!capture_file) {
+	write_log ("Sound capture: cannot open '%s'.\n", filename);
+	return 0;
+    }
+    capture_file_buffer = malloc (CAPTURE_FILE_BUFFER_SIZE);
+    if (capture_file_buffer)
+	setvbuf (capture_file, capture_file_buffer, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+    capture_format = format;
+    capture_freq = freq;
+    capture_channels = channels;
+    capture_bytes = 0;
+    capture_error = 0;
+
+    if (format == SOUND_CAPTURE_FLAC) {
+	flac_frame = malloc (FLAC_MAX_FRAME_BYTES);
+	if (!flac_frame)
+	    goto fail;
+	init_crc_tables ();
+	flac_block_bytes = 0;
+	flac_frame_number = 0;
+	write_flac_header ();
+    } else {
+	write_wav_header ();
+    }
+
+#ifdef SUPPORT_THREADS
+    if (!start_capture_thread ())
+	goto fail;
+#endif
+
+    sound_capture_active = 1;
+    write_log ("Sound capture: writing %d Hz %s %s to '%s'.\n", freq,
+	       channels == 2 ? "stereo" : "mono", format == SOUND_CAPTURE_FLAC ? "FLAC" : "WAV",
+	       filename);
+    return 1;
+
+ fail:
+    write_log ("Sound capture: out of memory.\n");
+    fclose (capture_file);
+    capture_file = 0;
+    free (capture_file_buffer);
+    capture_file_buffer = 0;
+    free (flac_frame);
+    flac_frame = 0;
+    return 0;
+}
+
+void sound_capture_stop (void)
+{
+    if (!sound_capture_active)
+	return;
+    sound_capture_active = 0;
+
+#ifdef SUPPORT_THREADS
+    stop_capture_thread ();
+#endif
+
+    /* Whole frames only, then go back and fill in the length. */
+    if (capture_format == SOUND_CAPTURE_FLAC) {
+	int frame_bytes = 2 * capture_channels;
+	capture_bytes -= flac_block_bytes % frame_bytes;
+	if (flac_block_bytes / frame_bytes > 0)
+	    encode_flac_frame (flac_block_bytes / frame_bytes);
+	if (!capture_error && fseek (capture_file, 0, SEEK_SET) == 0)
+	    write_flac_header ();
+	free (flac_frame);
+	flac_frame = 0;
+    } else {
+	capture_bytes -= capture_bytes % (2 * capture_channels);
+	if (!capture_error && fseek (capture_file, 0, SEEK_SET) == 0)
+	    write_wav_header ();
+    }
+
+    fclose (capture_file);
+    capture_file = 0;
+    free (capture_file_buffer);
+    capture_file_buffer = 0;
+    write_log ("Sound capture: %lu frames written.\n",
+	       (unsigned long)(capture_bytes / (2 * capture_channels)));
+}
+
+int sound_capture_matches (int freq, int channels)
+{
+    return sound_capture_active && capture_freq == freq && capture_channels == channels;
+}
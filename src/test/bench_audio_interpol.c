@@ -0,0 +1,251 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Benchmark for the audio interpolators.
+  *
+  * Plays four channels of random samples at fixed periods through the same
+  * event loop as update_audio() and reports the time taken per output
+  * sample for each interpolation mode. The sinc interpolator is run both
+  * with the queue in sincqueue.h and with the array that is aged and
+  * memmove()d on every change, as audio.c used to do it, and the two are
+  * checked to produce identical output.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sincqueue.h"
+#include "sinctable.c"
+
+/* Roughly 3.5 MHz / 44100 Hz. */
+#define SAMPLE_EVTIME	 80
+#define BENCH_SAMPLES	 100000
+
+struct bench_channel {
+    unsigned int per, evtime;
+    int current, last, vol;
+    /* sinc state */
+    int output_state;
+    struct sinc_queue queue;
+    struct { int age, output; } old_queue[SINC_QUEUE_LENGTH];
+    int old_queue_length;
+};
+
+static struct bench_channel channel[4];
+static unsigned int next_sample, seed;
+static int out_ref[BENCH_SAMPLES], out_new[BENCH_SAMPLES];
+
+static int random_sample (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (uae_s8)(seed >> 16);
+}
+
+static void reset_channels (unsigned int min_per, unsigned int max_per)
+{
+    int i;
+
+    seed = 1;
+    memset (channel, 0, sizeof channel);
+    for (i = 0; i < 4; i++) {
+	channel[i].per = min_per + (max_per - min_per) * i / 3;
+	channel[i].evtime = channel[i].per;
+	channel[i].vol = 64 - i * 8;
+    }
+    next_sample = SAMPLE_EVTIME;
+}
+
+static int mix_none (void)
+{
+    int i, data = 0;
+
+    for (i = 0; i < 4; i++)
+	data += channel[i].current * channel[i].vol;
+    return data;
+}
+
+static int mix_rh (void)
+{
+    int i, data = 0;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	unsigned long ratio = ((c->evtime % c->per) << 8) / c->per;
+	data += (c->current * c->vol * (int)(256 - ratio) + c->last * c->vol * (int)ratio) >> 8;
+    }
+    return data;
+}
+
+static int mix_crux (void)
+{
+    int i, data = 0;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	unsigned long ratio1 = c->per - c->evtime;
+	unsigned long ratio = (ratio1 << 12) / (SAMPLE_EVTIME * 3);
+	if (c->evtime < SAMPLE_EVTIME || ratio1 >= SAMPLE_EVTIME * 3)
+	    ratio = 4096;
+	data += (c->current * c->vol * (int)ratio + c->last * c->vol * (int)(4096 - ratio)) >> 12;
+    }
+    return data;
+}
+
+static void sinc_old_pre (unsigned int dt)
+{
+    int i, j;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	int output = c->current * c->vol;
+
+	for (j = 0; j < c->old_queue_length; j++) {
+	    c->old_queue[j].age += dt;
+	    if (c->old_queue[j].age >= SINC_QUEUE_MAX_AGE) {
+		c->old_queue_length = j;
+		break;
+	    }
+	}
+	if (c->output_state != output) {
+	    if (c->old_queue_length > SINC_QUEUE_LENGTH - 1)
+		c->old_queue_length = SINC_QUEUE_LENGTH - 1;
+	    memmove (&c->old_queue[1], &c->old_queue[0], sizeof c->old_queue[0] * c->old_queue_length);
+	    c->old_queue_length++;
+	    c->old_queue[0].age = dt;
+	    c->old_queue[0].output = output - c->output_state;
+	    c->output_state = output;
+	}
+    }
+}
+
+static int sinc_old_mix (void)
+{
+    int i, j, data = 0;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	int sum = c->output_state << 17;
+	for (j = 0; j < c->old_queue_length; j++)
+	    sum -= winsinc_integral[0][c->old_queue[j].age] * c->old_queue[j].output;
+	data += sum >> 17;
+    }
+    return data;
+}
+
+static void sinc_new_pre (unsigned int dt)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	int output = c->current * c->vol;
+
+	sinc_queue_advance (&c->queue, dt);
+	if (c->output_state != output) {
+	    sinc_queue_push (&c->queue, output - c->output_state, dt);
+	    c->output_state = output;
+	}
+    }
+}
+
+static int sinc_new_mix (void)
+{
+    int i, data = 0;
+
+    for (i = 0; i < 4; i++) {
+	struct bench_channel *c = &channel[i];
+	int sum = c->output_state << 17;
+	sum -= sinc_queue_mix (&c->queue, winsinc_integral[0]);
+	data += sum >> 17;
+    }
+    return data;
+}
+
+/* The event loop of update_audio(), with audio_handler() replaced by
+ * fetching a new random sample. */
+static void play (void (*pre) (unsigned int), int (*mix) (void), int *out)
+{
+    int n = 0, i;
+
+    while (n < BENCH_SAMPLES) {
+	unsigned int best = next_sample;
+
+	for (i = 0; i < 4; i++)
+	    if (channel[i].evtime < best)
+		best = channel[i].evtime;
+	for (i = 0; i < 4; i++)
+	    channel[i].evtime -= best;
+	next_sample -= best;
+
+	if (pre)
+	    pre (best);
+	if (next_sample == 0) {
+	    next_sample = SAMPLE_EVTIME;
+	    out[n++] = mix ();
+	}
+
+	for (i = 0; i < 4; i++) {
+	    if (channel[i].evtime == 0) {
+		channel[i].last = channel[i].current;
+		channel[i].current = random_sample ();
+		channel[i].evtime = channel[i].per;
+	    }
+	}
+    }
+}
+
+static double time_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double bench_one (unsigned int min_per, unsigned int max_per,
+			 void (*pre) (unsigned int), int (*mix) (void), int *out)
+{
+    double start;
+
+    reset_channels (min_per, max_per);
+    start = time_now ();
+    play (pre, mix, out);
+    return (time_now () - start) * 1000000000.0 / BENCH_SAMPLES;
+}
+
+int main (int argc, char *argv[])
+{
+    static const unsigned int periods[][2] = {
+	{ 124, 428 }, { MIN_ALLOWED_PERIOD, 64 }
+    };
+    static int scratch[BENCH_SAMPLES];
+    unsigned int p;
+    int num_fails = 0;
+
+    printf ("%-10s %10s %10s %10s %10s %10s\n", "periods", "none ns", "rh ns", "crux ns",
+	    "sinc old", "sinc ns");
+
+    for (p = 0; p < sizeof periods / sizeof periods[0]; p++) {
+	unsigned int lo = periods[p][0], hi = periods[p][1];
+	double t_none = bench_one (lo, hi, NULL, mix_none, scratch);
+	double t_rh = bench_one (lo, hi, NULL, mix_rh, scratch);
+	double t_crux = bench_one (lo, hi, NULL, mix_crux, scratch);
+	double t_old = bench_one (lo, hi, sinc_old_pre, sinc_old_mix, out_ref);
+	double t_new = bench_one (lo, hi, sinc_new_pre, sinc_new_mix, out_new);
+	char name[16];
+
+	sprintf (name, "%u-%u", lo, hi);
+	if (memcmp (out_ref, out_new, sizeof out_ref) != 0) {
+	    printf ("%-10s sinc output mismatch\n", name);
+	    num_fails++;
+	    continue;
+	}
+	printf ("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, t_none, t_rh, t_crux, t_old, t_new);
+    }
+
+    return num_fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
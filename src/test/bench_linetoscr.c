@@ -0,0 +1,149 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Benchmark for the generated line-to-screen converters.
+  *
+  * Runs every linetoscr_* variant over synthetic pixel data, checks that
+  * the vector converters produce the same output as the scalar ones and
+  * reports the time taken per line.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef USE_VECTOR_LINETOSCR
+# define USE_VECTOR_LINETOSCR
+#endif
+
+#include "options.h"
+#include "uae.h"
+#include "memory.h"
+#include "custom.h"
+#include "xwin.h"
+#include "drawing.h"
+
+#define BENCH_PIXELS	 (MAX_PIXELS_PER_LINE - 16)
+#define BENCH_ITERATIONS 20000
+
+/* The drawing.c state the generated converters refer to. */
+xcolnr xcolors[4096];
+unsigned int xredcolors[256], xgreencolors[256], xbluecolors[256];
+struct color_entry colors_for_drawing;
+uae_u8 *xlinebuffer;
+
+static union {
+    uae_u8 apixels[MAX_PIXELS_PER_LINE * 2];
+    uae_u32 apixels_l[MAX_PIXELS_PER_LINE * 2 / 4];
+} pixdata;
+
+static uae_u32 ham_linebuf[MAX_PIXELS_PER_LINE * 2];
+static uae_u8 spriteagadpfpixels[MAX_PIXELS_PER_LINE * 2];
+static int dblpf_ind1[256], dblpf_ind2[256];
+static int dblpf_2nd1[256], dblpf_2nd2[256];
+static int dblpf_ind1_aga[256], dblpf_ind2_aga[256];
+static int dblpfofs[] = { 0, 2, 4, 8, 16, 32, 64, 128 };
+static int bplehb, bpldualpf, bpldualpfpri, bpldualpf2of;
+
+static struct decision decision;
+static struct decision *dp_for_drawing = &decision;
+
+#include "linetoscr.c"
+
+typedef int (*linetoscr_func) (int, int, int);
+
+struct bench_variant {
+    const char *name;
+    int pixbytes;
+    int dst_pixels;
+    linetoscr_func scalar;
+    linetoscr_func vector;
+};
+
+static const struct bench_variant variants[] = {
+    { "16",             2, BENCH_PIXELS,     linetoscr_16,             linetoscr_16_vec },
+    { "16_stretch1",    2, BENCH_PIXELS * 2, linetoscr_16_stretch1,    linetoscr_16_stretch1_vec },
+    { "16_shrink1",     2, BENCH_PIXELS / 2, linetoscr_16_shrink1,     linetoscr_16_shrink1_vec },
+    { "32",             4, BENCH_PIXELS,     linetoscr_32,             linetoscr_32_vec },
+    { "32_stretch1",    4, BENCH_PIXELS * 2, linetoscr_32_stretch1,    linetoscr_32_stretch1_vec },
+    { "32_shrink1",     4, BENCH_PIXELS / 2, linetoscr_32_shrink1,     linetoscr_32_shrink1_vec },
+#ifdef AGA
+    { "16_aga",         2, BENCH_PIXELS,     linetoscr_16_aga,         linetoscr_16_aga_vec },
+    { "16_stretch1_aga",2, BENCH_PIXELS * 2, linetoscr_16_stretch1_aga,linetoscr_16_stretch1_aga_vec },
+    { "16_shrink1_aga", 2, BENCH_PIXELS / 2, linetoscr_16_shrink1_aga, linetoscr_16_shrink1_aga_vec },
+    { "32_aga",         4, BENCH_PIXELS,     linetoscr_32_aga,         linetoscr_32_aga_vec },
+    { "32_stretch1_aga",4, BENCH_PIXELS * 2, linetoscr_32_stretch1_aga,linetoscr_32_stretch1_aga_vec },
+    { "32_shrink1_aga", 4, BENCH_PIXELS / 2, linetoscr_32_shrink1_aga, linetoscr_32_shrink1_aga_vec },
+#endif
+};
+
+static double time_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double bench_one (linetoscr_func f, int dst_pixels)
+{
+    double start = time_now ();
+    int i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+	f (0, 1, dst_pixels);
+    return (time_now () - start) * 1000000000.0 / BENCH_ITERATIONS;
+}
+
+int main (int argc, char *argv[])
+{
+    static uae_u8 ref[MAX_PIXELS_PER_LINE * 2 * 4 * 2];
+    static uae_u8 out[MAX_PIXELS_PER_LINE * 2 * 4 * 2];
+    unsigned int i;
+    int num_fails = 0;
+
+    srand (1);
+    for (i = 0; i < sizeof pixdata.apixels; i++)
+	pixdata.apixels[i] = rand () & 0x1f;
+#ifdef AGA
+    decision.bplcon4 = 0x0a00;
+#endif
+
+    printf ("%-16s %12s %12s %8s\n", "variant", "scalar ns", "vector ns", "speedup");
+
+    for (i = 0; i < sizeof variants / sizeof variants[0]; i++) {
+	const struct bench_variant *v = &variants[i];
+	size_t bytes = (v->dst_pixels + 1) * v->pixbytes;
+	double t_scalar, t_vector;
+	unsigned int j;
+
+	/* At 16 bpp the colour table holds each pixel value twice. */
+	for (j = 0; j < sizeof colors_for_drawing.acolors / sizeof (xcolnr); j++) {
+	    uae_u32 c = ((uae_u32) rand () << 16) ^ rand ();
+	    colors_for_drawing.acolors[j] = v->pixbytes == 2 ? (c << 16) | (c & 0xffff) : c;
+	}
+
+	/* Start one pixel in to exercise the unaligned head. */
+	memset (ref, 0, sizeof ref);
+	xlinebuffer = ref;
+	v->scalar (0, 1, v->dst_pixels);
+	memset (out, 0, sizeof out);
+	xlinebuffer = out;
+	v->vector (0, 1, v->dst_pixels);
+	if (memcmp (ref, out, bytes) != 0) {
+	    printf ("%-16s output mismatch\n", v->name);
+	    num_fails++;
+	    continue;
+	}
+
+	bench_one (v->scalar, v->dst_pixels);
+	t_scalar = bench_one (v->scalar, v->dst_pixels);
+	t_vector = bench_one (v->vector, v->dst_pixels);
+	printf ("%-16s %12.1f %12.1f %7.2fx\n", v->name, t_scalar, t_vector, t_scalar / t_vector);
+    }
+
+    return num_fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
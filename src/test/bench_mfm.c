@@ -0,0 +1,278 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Test and benchmark for the MFM coder.
+  *
+  * Runs the routines in mfm.c and the loops disk.c used before them over
+  * random data of random lengths and bit offsets, checks that they agree
+  * and that decoding gives back what was encoded, and reports how many
+  * MB of sector data each version gets through per second.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "mfm.c"
+
+#define FUZZ_ROUNDS	 20000
+#define BENCH_SECTORS	 20000
+
+static unsigned int seed = 1;
+
+static unsigned int random_word (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0xffff;
+}
+
+static void random_bytes (uae_u8 *p, unsigned int len)
+{
+    while (len--)
+	*p++ = random_word ();
+}
+
+/* The old scalar versions from disk.c */
+
+static void old_mfmcode (uae_u16 *mfm, unsigned int words, uae_u16 prev)
+{
+    uae_u32 lastword = prev;
+    while (words--) {
+	uae_u32 v = *mfm;
+	uae_u32 lv = (lastword << 16) | v;
+	uae_u32 nlv = 0x55555555 & ~lv;
+	uae_u32 mfmbits = (nlv << 1) & (nlv >> 1);
+	*mfm++ = v | mfmbits;
+	lastword = v;
+    }
+}
+
+static const uae_u8 mfmencodetable[16] = {
+    0x2a, 0x29, 0x24, 0x25, 0x12, 0x11, 0x14, 0x15,
+    0x4a, 0x49, 0x44, 0x45, 0x52, 0x51, 0x54, 0x55
+};
+
+static uae_u16 old_encode_byte (uae_u8 byte)
+{
+    uae_u16 word = mfmencodetable[byte >> 4] << 8 | mfmencodetable[byte & 15];
+    return (word | ((word & (256 | 64)) ? 0 : 128));
+}
+
+static void old_mfmcoder (const uae_u8 *src, uae_u16 *dest, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+	*dest = old_encode_byte (*src++);
+	*dest |= ((dest[-1] & 1) || (*dest & 0x4000)) ? 0 : 0x8000;
+	dest++;
+    }
+}
+
+static uae_u32 old_encode_oddeven (const uae_u8 *src, uae_u16 *odd, uae_u16 *even, unsigned int longs)
+{
+    uae_u32 dck = 0;
+    unsigned int i;
+
+    for (i = 0; i < longs; i++) {
+	uae_u32 deven = (src[i * 4] << 24) | (src[i * 4 + 1] << 16) | (src[i * 4 + 2] << 8) | src[i * 4 + 3];
+	uae_u32 dodd = (deven >> 1) & 0x55555555;
+	deven &= 0x55555555;
+	odd[i * 2] = dodd >> 16;
+	odd[i * 2 + 1] = dodd;
+	even[i * 2] = deven >> 16;
+	even[i * 2 + 1] = deven;
+	dck ^= dodd ^ deven;
+    }
+    return dck;
+}
+
+static uae_u16 getmfmword (const uae_u16 *mbuf, unsigned int shift)
+{
+    return (mbuf[0] << shift) | (mbuf[1] >> (16 - shift));
+}
+
+static uae_u32 getmfmlong (const uae_u16 *mbuf, unsigned int shift)
+{
+    return ((getmfmword (mbuf, shift) << 16) | getmfmword (mbuf + 1, shift)) & 0x55555555;
+}
+
+static uae_u32 old_decode_oddeven (const uae_u16 *odd, const uae_u16 *even, unsigned int shift,
+				   uae_u8 *dst, unsigned int longs)
+{
+    uae_u32 chksum = 0;
+    unsigned int i;
+
+    for (i = 0; i < longs; i++) {
+	uae_u32 o = getmfmlong (odd + i * 2, shift);
+	uae_u32 e = getmfmlong (even + i * 2, shift);
+	uae_u32 dlong = (o << 1) | e;
+	*dst++ = dlong >> 24;
+	*dst++ = dlong >> 16;
+	*dst++ = dlong >> 8;
+	*dst++ = dlong;
+	chksum ^= o ^ e;
+    }
+    return chksum;
+}
+
+static uae_u8 old_decode_word (uae_u16 mfm)
+{
+    uae_u8 out = 0;
+    unsigned int i;
+
+    mfm &= 0x5555;
+    for (i = 0; i < 8; i++) {
+	out >>= 1;
+	if (mfm & 1)
+	    out |= 0x80;
+	mfm >>= 2;
+    }
+    return out;
+}
+
+/* Shift the words of SRC right by SHIFT bits into DST, as if the track
+ * started SHIFT bits early. */
+static void shift_words (const uae_u16 *src, uae_u16 *dst, unsigned int words, unsigned int shift)
+{
+    unsigned int i;
+
+    dst[0] = random_word () << (16 - shift);
+    for (i = 0; i < words; i++) {
+	dst[i] |= shift ? src[i] >> shift : src[i];
+	dst[i + 1] = shift ? src[i] << (16 - shift) : 0;
+    }
+    dst[words] |= random_word () >> shift;
+}
+
+static int fuzz (void)
+{
+    static uae_u8 data[1100], out_ref[1100], out_new[1100];
+    static uae_u16 mfm_ref[1100], mfm_new[1100], odd[600], even[600], sodd[600], seven[600];
+    int round, fails = 0;
+
+    for (round = 0; round < FUZZ_ROUNDS && fails < 10; round++) {
+	unsigned int len = random_word () % 1024;
+	unsigned int longs = random_word () % 260;
+	unsigned int shift = random_word () % 16;
+	uae_u16 prev = random_word ();
+	uae_u32 ck_ref, ck_new;
+	unsigned int i;
+
+	random_bytes (data, sizeof data);
+
+	for (i = 0; i < len; i++)
+	    mfm_ref[i + 1] = mfm_new[i + 1] = random_word () & 0x5555;
+	old_mfmcode (mfm_ref + 1, len, prev);
+	mfm_clock (mfm_new + 1, len, prev);
+	if (memcmp (mfm_ref + 1, mfm_new + 1, len * 2)) {
+	    printf ("mfm_clock mismatch, %u words\n", len);
+	    fails++;
+	}
+
+	mfm_ref[0] = mfm_new[0] = prev;
+	old_mfmcoder (data, mfm_ref + 1, len);
+	mfm_encode_bytes (data, mfm_new + 1, len, prev);
+	if (memcmp (mfm_ref + 1, mfm_new + 1, len * 2)) {
+	    printf ("mfm_encode_bytes mismatch, %u bytes\n", len);
+	    fails++;
+	}
+	for (i = 0; i < len; i++) {
+	    if (mfm_decode_word (mfm_new[i + 1]) != data[i] || old_decode_word (mfm_new[i + 1]) != data[i]) {
+		printf ("mfm_decode_word mismatch, byte %u\n", i);
+		fails++;
+		break;
+	    }
+	}
+
+	ck_ref = old_encode_oddeven (data, mfm_ref, mfm_ref + 550, longs);
+	ck_new = mfm_encode_oddeven (data, odd, even, longs);
+	if (ck_ref != ck_new || memcmp (mfm_ref, odd, longs * 4) || memcmp (mfm_ref + 550, even, longs * 4)) {
+	    printf ("mfm_encode_oddeven mismatch, %u longs\n", longs);
+	    fails++;
+	}
+
+	shift_words (odd, sodd, longs * 2, shift);
+	shift_words (even, seven, longs * 2, shift);
+	ck_ref = old_decode_oddeven (sodd, seven, shift, out_ref, longs);
+	ck_new = mfm_decode_oddeven (sodd, seven, shift, out_new, longs);
+	if (ck_ref != ck_new || memcmp (out_ref, out_new, longs * 4) || memcmp (out_new, data, longs * 4)) {
+	    printf ("mfm_decode_oddeven mismatch, %u longs, shift %u\n", longs, shift);
+	    fails++;
+	}
+	if (ck_new != mfm_encode_oddeven (data, odd, even, longs)) {
+	    printf ("mfm_decode_oddeven checksum differs from encoder, %u longs\n", longs);
+	    fails++;
+	}
+    }
+    return fails;
+}
+
+static double time_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uae_u32 sink;
+
+/* Encode and decode the data part of BENCH_SECTORS AmigaDOS sectors the
+ * way disk.c does, old or new. */
+static void bench (int new, double *enc, double *dec)
+{
+    static uae_u8 data[512], out[512];
+    static uae_u16 mfm[1 + 512 + 1];
+    double start;
+    int n;
+
+    random_bytes (data, sizeof data);
+
+    start = time_now ();
+    for (n = 0; n < BENCH_SECTORS; n++) {
+	data[0] = n;
+	if (new) {
+	    sink ^= mfm_encode_oddeven (data, mfm + 1, mfm + 257, 128);
+	    mfm_clock (mfm + 1, 512, 0);
+	} else {
+	    sink ^= old_encode_oddeven (data, mfm + 1, mfm + 257, 128);
+	    old_mfmcode (mfm + 1, 512, 0);
+	}
+    }
+    *enc = BENCH_SECTORS * 512.0 / (time_now () - start) / 1000000.0;
+
+    start = time_now ();
+    for (n = 0; n < BENCH_SECTORS; n++) {
+	unsigned int shift = n & 15;
+	if (new)
+	    sink ^= mfm_decode_oddeven (mfm + 1, mfm + 257, shift, out, 128);
+	else
+	    sink ^= old_decode_oddeven (mfm + 1, mfm + 257, shift, out, 128);
+	sink ^= out[n & 511];
+    }
+    *dec = BENCH_SECTORS * 512.0 / (time_now () - start) / 1000000.0;
+}
+
+int main (int argc, char *argv[])
+{
+    double old_enc, old_dec, new_enc, new_dec;
+    int fails = fuzz ();
+
+    if (fails) {
+	printf ("%d mismatches\n", fails);
+	return EXIT_FAILURE;
+    }
+    printf ("fuzz: %d rounds ok\n", FUZZ_ROUNDS);
+
+    bench (0, &old_enc, &old_dec);
+    bench (1, &new_enc, &new_dec);
+    printf ("%-6s %12s %12s\n", "", "encode MB/s", "decode MB/s");
+    printf ("%-6s %12.1f %12.1f\n", "old", old_enc, old_dec);
+    printf ("%-6s %12.1f %12.1f\n", "new", new_enc, new_dec);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,298 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Benchmark for the Picasso96 board operations in p96blit.c.
+  *
+  * Runs each operation over a 1024x768 screen-sized buffer, checks the
+  * result against a straightforward per-pixel/per-byte version of the same
+  * operation (as picasso96.c used to do it) and reports the time taken for
+  * both.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "p96blit.c"
+
+#define BENCH_WIDTH	 1024
+#define BENCH_HEIGHT	 768
+#define BENCH_BPR	 (BENCH_WIDTH * 4 + 64)
+#define BENCH_ITERATIONS 50
+
+static uae_u8 buf_ref[BENCH_BPR * BENCH_HEIGHT];
+static uae_u8 buf_out[BENCH_BPR * BENCH_HEIGHT];
+static uae_u8 buf_src[BENCH_BPR * BENCH_HEIGHT];
+static uae_u8 planar[8][BENCH_WIDTH / 8 * BENCH_HEIGHT + 2];
+
+/* The operation being measured. */
+static int op_bpp, op_pen, op_minterm, op_mask, op_depth, op_drawmode, op_invert;
+
+static void fill_ref (uae_u8 *dst)
+{
+    int x, y;
+
+    for (y = 0; y < BENCH_HEIGHT - 1; y++) {
+	uae_u8 *p = dst + y * BENCH_BPR + 1;
+	for (x = 0; x < BENCH_WIDTH - 1; x++, p += op_bpp) {
+	    switch (op_bpp) {
+	    case 1: *p = op_pen; break;
+	    case 2: do_put_mem_word ((uae_u16 *)p, op_pen); break;
+	    case 3: {
+		uae_u16 gb = (op_pen & 0x00FFFF00) >> 8;
+		p[0] = op_pen;
+		memcpy (p + 1, &gb, 2);
+		break;
+	    }
+	    case 4: do_put_mem_long ((uae_u32 *)p, op_pen); break;
+	    }
+	}
+    }
+}
+
+static void fill_new (uae_u8 *dst)
+{
+    p96_fill_rect (dst + 1, BENCH_BPR, BENCH_WIDTH - 1, BENCH_HEIGHT - 1, op_pen, op_bpp);
+}
+
+static void invert_ref (uae_u8 *dst)
+{
+    int x, y;
+
+    for (y = 0; y < BENCH_HEIGHT; y++)
+	for (x = 3; x < BENCH_WIDTH * op_bpp; x++)
+	    dst[y * BENCH_BPR + x] ^= op_mask;
+}
+
+static void invert_new (uae_u8 *dst)
+{
+    p96_invert_rect (dst + 3, BENCH_BPR, BENCH_WIDTH * op_bpp - 3, BENCH_HEIGHT, op_mask);
+}
+
+static uae_u8 minterm_byte (uae_u8 s, uae_u8 d)
+{
+    switch (op_minterm) {
+    case 0: return 0;
+    case 1: return ~(s | d);
+    case 2: return d & ~s;
+    case 3: return ~s;
+    case 4: return s & ~d;
+    case 5: return ~d;
+    case 6: return s ^ d;
+    case 7: return ~(s & d);
+    case 8: return s & d;
+    case 9: return ~(s ^ d);
+    case 10: return d;
+    case 11: return ~s | d;
+    case 12: return s;
+    case 13: return ~d | s;
+    case 14: return s | d;
+    default: return 0xFF;
+    }
+}
+
+static void minterm_ref (uae_u8 *dst)
+{
+    int x, y;
+
+    for (y = 0; y < BENCH_HEIGHT; y++)
+	for (x = 0; x < BENCH_WIDTH * 4 - 5; x++)
+	    dst[y * BENCH_BPR + x] = minterm_byte (buf_src[y * BENCH_BPR + x + 5], dst[y * BENCH_BPR + x]);
+}
+
+static void minterm_new (uae_u8 *dst)
+{
+    p96_blit_rect_minterm (buf_src + 5, BENCH_BPR, dst, BENCH_BPR, BENCH_WIDTH * 4 - 5, BENCH_HEIGHT, op_minterm);
+}
+
+static void masked_ref (uae_u8 *dst)
+{
+    int x, y;
+
+    for (y = 0; y < BENCH_HEIGHT; y++)
+	for (x = 0; x < BENCH_WIDTH - 1; x++) {
+	    uae_u8 *d = dst + y * BENCH_BPR + x;
+	    *d = (*d & ~op_mask) | (buf_src[y * BENCH_BPR + x + 1] & op_mask);
+	}
+}
+
+static void masked_new (uae_u8 *dst)
+{
+    p96_blit_rect_masked (buf_src + 1, BENCH_BPR, dst, BENCH_BPR, BENCH_WIDTH - 1, BENCH_HEIGHT, op_mask);
+}
+
+/* Source starts at pixel 3 of the planar data; destination is 1021 wide. */
+static void p2c_ref (uae_u8 *dst)
+{
+    int x, y, k;
+
+    for (y = 0; y < BENCH_HEIGHT; y++)
+	for (x = 0; x < BENCH_WIDTH - 3; x++) {
+	    int sx = x + 3;
+	    uae_u8 v = 0;
+	    for (k = 0; k < op_depth; k++) {
+		int bit;
+		if (k == 1)
+		    bit = 0;
+		else if (k == 2)
+		    bit = 1;
+		else
+		    bit = (planar[k][y * (BENCH_WIDTH / 8) + sx / 8] >> (7 - (sx & 7))) & 1;
+		v |= bit << k;
+	    }
+	    dst[y * BENCH_BPR + x] = v;
+	}
+}
+
+static void p2c_new (uae_u8 *dst)
+{
+    uae_u8 *planes[8];
+    int k;
+
+    /* Plane 1 is all zeros and plane 2 all ones. */
+    for (k = 0; k < op_depth; k++)
+	planes[k] = k == 1 || k == 2 ? 0 : planar[k];
+    p96_planar_to_chunky (dst, BENCH_BPR, planes, op_depth, 1 << 2, BENCH_WIDTH / 8, 3,
+			  BENCH_WIDTH - 3, BENCH_HEIGHT);
+}
+
+/* Template starts at pixel 3 of plane 0; destination is 1021 wide. This
+ * is the pixel loop BlitTemplate and BlitPattern used to run. */
+static void template_ref (uae_u8 *dst)
+{
+    uae_u32 fgpen = op_pen, bgpen = ~op_pen;
+    int x, y;
+
+    for (y = 0; y < BENCH_HEIGHT; y++) {
+	uae_u8 *d = dst + y * BENCH_BPR;
+	for (x = 0; x < BENCH_WIDTH - 3; x++) {
+	    int sx = x + 3;
+	    int bit_set = (planar[0][y * (BENCH_WIDTH / 8) + sx / 8] >> (7 - (sx & 7))) & 1;
+	    uae_u32 pen;
+
+	    if (op_drawmode == COMP) {
+		if (!bit_set)
+		    continue;
+		switch (op_bpp) {
+		case 1: d[x] ^= fgpen; break;
+		case 2: do_put_mem_word ((uae_u16 *)d + x, do_get_mem_word ((uae_u16 *)d + x) ^ fgpen); break;
+		case 3: do_put_mem_long ((uae_u32 *)(d + x * 3), do_get_mem_long ((uae_u32 *)(d + x * 3)) ^ (fgpen & 0x00FFFFFF)); break;
+		case 4: do_put_mem_long ((uae_u32 *)d + x, do_get_mem_long ((uae_u32 *)d + x) ^ fgpen); break;
+		}
+		continue;
+	    }
+	    if (op_invert)
+		bit_set = !bit_set;
+	    if (!bit_set && op_drawmode == JAM1)
+		continue;
+	    pen = bit_set ? fgpen : bgpen;
+	    switch (op_bpp) {
+	    case 1: d[x] = (pen & op_mask) | (d[x] & ~op_mask); break;
+	    case 2: do_put_mem_word ((uae_u16 *)d + x, pen); break;
+	    case 3: {
+		uae_u16 gb = (pen & 0x00FFFF00) >> 8;
+		d[x * 3] = pen;
+		memcpy (d + x * 3 + 1, &gb, 2);
+		break;
+	    }
+	    case 4: do_put_mem_long ((uae_u32 *)d + x, pen); break;
+	    }
+	}
+    }
+}
+
+static void template_new (uae_u8 *dst)
+{
+    p96_blit_template (dst, BENCH_BPR, planar[0], BENCH_WIDTH / 8, 3, BENCH_WIDTH - 3, BENCH_HEIGHT,
+		       op_bpp, op_drawmode, op_invert, op_pen, ~op_pen, op_mask);
+}
+
+static double time_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double bench_one (void (*f) (uae_u8 *), uae_u8 *buf)
+{
+    double start = time_now ();
+    int i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+	f (buf);
+    return (time_now () - start) * 1000000.0 / BENCH_ITERATIONS;
+}
+
+static int run (const char *name, void (*ref) (uae_u8 *), void (*fast) (uae_u8 *))
+{
+    double t_ref, t_new;
+
+    memcpy (buf_ref, buf_src, sizeof buf_ref);
+    memcpy (buf_out, buf_src, sizeof buf_out);
+    ref (buf_ref);
+    fast (buf_out);
+    if (memcmp (buf_ref, buf_out, sizeof buf_ref) != 0) {
+	printf ("%-20s output mismatch\n", name);
+	return 1;
+    }
+
+    t_ref = bench_one (ref, buf_ref);
+    t_new = bench_one (fast, buf_out);
+    printf ("%-20s %12.1f %12.1f %7.2fx\n", name, t_ref, t_new, t_ref / t_new);
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    static const int minterms[] = { 1, 3, 6, 8, 14 };
+    char name[32];
+    unsigned int i;
+    int num_fails = 0;
+
+    srand (1);
+    for (i = 0; i < sizeof buf_src; i++)
+	buf_src[i] = rand ();
+    for (i = 0; i < sizeof planar; i++)
+	((uae_u8 *)planar)[i] = rand ();
+
+    printf ("%-20s %12s %12s %8s\n", "operation", "simple us", "p96blit us", "speedup");
+
+    for (op_bpp = 1; op_bpp <= 4; op_bpp++) {
+	op_pen = 0x12345678;
+	sprintf (name, "FillRect %dbpp", op_bpp * 8);
+	num_fails += run (name, fill_ref, fill_new);
+    }
+    for (op_bpp = 1; op_bpp <= 4; op_bpp += 3) {
+	op_mask = op_bpp == 1 ? 0x0F : 0xFF;
+	sprintf (name, "InvertRect %dbpp", op_bpp * 8);
+	num_fails += run (name, invert_ref, invert_new);
+    }
+    for (i = 0; i < sizeof minterms / sizeof minterms[0]; i++) {
+	op_minterm = minterms[i];
+	sprintf (name, "BlitRect minterm %d", op_minterm);
+	num_fails += run (name, minterm_ref, minterm_new);
+    }
+    op_mask = 0x3C;
+    num_fails += run ("BlitRect mask 0x3c", masked_ref, masked_new);
+    for (op_depth = 4; op_depth <= 8; op_depth += 4) {
+	sprintf (name, "Planar2Chunky %d", op_depth);
+	num_fails += run (name, p2c_ref, p2c_new);
+    }
+    op_pen = 0x12345678;
+    for (op_bpp = 1; op_bpp <= 4; op_bpp++) {
+	static const char *modes[] = { "JAM1", "JAM2", "COMP" };
+	for (op_drawmode = JAM1; op_drawmode <= COMP; op_drawmode++) {
+	    op_mask = op_bpp == 1 && op_drawmode == JAM1 ? 0x3C : 0xFF;
+	    op_invert = op_drawmode == JAM2;
+	    sprintf (name, "Template %s %dbpp", modes[op_drawmode], op_bpp * 8);
+	    num_fails += run (name, template_ref, template_new);
+	}
+    }
+
+    return num_fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Test for the decoded copper lists.
+  *
+  * Fills a buffer with random copper lists, decodes them with
+  * copper_cache_decode() as custom.c does, and checks that the decoded
+  * words are the ones in memory and that every run of colour MOVEs that
+  * predict_copper_moves() would let the copper skip over is exactly the
+  * run that executing the list one instruction at a time finds. Then
+  * checks that copper_cache_check() catches every write that changes a
+  * word of the list, and no write that cannot.
+  *
+  * Last, lets a copper fall behind on a run of colour MOVEs, as
+  * predict_copper_moves() allows, writes into the run while it is behind
+  * and checks that it ends up with the colours a copper that kept up
+  * sees, as it does when copper_cache_write() makes it catch up first.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+#include "uae.h"
+#include "memory.h"
+#include "custom.h"
+#include "custom_private.h"
+
+#define BUFFER_SIZE	 0x4000
+
+static uae_u8 mem[BUFFER_SIZE];
+static struct copcache cache;
+
+uae_u32 copper_cache_lo, copper_cache_hi;
+static int writes_seen;
+
+/* A copper doing one colour MOVE every MOVE_CYCLES cycles from chip RAM,
+   as update_copper () does, which may be left behind the CPU.  */
+#define MOVE_CYCLES 4
+
+static uae_u16 colours[32];
+static uae_u32 cop_start;
+static int cop_next, cop_len;
+static int copper_planned, write_cycle;
+
+/* Do the MOVEs the copper fetches before CYCLE.  */
+static void run_copper (int cycle)
+{
+    for (; cop_next < cop_len && cop_next * MOVE_CYCLES < cycle; cop_next++) {
+	uae_u16 i1 = do_get_mem_word ((uae_u16 *)(mem + cop_start + cop_next * 4));
+	uae_u16 i2 = do_get_mem_word ((uae_u16 *)(mem + cop_start + cop_next * 4 + 2));
+	colours[(i1 - 0x180) / 2 & 31] = i2;
+    }
+}
+
+void copper_cache_write (uae_u32 offset)
+{
+    writes_seen++;
+    /* As in custom.c: a copper left behind catches up first.  */
+    if (copper_planned) {
+	copper_planned = 0;
+	run_copper (write_cycle);
+    }
+}
+
+static void put_insn (uae_u32 ofs, uae_u16 i1, uae_u16 i2)
+{
+    do_put_mem_word ((uae_u16 *)(mem + ofs), i1);
+    do_put_mem_word ((uae_u16 *)(mem + ofs + 2), i2);
+}
+
+static void make_list (uae_u32 start, int len, int terminate)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+	uae_u16 i1, i2 = rand () & 0xffff;
+
+	switch (rand () % 6) {
+	case 0: case 1: case 2:	/* colour MOVE */
+	    i1 = 0x180 + (rand () % 32) * 2;
+	    break;
+	case 3:			/* other MOVE, sometimes odd */
+	    i1 = (rand () % 0x100) * 2 + (rand () % 8 == 0);
+	    break;
+	default:		/* WAIT or SKIP */
+	    i1 = (rand () & 0xfffe) | 1;
+	    break;
+	}
+	if (i1 == 0xffff && i2 == 0xfffe)
+	    i2 = 0xfffc;
+	put_insn (start + i * 4, i1, i2);
+    }
+    if (terminate)
+	put_insn (start + len * 4, 0xffff, 0xfffe);
+}
+
+/* What the copper does after index I, one instruction at a time: the
+   first instruction that is not a colour MOVE.  */
+static int step (uae_u32 start, int i, int len)
+{
+    for (; i < len; i++) {
+	uae_u16 i1 = do_get_mem_word ((uae_u16 *)(mem + start + i * 4));
+	if ((i1 & 1) || i1 < 0x180 || i1 >= 0x1c0)
+	    break;
+    }
+    return i;
+}
+
+int main (int argc, char *argv[])
+{
+    int round, i, num_fails = 0;
+
+    srand (1);
+    for (round = 0; round < 2000; round++) {
+	uae_u32 start = (rand () % (BUFFER_SIZE / 4)) * 4;
+	int len = rand () % 64;
+	int terminate = rand () % 4 != 0;
+	int expect, n;
+	uae_u32 ofs;
+
+	memset (mem, 0, sizeof mem);
+	if (start + (len + terminate) * 4 > BUFFER_SIZE)
+	    len = (BUFFER_SIZE - start) / 4 - terminate;
+	make_list (start, len, terminate);
+	/* An unterminated list runs on to the end of the buffer.  */
+	expect = terminate ? len + 1 : (int)(BUFFER_SIZE - start) / 4;
+	if (expect > COPCACHE_MAX)
+	    expect = COPCACHE_MAX;
+
+	n = copper_cache_decode (&cache, mem, start, BUFFER_SIZE);
+	if (n != expect || cache.start != start || cache.len != n) {
+	    if (num_fails++ < 10)
+		printf ("round %d: decoded %d instructions at %x, expected %d\n",
+			round, n, start, expect);
+	    continue;
+	}
+	for (i = 0; i < n; i++) {
+	    uae_u16 i1 = do_get_mem_word ((uae_u16 *)(mem + start + i * 4));
+	    uae_u16 i2 = do_get_mem_word ((uae_u16 *)(mem + start + i * 4 + 2));
+	    int s = step (start, i, n);
+
+	    if (cache.words[i * 2] != i1 || cache.words[i * 2 + 1] != i2 || cache.stop[i] != s) {
+		if (num_fails++ < 10)
+		    printf ("round %d: instruction %d is %04x %04x stop %d, expected %04x %04x stop %d\n",
+			    round, i, cache.words[i * 2], cache.words[i * 2 + 1], cache.stop[i], i1, i2, s);
+	    }
+	}
+
+	/* Byte, word and long writes at and around the list.  */
+	copper_cache_lo = start >= 3 ? start - 3 : 0;
+	copper_cache_hi = start + n * 4;
+	for (ofs = copper_cache_lo >= 8 ? copper_cache_lo - 8 : 0;
+	     ofs < copper_cache_hi + 8 && ofs < BUFFER_SIZE; ofs++) {
+	    int size;
+
+	    for (size = 1; size <= 4; size *= 2) {
+		int hits = ofs + size > start && ofs < start + n * 4;
+		int near = ofs + 4 > start && ofs < start + n * 4;
+
+		writes_seen = 0;
+		copper_cache_check (ofs);
+		if (hits ? !writes_seen : writes_seen && !near) {
+		    if (num_fails++ < 10)
+			printf ("round %d: %d byte write at %x %s\n", round, size, ofs,
+				hits ? "not seen" : "seen outside the list");
+		}
+	    }
+	}
+    }
+
+    /* Writes into a run of colour MOVEs that the copper is behind on.  */
+    for (round = 0; round < 2000; round++) {
+	uae_u16 expect[32];
+	uae_u32 ofs;
+	int size, n, j;
+
+	memset (mem, 0, sizeof mem);
+	cop_start = (rand () % (BUFFER_SIZE / 4 - 64)) * 4;
+	cop_len = 1 + rand () % 48;
+	for (i = 0; i < cop_len; i++)
+	    put_insn (cop_start + i * 4, 0x180 + (rand () % 32) * 2, rand ());
+	put_insn (cop_start + cop_len * 4, 0xffff, 0xfffe);
+	n = copper_cache_decode (&cache, mem, cop_start, BUFFER_SIZE);
+	copper_cache_lo = cop_start >= 3 ? cop_start - 3 : 0;
+	copper_cache_hi = cop_start + n * 4;
+
+	/* A byte, word or long CPU write somewhere in the run.  */
+	size = 1 << (rand () % 3);
+	ofs = cop_start + (rand () % cop_len) * 4 + (size == 4 ? 0 : (rand () % (4 / size)) * size);
+	write_cycle = rand () % (cop_len * MOVE_CYCLES + 1);
+
+	/* The copper that keeps up.  */
+	memset (colours, 0, sizeof colours);
+	cop_next = 0;
+	run_copper (write_cycle);
+	for (j = 0; j < size; j++)
+	    mem[ofs + j] ^= 0x5a;
+	run_copper (cop_len * MOVE_CYCLES);
+	memcpy (expect, colours, sizeof expect);
+	for (j = 0; j < size; j++)
+	    mem[ofs + j] ^= 0x5a;
+
+	/* The one that is left behind until the end of the run.  */
+	memset (colours, 0, sizeof colours);
+	cop_next = 0;
+	copper_planned = 1;
+	copper_cache_check (ofs);
+	for (j = 0; j < size; j++)
+	    mem[ofs + j] ^= 0x5a;
+	copper_planned = 0;
+	run_copper (cop_len * MOVE_CYCLES);
+
+	if (memcmp (colours, expect, sizeof expect) != 0) {
+	    if (num_fails++ < 10)
+		printf ("round %d: %d byte write at %x in cycle %d changed the colours the copper set\n",
+			round, size, ofs, write_cycle);
+	}
+    }
+
+    if (num_fails)
+	printf ("%d failures\n", num_fails);
+    else
+	printf ("All tests passed\n");
+    return num_fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
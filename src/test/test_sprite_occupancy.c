@@ -0,0 +1,387 @@
+ /*
+  * E-UAE - The portable Amiga Emulator
+  *
+  * Test for sprite_next_occupied().
+  *
+  * Lays out sprite entries in a buffer the way record_sprite() in custom.c
+  * does, fills them with sparse sprite data and checks that walking the
+  * entries with sprite_next_occupied(), as draw_sprites_1() and
+  * do_sprite_collisions() do, visits exactly the sprite pixels that the
+  * plain pixel-by-pixel loop visits.
+  *
+  * Then records lines of sprites as record_sprite() does, draws them over
+  * a random playfield with a copy of draw_sprites_1(), once skipping
+  * transparent pixels and once pixel by pixel, and compares the lines.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+#include "uae.h"
+#include "memory.h"
+#include "custom.h"
+#include "xwin.h"
+#include "drawing.h"
+
+#define NR_ENTRIES	 64
+#define BUFFER_PIXELS	 (NR_ENTRIES * 128)
+
+static uae_u16 spbuf[BUFFER_PIXELS + 4];
+static uae_u8 spstate[BUFFER_PIXELS + 8];
+static struct sprite_entry entries[NR_ENTRIES + 1];
+
+static void make_entries (void)
+{
+    int i;
+
+    memset (spbuf, 0, sizeof spbuf);
+    entries[0].first_pixel = 0;
+    for (i = 0; i < NR_ENTRIES; i++) {
+	struct sprite_entry *e = &entries[i];
+	int width = 16 << (rand () % 3);
+	int density = rand () % 4;
+	int j;
+
+	e->pos = 0x80 + rand () % 0x200;
+	/* Coalesced entries cover several sprites with gaps in between.  */
+	e->max = e->pos + width + (rand () % 2 ? 16 + rand () % 32 : 0);
+	e[1].first_pixel = e->first_pixel + ((e->max - e->pos + 3) & ~3);
+
+	for (j = 0; j < e->max - e->pos; j++) {
+	    if (density && rand () % (1 << (density * 2)) == 0)
+		spbuf[e->first_pixel + j] = 1 + rand () % 0xffff;
+	}
+    }
+}
+
+/* The pixels visited by the draw loop, with and without skipping.  */
+static int walk (const struct sprite_entry *e, int skip, int doubling, int fast, int *out)
+{
+    const uae_u16 *buf = spbuf + e->first_pixel - e->pos;
+    int pos, window_pos = 0, n = 0;
+
+    for (pos = e->pos; pos < e->max; pos += 1 << skip) {
+	unsigned int v = buf[pos];
+
+	if (fast && v == 0) {
+	    int steps = (sprite_next_occupied (buf, pos, e->max) - pos + (1 << skip) - 1) >> skip;
+	    pos += steps << skip;
+	    window_pos += steps << doubling;
+	    if (pos >= e->max)
+		break;
+	    v = buf[pos];
+	}
+	if (v != 0) {
+	    out[n++] = pos;
+	    out[n++] = window_pos;
+	}
+	window_pos += 1 << doubling;
+    }
+    return n;
+}
+
+/* The tables and playfield state of drawing.c that draw_sprites_1 () uses.  */
+static uae_u32 sprtaba[256], sprtabb[256];
+static int dblpf_ms1[256], dblpf_ms2[256], dblpf_ms[256];
+static int sprite_offs[256];
+static uae_u32 plf_sprite_mask;
+static int sbasecol[2];
+static int bpldualpfpri;
+static uae_u8 xor_val;
+static uae_u32 palette[256];
+
+#define LINE_PIXELS	 2048
+
+struct line {
+    union {
+	uae_u8 apixels[LINE_PIXELS];
+	uae_u16 apixels_w[LINE_PIXELS / 2];
+    } pixdata;
+    uae_u32 ham_linebuf[LINE_PIXELS];
+    uae_u8 spriteagadpfpixels[LINE_PIXELS];
+};
+
+static struct line playfield, ref_line, got_line;
+
+static void gen_tables (void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+	int plane1 = (i & 1) | ((i >> 1) & 2) | ((i >> 2) & 4) | ((i >> 3) & 8);
+	int plane2 = ((i >> 1) & 1) | ((i >> 2) & 2) | ((i >> 3) & 4) | ((i >> 4) & 8);
+
+	sprtaba[i] = ((((i >> 7) & 1) << 0)
+		      | (((i >> 6) & 1) << 2)
+		      | (((i >> 5) & 1) << 4)
+		      | (((i >> 4) & 1) << 6)
+		      | (((i >> 3) & 1) << 8)
+		      | (((i >> 2) & 1) << 10)
+		      | (((i >> 1) & 1) << 12)
+		      | (((i >> 0) & 1) << 14));
+	sprtabb[i] = sprtaba[i] * 2;
+	dblpf_ms1[i] = plane1 == 0 ? (plane2 == 0 ? 16 : 8) : 0;
+	dblpf_ms2[i] = plane2 == 0 ? (plane1 == 0 ? 16 : 0) : 8;
+	dblpf_ms[i] = i == 0 ? 16 : 8;
+	sprite_offs[i] = (i & 15) ? 0 : 2;
+    }
+}
+
+/* Record one line of sprites FETCH pixels wide, each pixel DBL times, into
+   entries, spbuf and spstate the way decide_sprites () and record_sprite ()
+   do.  Returns the number of entries.  */
+static int make_line (int fetch, int dbl)
+{
+    int xpos[8], nrs[8];
+    int count = 0, nr_entries = 0, i, j, k;
+
+    memset (spbuf, 0, sizeof spbuf);
+    memset (spstate, 0, sizeof spstate);
+    for (i = 0; i < 8; i++) {
+	int x;
+
+	if (rand () % 3 == 0)
+	    continue;
+	x = 0x40 + rand () % 0x180;
+	for (j = count; j > 0 && xpos[j - 1] > x; j--) {
+	    xpos[j] = xpos[j - 1];
+	    nrs[j] = nrs[j - 1];
+	}
+	xpos[j] = x;
+	nrs[j] = i;
+	count++;
+    }
+
+    entries[0].first_pixel = 0;
+    for (i = 0; i < count; i++) {
+	struct sprite_entry *e;
+	int num = nrs[i], width = fetch << dbl, word_offs;
+
+	if (nr_entries > 0 && entries[nr_entries - 1].max + 16 >= xpos[i]) {
+	    e = &entries[nr_entries - 1];
+	} else {
+	    e = &entries[nr_entries++];
+	    e->pos = xpos[i];
+	    e->has_attached = 0;
+	}
+	e->max = xpos[i] + width;
+	e[1].first_pixel = e->first_pixel + ((e->max - e->pos + 3) & ~3);
+	word_offs = e->first_pixel + xpos[i] - e->pos;
+
+	for (k = 0; k < fetch; k += 16) {
+	    /* Most sprite data words are empty.  */
+	    unsigned int da = rand () % 3 ? 0 : rand () & 0xffff;
+	    unsigned int db = rand () % 3 ? 0 : rand () & 0xffff;
+	    uae_u32 datab = ((sprtaba[da & 0xFF] << 16) | sprtaba[da >> 8]
+			     | (sprtabb[db & 0xFF] << 16) | sprtabb[db >> 8]);
+	    uae_u16 *buf = spbuf + word_offs + (k << dbl);
+
+	    while (datab) {
+		unsigned int tmp = *buf | ((datab & 3) << (2 * num));
+		*buf++ = tmp;
+		if (dbl)
+		    *buf++ = tmp;
+		datab >>= 2;
+	    }
+	}
+
+	if (rand () % 4 == 0) {
+	    for (k = 0; k < ((width + 7) & ~7); k++)
+		spstate[word_offs + k] |= 1 << (num & ~1);
+	    e->has_attached = 1;
+	}
+    }
+    return nr_entries;
+}
+
+/* draw_sprites_1 () in drawing.c, drawing into L; FAST selects the skip
+   over transparent pixels.  */
+static void draw_sprites (struct line *l, const struct sprite_entry *e, int ham, int dualpf,
+			  int doubling, int skip, int has_attach, int aga, int fast)
+{
+    int *shift_lookup = dualpf ? (bpldualpfpri ? dblpf_ms2 : dblpf_ms1) : dblpf_ms;
+    const uae_u16 *buf = spbuf + e->first_pixel - e->pos;
+    const uae_u8 *stbuf = spstate + e->first_pixel - e->pos;
+    int pos, window_pos;
+
+    window_pos = e->pos + 8;
+    if (skip)
+	window_pos >>= 1;
+    else if (doubling)
+	window_pos <<= 1;
+    for (pos = e->pos; pos < e->max; pos += 1 << skip) {
+	int maskshift, plfmask;
+	unsigned int v = buf[pos];
+
+	if (fast && v == 0) {
+	    int steps = (sprite_next_occupied (buf, pos, e->max) - pos + (1 << skip) - 1) >> skip;
+	    pos += steps << skip;
+	    window_pos += steps << doubling;
+	    if (pos >= e->max)
+		break;
+	    v = buf[pos];
+	}
+
+	maskshift = shift_lookup[l->pixdata.apixels[window_pos]];
+	plfmask = (plf_sprite_mask >> maskshift) >> maskshift;
+	v &= ~plfmask;
+	if (v != 0) {
+	    unsigned int vlo, vhi, col;
+	    unsigned int v1 = v & 255;
+	    int offs;
+
+	    if (v1 == 0)
+		offs = 4 + sprite_offs[v >> 8];
+	    else
+		offs = sprite_offs[v1];
+	    v >>= offs * 2;
+	    v &= 15;
+
+	    if (has_attach && (stbuf[pos] & (3 << offs))) {
+		col = v;
+		if (aga)
+		    col += sbasecol[1];
+		else
+		    col += 16;
+	    } else {
+		vlo = v & 3;
+		vhi = (v & (vlo - 1)) >> 2;
+		col = (vlo | vhi);
+		if (aga) {
+		    if (vhi > 0)
+			col += sbasecol[1];
+		    else
+			col += sbasecol[0];
+		} else {
+		    col += 16;
+		}
+		col += (offs * 2);
+	    }
+	    if (dualpf) {
+		if (aga) {
+		    l->spriteagadpfpixels[window_pos] = col;
+		    if (doubling)
+			l->spriteagadpfpixels[window_pos + 1] = col;
+		} else {
+		    col += 128;
+		    if (doubling)
+			l->pixdata.apixels_w[window_pos >> 1] = col | (col << 8);
+		    else
+			l->pixdata.apixels[window_pos] = col;
+		}
+	    } else if (ham) {
+		col = palette[col & 255];
+		if (aga)
+		    col ^= xor_val;
+		l->ham_linebuf[window_pos] = col;
+		if (doubling)
+		    l->ham_linebuf[window_pos + 1] = col;
+	    } else {
+		if (aga)
+		    col ^= xor_val;
+		if (doubling)
+		    l->pixdata.apixels_w[window_pos >> 1] = col | (col << 8);
+		else
+		    l->pixdata.apixels[window_pos] = col;
+	    }
+	}
+	window_pos += 1 << doubling;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    static int ref[BUFFER_PIXELS * 2], got[BUFFER_PIXELS * 2];
+    int round, i, num_fails = 0;
+
+    srand (1);
+    for (round = 0; round < 200; round++) {
+	make_entries ();
+	for (i = 0; i < NR_ENTRIES; i++) {
+	    const struct sprite_entry *e = &entries[i];
+	    const uae_u16 *buf = spbuf + e->first_pixel - e->pos;
+	    int skip, doubling, pos, max;
+
+	    /* Every start and end position within the entry.  */
+	    for (max = e->pos; max <= e->max; max++) {
+		for (pos = e->pos; pos <= max; pos++) {
+		    int expect = pos;
+		    while (expect < max && !buf[expect])
+			expect++;
+		    if (sprite_next_occupied (buf, pos, max) != expect) {
+			if (num_fails++ < 10)
+			    printf ("round %d entry %d: next_occupied (%d, %d) = %d, expected %d\n",
+				    round, i, pos, max, sprite_next_occupied (buf, pos, max), expect);
+		    }
+		}
+	    }
+
+	    for (skip = 0; skip < 2; skip++) {
+		for (doubling = 0; doubling < 2; doubling++) {
+		    int nref = walk (e, skip, doubling, 0, ref);
+		    int ngot = walk (e, skip, doubling, 1, got);
+		    if (nref != ngot || memcmp (ref, got, nref * sizeof *ref) != 0) {
+			if (num_fails++ < 10)
+			    printf ("round %d entry %d: walk mismatch (skip %d, doubling %d)\n",
+				    round, i, skip, doubling);
+		    }
+		}
+	    }
+	}
+    }
+
+    gen_tables ();
+    for (round = 0; round < 2000; round++) {
+	int aga = round & 1;
+	int dbl = aga ? rand () % 2 : 0;
+	int fetch = aga ? 16 << (rand () % 3) : 16;
+	int nr_entries = make_line (fetch, dbl);
+	int mode;
+
+	for (i = 0; i < LINE_PIXELS; i++) {
+	    playfield.pixdata.apixels[i] = rand () % 4 ? 0 : rand () & 0xff;
+	    playfield.ham_linebuf[i] = rand ();
+	    playfield.spriteagadpfpixels[i] = 0;
+	}
+	for (i = 0; i < 256; i++)
+	    palette[i] = rand () & 0xffffff;
+	bpldualpfpri = rand () % 2;
+	plf_sprite_mask = 0xFFFF0000 << (4 * (rand () % 5));
+	plf_sprite_mask |= (0xFFFF << (4 * (rand () % 5))) & 0xFFFF;
+	sbasecol[0] = (rand () % 16) << 4;
+	sbasecol[1] = (rand () % 16) << 4;
+	xor_val = rand ();
+
+	/* Bit 0 HAM, bit 1 dual playfield, bit 2 doubling, bit 3 skip.  */
+	for (mode = 0; mode < 16; mode++) {
+	    int ham = mode & 1, dualpf = (mode >> 1) & 1;
+	    int doubling = (mode >> 2) & 1, skip = (mode >> 3) & 1;
+
+	    if ((ham && dualpf) || (doubling && skip))
+		continue;
+	    ref_line = playfield;
+	    got_line = playfield;
+	    for (i = 0; i < nr_entries; i++) {
+		const struct sprite_entry *e = &entries[i];
+		draw_sprites (&ref_line, e, ham, dualpf, doubling, skip, e->has_attached, aga, 0);
+		draw_sprites (&got_line, e, ham, dualpf, doubling, skip, e->has_attached, aga, 1);
+	    }
+	    if (memcmp (&ref_line, &got_line, sizeof ref_line) != 0) {
+		if (num_fails++ < 10)
+		    printf ("round %d: drawn line differs (ham %d, dualpf %d, doubling %d, skip %d, aga %d)\n",
+			    round, ham, dualpf, doubling, skip, aga);
+	    }
+	}
+    }
+
+    if (num_fails)
+	printf ("%d failures\n", num_fails);
+    else
+	printf ("All tests passed\n");
+    return num_fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1129,6 +1129,29 @@ extern z_off_t ZEXPORT unztell (file)
 }
 
 
+/*
+  Give the position of the data of the current file in the zipfile
+*/
+extern int ZEXPORT unzGetCurrentFileDataOffset (file,poffset)
+	unzFile file;
+	uLong *poffset;
+{
+	unz_s* s;
+	file_in_zip_read_info_s* pfile_in_zip_read_info;
+	if (file==NULL)
+		return UNZ_PARAMERROR;
+	s=(unz_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+	if (pfile_in_zip_read_info==NULL)
+		return UNZ_PARAMERROR;
+
+	*poffset = pfile_in_zip_read_info->pos_in_zipfile +
+		   pfile_in_zip_read_info->byte_before_the_zipfile;
+	return UNZ_OK;
+}
+
+
 /*
   return 1 if the end of file was reached, 0 elsewhere
 */
@@ -18,8 +18,16 @@
 #include "dms/pfile.h"
 #include "gui.h"
 #include "crc32.h"
+#ifdef SUPPORT_THREADS
+#include "threaddep/thread.h"
+#endif
 
 #include <zlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+struct zindex;
 
 struct zfile {
     char *name;
@@ -29,9 +37,14 @@ struct zfile {
     int size;
     int seek;
     int deleteafterclose;
+    int mapped;			/* data is the file mmap()ed */
+    struct zindex *index;	/* data is decompressed on demand */
     struct zfile *next;
 };
 
+static void zindex_free (struct zindex *ix);
+static int zindex_read (struct zindex *ix, uae_u8 *dst, long offset, int len);
+
 static struct zfile *zlist = 0;
 int is_zlib;
 
@@ -74,11 +87,21 @@ static void zfile_free (struct zfile *f)
 	unlink (f->name);
 	write_log ("deleted temporary file '%s'\n", f->name);
     }
+    if (f->index)
+	zindex_free (f->index);
     free (f->name);
-    free (f->data);
+    free (f->zipname);
+#ifdef HAVE_SYS_MMAN_H
+    if (f->mapped)
+	munmap (f->data, f->size);
+    else
+#endif
+	free (f->data);
     free (f);
 }
 
+static void dms_cache_free (void);
+
 void zfile_exit (void)
 {
     struct zfile *l;
@@ -86,6 +109,7 @@ void zfile_exit (void)
 	zlist = l->next;
 	zfile_free (l);
     }
+    dms_cache_free ();
 }
 
 void zfile_fclose (struct zfile *f)
@@ -224,6 +248,282 @@ static struct zfile *updateoutputfile (struct zfile *z)
 }
 #endif
 
+/* Read-only files are mapped, and then read like decompressed ones. The
+ * FILE stays open, so that zfile_dup () can open it again. */
+static int zfile_map (struct zfile *z)
+{
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    void *p;
+
+    if (fstat (fileno (z->f), &st) < 0 || !S_ISREG (st.st_mode)
+	|| st.st_size <= 0 || st.st_size > INT_MAX)
+	return 0;
+    p = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fileno (z->f), 0);
+    if (p == MAP_FAILED)
+	return 0;
+    z->data = p;
+    z->size = st.st_size;
+    z->seek = 0;
+    z->mapped = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* A private handle to the file behind Z, not in zlist. */
+static struct zfile *zfile_dup (struct zfile *z)
+{
+    struct zfile *l;
+    FILE *f;
+    int fd;
+
+    if (!z->f)
+	return 0;
+    fd = dup (fileno (z->f));
+    if (fd < 0)
+	return 0;
+    f = fdopen (fd, "rb");
+    if (!f) {
+	close (fd);
+	return 0;
+    }
+    l = malloc (sizeof *l);
+    if (!l) {
+	fclose (f);
+	return 0;
+    }
+    memset (l, 0, sizeof *l);
+    l->name = strdup (z->name);
+    l->f = f;
+    zfile_map (l);
+    return l;
+}
+
+/*
+ * Big gzip files and zip members are not decompressed when they are
+ * opened, but read from the archive as they are used. Every ZINDEX_SPAN
+ * bytes of output, at the next deflate block boundary, the position in
+ * the compressed data and the last 32 KB of output are kept, and a read
+ * starts inflating from the last such point before it (as zran.c in the
+ * zlib sources does). The points are added as far as the file has been
+ * read, so opening costs nothing.
+ */
+#define ZINDEX_MINSIZE	(4 * 1024 * 1024)
+#define ZINDEX_SPAN	(1024 * 1024)
+#define ZINDEX_WINDOW	32768
+
+struct zpoint {
+    long in;			/* first whole byte in the source */
+    int bits;			/* bits of the byte before it still to be used */
+    long out;			/* offset in the uncompressed data */
+    uae_u8 *window;		/* the 32 KB before out, 0 at the start */
+};
+
+struct zindex {
+    struct zfile *src;
+    long end;			/* end of the data in src */
+    int stored;			/* data is not compressed at all */
+    int size;
+    struct zpoint *points;
+    int npoints, maxpoints;
+    z_stream zs;
+    int active;
+    long in, out;		/* next byte to read from src, position of zs */
+    unsigned int wpos, wvalid;	/* window is a ring of the last output */
+    uae_u8 window[ZINDEX_WINDOW];
+    uae_u8 inbuf[16384];
+};
+
+static int zindex_addpoint (struct zindex *ix, long in, int bits, long out)
+{
+    struct zpoint *p;
+
+    if (ix->npoints == ix->maxpoints) {
+	int max = ix->maxpoints ? ix->maxpoints * 2 : 16;
+	p = realloc (ix->points, max * sizeof *p);
+	if (!p)
+	    return 0;
+	ix->points = p;
+	ix->maxpoints = max;
+    }
+    p = &ix->points[ix->npoints];
+    p->in = in;
+    p->bits = bits;
+    p->out = out;
+    p->window = 0;
+    if (out > 0) {
+	p->window = malloc (ZINDEX_WINDOW);
+	if (!p->window)
+	    return 0;
+	memcpy (p->window, ix->window + ix->wpos, ZINDEX_WINDOW - ix->wpos);
+	memcpy (p->window + ZINDEX_WINDOW - ix->wpos, ix->window, ix->wpos);
+    }
+    ix->npoints++;
+    return 1;
+}
+
+static void zindex_free (struct zindex *ix)
+{
+    int i;
+
+    if (ix->active)
+	inflateEnd (&ix->zs);
+    for (i = 0; i < ix->npoints; i++)
+	free (ix->points[i].window);
+    free (ix->points);
+    zfile_free (ix->src);
+    free (ix);
+}
+
+/* A zfile of SIZE bytes, the deflate data (or the plain data if STORED)
+ * of which is at START..END in the file behind Z. */
+static struct zfile *zindex_open (const char *name, struct zfile *z, long start, long end, int size, int stored)
+{
+    struct zindex *ix;
+    struct zfile *l;
+
+    ix = malloc (sizeof *ix);
+    if (!ix)
+	return 0;
+    memset (ix, 0, sizeof *ix);
+    ix->src = zfile_dup (z);
+    if (!ix->src || !zindex_addpoint (ix, start, 0, 0)) {
+	if (ix->src)
+	    zfile_free (ix->src);
+	free (ix->points);
+	free (ix);
+	return 0;
+    }
+    ix->end = end;
+    ix->stored = stored;
+    ix->size = size;
+    l = zfile_create ();
+    l->name = strdup (name);
+    l->size = size;
+    l->index = ix;
+    write_log ("zfile: '%s', %d bytes, decompressed on demand\n", name, size);
+    return l;
+}
+
+static int zindex_restart (struct zindex *ix, const struct zpoint *p)
+{
+    if (ix->active)
+	inflateEnd (&ix->zs);
+    memset (&ix->zs, 0, sizeof ix->zs);
+    ix->active = inflateInit2 (&ix->zs, -MAX_WBITS) == Z_OK;
+    if (!ix->active)
+	return 0;
+    ix->in = p->in;
+    if (p->bits) {
+	uae_u8 b = 0;
+	zfile_fseek (ix->src, p->in - 1, SEEK_SET);
+	zfile_fread (&b, 1, 1, ix->src);
+	inflatePrime (&ix->zs, p->bits, b >> (8 - p->bits));
+    }
+    ix->wpos = 0;
+    ix->wvalid = 0;
+    if (p->window) {
+	inflateSetDictionary (&ix->zs, p->window, ZINDEX_WINDOW);
+	memcpy (ix->window, p->window, ZINDEX_WINDOW);
+	ix->wvalid = ZINDEX_WINDOW;
+    }
+    ix->out = p->out;
+    return 1;
+}
+
+static int zindex_read (struct zindex *ix, uae_u8 *dst, long offset, int len)
+{
+    int done = 0, lo, hi;
+
+    if (offset >= ix->size || len <= 0)
+	return 0;
+    if (offset + len > ix->size)
+	len = ix->size - offset;
+    if (ix->stored) {
+	zfile_fseek (ix->src, ix->points[0].in + offset, SEEK_SET);
+	return zfile_fread (dst, 1, len, ix->src);
+    }
+
+    /* still in the window, as when the same block is read again */
+    if (ix->active && offset < ix->out && ix->out - offset <= (long)ix->wvalid) {
+	while (done < len && offset + done < ix->out) {
+	    unsigned int back = ix->out - (offset + done);
+	    unsigned int i = (ix->wpos + ZINDEX_WINDOW - back) % ZINDEX_WINDOW;
+	    int n = ZINDEX_WINDOW - i;
+	    if (n > (int)back)
+		n = back;
+	    if (n > len - done)
+		n = len - done;
+	    memcpy (dst + done, ix->window + i, n);
+	    done += n;
+	}
+    }
+
+    /* the last point at or before the data */
+    lo = 0;
+    hi = ix->npoints - 1;
+    while (lo < hi) {
+	int mid = (lo + hi + 1) / 2;
+	if (ix->points[mid].out <= offset + done)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    if (done < len && (!ix->active || offset + done < ix->out || ix->points[lo].out > ix->out)) {
+	if (!zindex_restart (ix, &ix->points[lo]))
+	    return done;
+    }
+
+    while (done < len) {
+	long want = offset + done;
+	unsigned int have;
+	int ret;
+
+	if (ix->zs.avail_in == 0) {
+	    long n = ix->end - ix->in;
+	    if (n > (long)sizeof ix->inbuf)
+		n = sizeof ix->inbuf;
+	    if (n > 0) {
+		zfile_fseek (ix->src, ix->in, SEEK_SET);
+		n = zfile_fread (ix->inbuf, 1, n, ix->src);
+	    }
+	    if (n <= 0)
+		break;
+	    ix->in += n;
+	    ix->zs.next_in = ix->inbuf;
+	    ix->zs.avail_in = n;
+	}
+	ix->zs.next_out = ix->window + ix->wpos;
+	ix->zs.avail_out = ZINDEX_WINDOW - ix->wpos;
+	ret = inflate (&ix->zs, Z_BLOCK);
+	have = ZINDEX_WINDOW - ix->wpos - ix->zs.avail_out;
+	if (want < ix->out + (long)have) {
+	    int n = ix->out + have - want;
+	    if (n > len - done)
+		n = len - done;
+	    memcpy (dst + done, ix->window + ix->wpos + (want - ix->out), n);
+	    done += n;
+	}
+	ix->out += have;
+	ix->wpos = (ix->wpos + have) % ZINDEX_WINDOW;
+	ix->wvalid = ix->wvalid + have > ZINDEX_WINDOW ? ZINDEX_WINDOW : ix->wvalid + have;
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+	    if (ret != Z_STREAM_END)
+		write_log ("zfile: inflate error %d at %ld\n", ret, ix->out);
+	    inflateEnd (&ix->zs);
+	    ix->active = 0;
+	    break;
+	}
+	/* at the end of a deflate block */
+	if ((ix->zs.data_type & 128) && !(ix->zs.data_type & 64)
+	    && ix->out >= ix->points[ix->npoints - 1].out + ZINDEX_SPAN)
+	    zindex_addpoint (ix, ix->in - ix->zs.avail_in, ix->zs.data_type & 7, ix->out);
+    }
+    return done;
+}
+
 static struct zfile *zuncompress (struct zfile *z);
 
 static struct zfile *gunzip (struct zfile *z)
@@ -280,8 +580,16 @@ static struct zfile *gunzip (struct zfile *z)
     size |= b << 16;
     zfile_fread (&b, 1, 1, z);
     size |= b << 24;
-    if (size < 8 || size > 10000000) /* safety check */
+    if (size < 8) /* safety check */
 	return z;
+    if (size >= ZINDEX_MINSIZE) {
+	/* Inside another archive there is no file to index: unpack it */
+	z2 = zindex_open (name, z, offset, zfile_ftell (z) - 8, size, 0);
+	if (z2) {
+	    zfile_fclose (z);
+	    return z2;
+	}
+    }
     zfile_fseek (z, offset, SEEK_SET);
     z2 = zfile_fopen_empty (name, size);
     if (!z2)
@@ -320,15 +628,132 @@ static struct zfile *lha (struct zfile *z)
     return z;
 }
 
+/*
+ * Unpacked DMS images are kept, most recently used first, so that a game
+ * that swaps between DMS disks does not unpack them again on every swap.
+ * They are found by the CRC32 and size of the archive. With dms_cache_dir
+ * set, they are also written there and kept across runs.
+ */
+#define DMS_SIZE		(1760 * 512)
+#define DMS_CACHE_ENTRIES	8
+
+struct dms_cache {
+    uae_u32 crc;
+    long size;
+    uae_u8 *data;
+    struct dms_cache *next;
+};
+
+static struct dms_cache *dms_cache;
+
+static void dms_cache_file (char *path, uae_u32 crc, long size)
+{
+    sprintf (path, "%s/%08x-%ld.adf", currprefs.dms_cache_dir, crc, size);
+}
+
+static void dms_cache_put (uae_u32 crc, long size, const uae_u8 *data, int todisk)
+{
+    struct dms_cache *c, **link;
+    char path[MAX_DPATH];
+    int n = 0;
+    FILE *f;
+
+    for (link = &dms_cache; (c = *link); link = &c->next) {
+	if (++n == DMS_CACHE_ENTRIES) {
+	    *link = 0;
+	    free (c->data);
+	    free (c);
+	    break;
+	}
+    }
+    c = malloc (sizeof *c);
+    if (c)
+	c->data = malloc (DMS_SIZE);
+    if (c && c->data) {
+	c->crc = crc;
+	c->size = size;
+	memcpy (c->data, data, DMS_SIZE);
+	c->next = dms_cache;
+	dms_cache = c;
+    } else
+	free (c);
+
+    if (!todisk || !currprefs.dms_cache_dir[0])
+	return;
+    dms_cache_file (path, crc, size);
+    f = fopen (path, "wb");
+    if (!f)
+	return;
+    if (fwrite (data, DMS_SIZE, 1, f) != 1) {
+	fclose (f);
+	unlink (path);
+	return;
+    }
+    fclose (f);
+}
+
+static int dms_cache_get (uae_u32 crc, long size, uae_u8 *dst)
+{
+    struct dms_cache *c, **link;
+    char path[MAX_DPATH];
+    FILE *f;
+    int ok;
+
+    for (link = &dms_cache; (c = *link); link = &c->next) {
+	if (c->crc == crc && c->size == size) {
+	    *link = c->next;
+	    c->next = dms_cache;
+	    dms_cache = c;
+	    memcpy (dst, c->data, DMS_SIZE);
+	    return 1;
+	}
+    }
+    if (!currprefs.dms_cache_dir[0])
+	return 0;
+    dms_cache_file (path, crc, size);
+    f = fopen (path, "rb");
+    if (!f)
+	return 0;
+    ok = fread (dst, DMS_SIZE, 1, f) == 1;
+    fclose (f);
+    if (ok)
+	dms_cache_put (crc, size, dst, 0);
+    return ok;
+}
+
+static void dms_cache_free (void)
+{
+    struct dms_cache *c;
+
+    while ((c = dms_cache)) {
+	dms_cache = c->next;
+	free (c->data);
+	free (c);
+    }
+}
+
 static struct zfile *dms (struct zfile *z)
 {
     int ret;
     struct zfile *zo;
+    uae_u32 crc;
+    long pos, size;
 
-    zo = zfile_fopen_empty ("zipped.dms", 1760 * 512);
+    zo = zfile_fopen_empty ("zipped.dms", DMS_SIZE);
     if (!zo) return z;
+    pos = zfile_ftell (z);
+    zfile_fseek (z, 0, SEEK_END);
+    size = zfile_ftell (z);
+    crc = zfile_crc32 (z);
+    zfile_fseek (z, pos, SEEK_SET);
+    if (dms_cache_get (crc, size, zo->data)) {
+	zfile_fclose (z);
+	return zo;
+    }
     ret = DMS_Process_File (z, zo, CMD_UNPACK, OPT_VERBOSE, 0, 0);
     if (ret == NO_PROBLEM || ret == DMS_FILE_END) {
+	dms_cache_put (crc, size, zo->data, 1);
+	zfile_fseek (zo, 0, SEEK_SET);
 	zfile_fclose (z);
 	return zo;
     }
@@ -426,14 +851,30 @@ static struct zfile *unzip (struct zfile *z)
 		if (select && !we_have_file) {
 		    unsigned int err = unzOpenCurrentFile (uz);
 		    if (err == UNZ_OK) {
-			zf = zfile_fopen_empty (filename_inzip, file_info.uncompressed_size);
+			uLong pos;
+			zf = 0;
+			/* Inside another archive there is no file to index */
+			if (file_info.uncompressed_size >= ZINDEX_MINSIZE
+			    && (file_info.compression_method == 0 || file_info.compression_method == Z_DEFLATED)
+			    && !(file_info.flag & 1)
+			    && unzGetCurrentFileDataOffset (uz, &pos) == UNZ_OK)
+			    zf = zindex_open (filename_inzip, z, pos, pos + file_info.compressed_size,
+					      file_info.uncompressed_size, file_info.compression_method == 0);
 			if (zf) {
-			    err = unzReadCurrentFile  (uz, zf->data, file_info.uncompressed_size);
 			    unzCloseCurrentFile (uz);
-			    if (err == 0 || err == file_info.uncompressed_size) {
-				zf = zuncompress (zf);
-				if (select < 0 || zfile_gettype (zf)) {
-				    we_have_file = 1;
+			    zf = zuncompress (zf);
+			    if (select < 0 || zfile_gettype (zf))
+				we_have_file = 1;
+			} else {
+			    zf = zfile_fopen_empty (filename_inzip, file_info.uncompressed_size);
+			    if (zf) {
+				err = unzReadCurrentFile  (uz, zf->data, file_info.uncompressed_size);
+				unzCloseCurrentFile (uz);
+				if (err == 0 || err == file_info.uncompressed_size) {
+				    zf = zuncompress (zf);
+				    if (select < 0 || zfile_gettype (zf)) {
+					we_have_file = 1;
+				    }
 				}
 			    }
 			}
@@ -590,6 +1031,8 @@ struct zfile *zfile_fopen (const char *name, const char *mode)
 	}
     }
     l->f = f;
+    if (!strcasecmp (mode, "rb"))
+	zfile_map (l);
     l = zuncompress (l);
     return l;
 }
@@ -611,7 +1054,7 @@ int zfile_exists (const char *name)
 
 int zfile_iscompressed (struct zfile *z)
 {
-    return z->data ? 1 : 0;
+    return (z->data && !z->mapped) || z->index ? 1 : 0;
 }
 
 struct zfile *zfile_fopen_empty (const char *name, int size)
@@ -627,15 +1070,14 @@ struct zfile *zfile_fopen_empty (const char *name, int size)
 
 long zfile_ftell (struct zfile *z)
 {
-    if (z->data)
+    if (z->data || z->index)
 	return z->seek;
     return ftell (z->f);
 }
 
 int zfile_fseek (struct zfile *z, long offset, int mode)
 {
-    if (z->data) {
-	int old = z->seek;
+    if (z->data || z->index) {
 	switch (mode) {
 	    case SEEK_SET:
 		z->seek = offset;
@@ -644,12 +1086,12 @@ int zfile_fseek (struct zfile *z, long offset, int mode)
 		z->seek += offset;
 		break;
 	    case SEEK_END:
-		z->seek = z->size - offset;
+		z->seek = z->size + offset;
 		break;
 	}
 	if (z->seek < 0) z->seek = 0;
 	if (z->seek > z->size) z->seek = z->size;
-	return old;
+	return 0;
     }
     return fseek (z->f, offset, mode);
 }
@@ -657,12 +1099,18 @@ int zfile_fseek (struct zfile *z, long offset, int mode)
 size_t zfile_fread  (void *b, size_t l1, size_t l2, struct zfile *z)
 {
     long len = l1 * l2;
+    if (z->index) {
+	len = zindex_read (z->index, b, z->seek, len);
+	z->seek += len;
+	return l1 ? len / l1 : 0;
+    }
     if (z->data) {
 	if (z->seek + len > z->size)
 	    len = z->size - z->seek;
 	memcpy (b, z->data + z->seek, len);
 	z->seek += len;
-	return len;
+	/* whole items, like fread () */
+	return l1 ? len / l1 : 0;
     }
     return fread (b, l1, l2, z->f);
 }
@@ -670,6 +1118,8 @@ size_t zfile_fread  (void *b, size_t l1, size_t l2, struct zfile *z)
 size_t zfile_fwrite  (const void *b, size_t l1, size_t l2, struct zfile *z)
 {
     long len = l1 * l2;
+    if (z->mapped || z->index)
+	return 0;
     if (z->data) {
 	if (z->seek + len > z->size)
 	    len = z->size - z->seek;
@@ -739,27 +1189,195 @@ int zfile_zcompress (struct zfile *f, void *src, int size)
     return zs.total_out;
 }
 
+/* Block compression: the data is cut into blocks that are compressed as
+ * separate zlib streams, so that several threads can work on them. Laid
+ * out as the block size, the number of blocks and the compressed size of
+ * each, all big-endian longs, then the blocks. A block that does not get
+ * smaller is stored as is, with ZBLOCK_STORED set in its size. */
+#define ZBLOCK_STORED 0x80000000
+#define ZBLOCK_WORKERS 4
+
+struct zblock_work {
+    const uae_u8 *src;
+    int size, blocksize, nblocks, next;
+    uae_u8 *out;
+    uLong bound;
+    uae_u32 *sizes;
+#ifdef SUPPORT_THREADS
+    uae_sem_t lock;
+#endif
+};
+
+static void zblock_compress (struct zblock_work *w, int i)
+{
+    const uae_u8 *src = w->src + i * w->blocksize;
+    uae_u8 *out = w->out + i * w->bound;
+    uLong len = w->size - i * w->blocksize;
+    uLongf outlen = w->bound;
+
+    if (len > (uLong)w->blocksize)
+	len = w->blocksize;
+    if (compress2 (out, &outlen, src, len, Z_BEST_SPEED) != Z_OK || outlen >= len) {
+	memcpy (out, src, len);
+	w->sizes[i] = len | ZBLOCK_STORED;
+    } else {
+	w->sizes[i] = outlen;
+    }
+}
+
+#ifdef SUPPORT_THREADS
+static void *zblock_worker (void *arg)
+{
+    struct zblock_work *w = arg;
+    int i;
+
+    for (;;) {
+	uae_sem_wait (&w->lock);
+	i = w->next++;
+	uae_sem_post (&w->lock);
+	if (i >= w->nblocks)
+	    break;
+	zblock_compress (w, i);
+    }
+    return 0;
+}
+#endif
+
+static void put_be32 (uae_u8 *p, uae_u32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uae_u32 get_be32 (const uae_u8 *p)
+{
+    return ((uae_u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Compress SIZE bytes at SRC to F in blocks of BLOCKSIZE bytes. Returns
+ * the number of bytes written, 0 if nothing could be. */
+int zfile_zcompress_blocks (struct zfile *f, const void *src, int size, int blocksize)
+{
+    struct zblock_work w;
+    uae_u8 *hdr;
+    int i, hdrlen, total;
+
+    if (!zlib_test () || size <= 0 || blocksize <= 0)
+	return 0;
+    w.src = src;
+    w.size = size;
+    w.blocksize = blocksize;
+    w.nblocks = (size + blocksize - 1) / blocksize;
+    w.next = 0;
+    w.bound = compressBound (blocksize);
+    w.out = malloc (w.nblocks * w.bound);
+    hdrlen = 4 + 4 + 4 * w.nblocks;
+    hdr = malloc (hdrlen);
+    w.sizes = malloc (w.nblocks * sizeof *w.sizes);
+    if (!w.out || !hdr || !w.sizes) {
+	free (w.out);
+	free (hdr);
+	free (w.sizes);
+	return 0;
+    }
+
+#ifdef SUPPORT_THREADS
+    if (w.nblocks > 1) {
+	uae_thread_id tid[ZBLOCK_WORKERS - 1];
+	int nthreads = 0;
+
+	uae_sem_init (&w.lock, 0, 1);
+	while (nthreads < ZBLOCK_WORKERS - 1 && nthreads < w.nblocks - 1
+	       && uae_start_thread (zblock_worker, &w, &tid[nthreads]))
+	    nthreads++;
+	zblock_worker (&w);
+	for (i = 0; i < nthreads; i++)
+	    uae_wait_thread (tid[i]);
+	uae_sem_destroy (&w.lock);
+    } else
+#endif
+    for (i = 0; i < w.nblocks; i++)
+	zblock_compress (&w, i);
+
+    put_be32 (hdr, blocksize);
+    put_be32 (hdr + 4, w.nblocks);
+    for (i = 0; i < w.nblocks; i++)
+	put_be32 (hdr + 8 + 4 * i, w.sizes[i]);
+    zfile_fwrite (hdr, 1, hdrlen, f);
+    total = hdrlen;
+    for (i = 0; i < w.nblocks; i++) {
+	uae_u32 len = w.sizes[i] & ~ZBLOCK_STORED;
+	zfile_fwrite (w.out + i * w.bound, 1, len, f);
+	total += len;
+    }
+    free (w.out);
+    free (hdr);
+    free (w.sizes);
+    return total;
+}
+
+/* Read SRCSIZE bytes of blocks written by zfile_zcompress_blocks () from
+ * SRC into DST. Returns the number of bytes restored. */
+int zfile_zuncompress_blocks (void *dst, int dstsize, struct zfile *src, int srcsize)
+{
+    uae_u8 tmp[8], *hdr = 0, *buf = 0;
+    uae_u8 *out = dst;
+    int blocksize, nblocks, i, done = 0;
+
+    if (!zlib_test () || srcsize < 8 || zfile_fread (tmp, 8, 1, src) != 1)
+	return 0;
+    blocksize = get_be32 (tmp);
+    nblocks = get_be32 (tmp + 4);
+    if (dstsize <= 0 || blocksize <= 0 || nblocks <= 0 || nblocks > (srcsize - 8) / 4)
+	return 0;
+    /* The same block size is used for every chunk, so it may be larger
+     * than DST, but no block can hold more than DST does. */
+    if (blocksize > dstsize)
+	blocksize = dstsize;
+    hdr = malloc (4 * nblocks);
+    buf = malloc (compressBound (blocksize));
+    if (!hdr || !buf || zfile_fread (hdr, 4 * nblocks, 1, src) != 1)
+	goto end;
+    for (i = 0; i < nblocks && done < dstsize; i++) {
+	uae_u32 size = get_be32 (hdr + 4 * i);
+	uae_u32 len = size & ~ZBLOCK_STORED;
+	uLongf outlen = dstsize - done < blocksize ? dstsize - done : blocksize;
+
+	if (len > compressBound (blocksize) || zfile_fread (buf, 1, len, src) != len)
+	    break;
+	if (size & ZBLOCK_STORED) {
+	    if (len < outlen)
+		outlen = len;
+	    memcpy (out + done, buf, outlen);
+	} else if (uncompress (out + done, &outlen, buf, len) != Z_OK) {
+	    break;
+	}
+	done += outlen;
+    }
+end:
+    free (hdr);
+    free (buf);
+    return done;
+}
+
 uae_u32 zfile_crc32 (struct zfile *f)
 {
-    uae_u8 *p;
-    int pos, size;
-    uae_u32 crc;
+    uae_u8 buf[65536];
+    long pos;
+    size_t len;
+    uLong crc;
 
     if (!f)
 	return 0;
     if (f->data)
 	return get_crc32 (f->data, f->size);
     pos = zfile_ftell (f);
-    zfile_fseek (f, 0, SEEK_END);
-    size = zfile_ftell (f);
-    p = xmalloc (size);
-    if (!p)
-	return 0;
-    memset (p, 0, size);
     zfile_fseek (f, 0, SEEK_SET);
-    zfile_fread (p, 1, size, f);
+    crc = crc32 (0, Z_NULL, 0);
+    while ((len = zfile_fread (buf, 1, sizeof buf, f)) > 0)
+	crc = crc32 (crc, buf, len);
     zfile_fseek (f, pos, SEEK_SET);
-    crc = get_crc32 (p, size);
-    free (p);
     return crc;
 }